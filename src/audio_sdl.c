@@ -0,0 +1,116 @@
+#include <string.h>
+#include "audio_sdl.h"
+#include "logger.h"
+
+/*
+    audio_sdl.c plays the sound timer as a square wave:
+    - beeper_set (emulation thread) stamps state changes with the performance counter and appends them to the ring
+    - The SDL audio callback renders one buffer per call: buffer sample i stands for the time one buffer before the
+      callback plus i samples, so an event lands at its own offset within the buffer and edges keep their spacing
+    - No locks, no allocation and no SDL calls other than the performance counter on either side
+*/
+
+static void beeper_callback(void *userdata, Uint8 *stream, int len)
+{
+    Beeper *b = userdata;
+    int16_t *out = (int16_t *)stream;
+    int count = len / (int)sizeof(int16_t);
+    uint64_t now = SDL_GetPerformanceCounter();
+    uint64_t start = now - b->delay;        // Time the first sample of this buffer stands for
+    uint32_t period = (uint32_t)b->frequency / AUDIO_TONE_HZ;
+    uint32_t head = atomic_load_explicit(&b->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&b->tail, memory_order_acquire);
+
+    for (int i = 0; i < count; )
+    {
+        // Fill up to the next event that falls inside this buffer, or to its end
+        int until = count;
+        const AudioEvent *e = head != tail ? &b->events[head % AUDIO_QUEUE] : NULL;
+        if (e)
+        {
+            uint64_t offset = e->at > start ? (e->at - start) * (uint64_t)b->frequency / b->tick_hz : 0;
+            if (offset < (uint64_t)count)
+                until = offset > (uint64_t)i ? (int)offset : i;
+            else
+                e = NULL;   // Due in a later buffer
+        }
+        for (; i < until; i++)
+        {
+            int16_t level = b->phase < period / 2 ? AUDIO_VOLUME : -AUDIO_VOLUME;
+            out[i] = b->tone ? level : 0;
+            b->phase = b->phase + 1 < period ? b->phase + 1 : 0;
+        }
+        if (e)
+        {
+            b->tone = e->on;
+            uint64_t played = now + (uint64_t)i * b->tick_hz / (uint64_t)b->frequency;
+            uint64_t latency = played > e->at ? played - e->at : 0;
+            atomic_fetch_add_explicit(&b->latency_sum, latency, memory_order_relaxed);
+            atomic_fetch_add_explicit(&b->latency_count, 1, memory_order_relaxed);
+            if (latency > atomic_load_explicit(&b->latency_max, memory_order_relaxed))
+                atomic_store_explicit(&b->latency_max, latency, memory_order_relaxed);
+            head++;
+        }
+    }
+    atomic_store_explicit(&b->head, head, memory_order_release);
+}
+
+void beeper_open(Beeper *b, int samples)
+{
+    memset(b, 0, sizeof(*b));
+    b->tick_hz = SDL_GetPerformanceFrequency();
+    SDL_AudioSpec want = {
+        .freq = AUDIO_FREQUENCY,
+        .format = AUDIO_S16SYS,
+        .channels = 1,
+        .samples = (Uint16)samples,
+        .callback = beeper_callback,
+        .userdata = b
+    };
+    SDL_AudioSpec have;
+    b->device = SDL_OpenAudioDevice(NULL, 0, &want, &have,
+        SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+    if (!b->device)
+    {
+        log_msg(LOG_WARN, "No audio, the sound timer stays silent: %s", SDL_GetError());
+        return;
+    }
+    if (have.freq < AUDIO_TONE_HZ * 2 || !have.samples)
+    {
+        log_msg(LOG_WARN, "No audio, unusable device format (%d Hz, %d samples)", have.freq, have.samples);
+        SDL_CloseAudioDevice(b->device);
+        b->device = 0;
+        return;
+    }
+    b->frequency = have.freq;
+    b->samples = have.samples;
+    b->delay = (uint64_t)b->samples * b->tick_hz / (uint64_t)b->frequency;
+    log_msg(LOG_INFO, "audio: %d Hz, %d-sample buffer, %.1f ms latency", b->frequency, b->samples,
+        b->delay * 1000.0 / b->tick_hz);
+    SDL_PauseAudioDevice(b->device, 0);
+}
+
+void beeper_close(Beeper *b)
+{
+    if (!b->device)
+        return;
+    SDL_CloseAudioDevice(b->device);
+    b->device = 0;
+    uint32_t count = atomic_load(&b->latency_count);
+    if (count)
+        log_msg(LOG_INFO, "audio latency: %.1f ms average, %.1f ms worst over %u tone changes",
+            atomic_load(&b->latency_sum) * 1000.0 / count / b->tick_hz,
+            atomic_load(&b->latency_max) * 1000.0 / b->tick_hz, count);
+}
+
+void beeper_set(Beeper *b, bool on)
+{
+    if (!b->device || on == b->queued_tone)
+        return;
+    uint32_t tail = atomic_load_explicit(&b->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&b->head, memory_order_acquire) == AUDIO_QUEUE)
+        return;     // Full: the callback stalled, the change is queued by a later call
+    b->events[tail % AUDIO_QUEUE] = (AudioEvent){ .at = SDL_GetPerformanceCounter(), .on = on };
+    atomic_store_explicit(&b->tail, tail + 1, memory_order_release);
+    b->queued_tone = on;
+}
@@ -0,0 +1,64 @@
+#ifndef AUDIO_SDL_H
+#define AUDIO_SDL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <SDL2/SDL.h>
+
+/* Square-wave beeper sounding while the VM's sound timer is non-zero.
+    The emulation thread pushes timestamped on/off events into a single-producer single-consumer ring; the SDL
+    audio callback pops them without locking and starts or stops the tone at the sample matching the event's time
+    plus one buffer of delay. That fixed delay is the output latency: every edge keeps its spacing, whatever the
+    callback's wake-up jitter, and the CPU loop never waits on the audio device */
+
+#define AUDIO_FREQUENCY 48000       // Requested sample rate
+#define AUDIO_DEFAULT_SAMPLES 512   // Requested buffer size in samples (~10.7 ms at 48 kHz)
+#define AUDIO_MIN_SAMPLES 64
+#define AUDIO_MAX_SAMPLES 8192
+#define AUDIO_TONE_HZ 440           // Beep pitch
+#define AUDIO_VOLUME 3000           // Square wave amplitude (signed 16-bit)
+#define AUDIO_QUEUE 256             // Events in flight, power of two
+
+typedef struct {
+    uint64_t at;        // Performance counter when the sound timer changed state
+    bool on;
+} AudioEvent;
+
+typedef struct {
+    SDL_AudioDeviceID device;   // 0 if audio couldn't be opened, the beeper is then silent
+    int frequency;              // Sample rate and buffer size the device granted
+    int samples;
+    uint64_t delay;             // Performance-counter ticks every event is delayed by (one buffer)
+    uint64_t tick_hz;           // Performance-counter frequency
+
+    // Ring: the emulation thread owns tail, the callback owns head
+    AudioEvent events[AUDIO_QUEUE];
+    _Alignas(64) _Atomic uint32_t tail;
+    _Alignas(64) _Atomic uint32_t head;
+
+    // Callback state
+    bool tone;                  // Square wave currently sounding
+    uint32_t phase;             // Samples into the current wave period
+
+    // Emulation thread state
+    bool queued_tone;           // State of the last event queued
+
+    // Measured by the callback: event-to-sample latency, ticks
+    _Atomic uint64_t latency_sum;
+    _Atomic uint64_t latency_max;
+    _Atomic uint32_t latency_count;
+} Beeper;
+
+/* Opens the default audio device with a buffer of `samples` samples, starts the callback and logs the latency.
+    A missing audio device isn't fatal: the beeper stays silent */
+void beeper_open(Beeper *b, int samples);
+
+// Stops the callback, closes the device and logs the measured latency
+void beeper_close(Beeper *b);
+
+/* Emulation thread: turns the tone on or off from now on. Only changes are queued; if the ring is full the
+    change is retried on the next call */
+void beeper_set(Beeper *b, bool on);
+
+#endif
@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include "batch.h"
+#include "pool.h"
+#include "logger.h"
+
+/*
+    batch.c runs a list of ROMs in parallel:
+    - Every ROM gets a fresh VM, workers only share the read-only job list, ROM library and movies
+    - Per-worker JITs, since a code cache belongs to a single VM at a time
+*/
+
+typedef struct {
+    BatchJob *jobs;
+    const RomLib *lib;
+    const RunConfig *cfg;
+    Chip8Jit *jits;     // One per worker, NULL when interpreting
+} Batch;
+
+static void batch_job(void *ctx, size_t index, unsigned worker)
+{
+    Batch *b = ctx;
+    BatchJob *job = &b->jobs[index];
+    Chip8 *vm = malloc(sizeof(Chip8));
+    if (!vm || chip8_init(vm) || romlib_load(b->lib, job->rom, vm))
+    {
+        job->load_failed = true;
+        free(vm);
+        return;
+    }
+
+    RunConfig cfg = *b->cfg;
+    cfg.jit = NULL;
+    cfg.rewind = NULL;
+    cfg.trace = NULL;
+    cfg.dump = NULL;
+    MoviePlayer player;
+    cfg.movie = NULL;
+    if (job->movie)
+    {
+        movie_play_start(&player, job->movie, vm);
+        cfg.movie = &player;
+    }
+    if (b->jits)
+    {
+        cfg.jit = &b->jits[worker];
+        chip8_jit_flush(cfg.jit);
+    }
+    if (runner_run(vm, &cfg, &job->result))
+        job->load_failed = true;
+    free(vm);
+}
+
+bool batch_run(BatchJob *jobs, size_t count, const RomLib *lib, const RunConfig *cfg, bool use_jit, unsigned threads)
+{
+    Batch b = { .jobs = jobs, .lib = lib, .cfg = cfg };
+    if (threads == 0) threads = 1;
+    if (use_jit)
+    {
+        b.jits = calloc(threads, sizeof(Chip8Jit));
+        if (!b.jits)
+            return true;
+        for (unsigned i = 0; i < threads; i++)
+        {
+            if (chip8_jit_init(&b.jits[i]))
+            {
+                for (unsigned k = 0; k < i; k++)
+                    chip8_jit_cleanup(&b.jits[k]);
+                free(b.jits);
+                return true;
+            }
+        }
+    }
+
+    bool failed = pool_run(count, threads, batch_job, &b);
+
+    if (b.jits)
+    {
+        for (unsigned i = 0; i < threads; i++)
+            chip8_jit_cleanup(&b.jits[i]);
+        free(b.jits);
+    }
+    return failed;
+}
@@ -0,0 +1,24 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "runner.h"
+#include "romlib.h"
+
+// One ROM of a batch and its outcome
+typedef struct {
+    const char *path;
+    uint32_t rom;           // RomEntry in the library given to batch_run
+    const Movie *movie;     // Input movie played on the ROM, NULL for none
+    bool load_failed;       // ROM couldn't be loaded, result is meaningless
+    RunResult result;
+} BatchJob;
+
+/* Runs every job on its own VM across `threads` workers (see pool.h), loading the ROMs from lib.
+    cfg->jit, cfg->rewind, cfg->trace and cfg->movie are ignored: use_jit gives each worker its own JIT, and each job
+    plays its own movie.
+Returns: true if the pool couldn't be started */
+bool batch_run(BatchJob *jobs, size_t count, const RomLib *lib, const RunConfig *cfg, bool use_jit, unsigned threads);
+
+#endif
@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "chip8.h"
+#include "chip8_jit.h"
+#include "runner.h"
+#include "logger.h"
+#ifdef CHIP8_PROFILE
+#include "profile.h"
+#endif
+
+/* Chip8 benchmark suite
+    Runs synthetic per-opcode-family loops and whole-program workloads on the interpreter and the JIT,
+    and prints ns/instruction and IPS (with warmup, repetitions and spread) as JSON.
+    A PROFILE=1 build also runs every workload on the interpreter with the guest profiler attached ("interp+profile")
+    Program usage: ./chip8-bench [-r repetitions] [-w warmup] [-n instructions_per_repetition] [-f name_filter] [rom ...] */
+
+#define BENCH_DEFAULT_REPS 10
+#define BENCH_DEFAULT_WARMUP 2
+#define BENCH_DEFAULT_INSTRUCTIONS 5000000
+#define BENCH_CHUNK 1000000     // Instructions per chip8_run call
+
+// Assembles a workload into a VM, at CHIP8_PC_START_INDEX
+typedef struct {
+    Chip8 *vm;
+    uint16_t at;
+} Assembler;
+
+static void emit(Assembler *a, uint16_t opcode)
+{
+    a->vm->memory[a->at] = (uint8_t)(opcode >> 8);
+    a->vm->memory[a->at + 1] = (uint8_t)opcode;
+    a->at += 2;
+}
+
+#define LOOP_START 0x202    // Workloads start with one setup instruction, then loop back here
+#define DATA 0x400          // Sprite / register-dump area, away from the code
+
+/* Every workload changes a register on each iteration, so that the interpreter's idle-loop detection
+    doesn't skip it (it only skips iterations that leave the whole VM state unchanged) */
+
+// 8XYn: every ALU operation on two registers, plus counters
+static void build_alu(Assembler *a)
+{
+    emit(a, 0x6B03);
+    static const uint16_t body[] = { 0x8AB4, 0x8AB5, 0x8AB1, 0x8AB2, 0x8AB3, 0x8AB6, 0x8ABE, 0x8AB7, 0x8AB0, 0x7A01, 0x7C01 };
+    for (size_t i = 0; i < sizeof(body) / sizeof(body[0]); i++)
+        emit(a, body[i]);
+    emit(a, 0x1000 | LOOP_START);
+}
+
+// Dxyn of the given height at moving coordinates
+static void build_draw(Assembler *a, int height)
+{
+    emit(a, 0xA000 | DATA);
+    emit(a, 0x7003);
+    emit(a, 0x7105);
+    emit(a, 0xD010 | height);
+    emit(a, 0x1000 | LOOP_START);
+    for (int i = 0; i < 15; i++)
+        a->vm->memory[DATA + i] = (uint8_t)(0xA5 ^ (i * 0x1F));
+}
+
+static void build_draw1(Assembler *a)  { build_draw(a, 1); }
+static void build_draw5(Assembler *a)  { build_draw(a, 5); }
+static void build_draw15(Assembler *a) { build_draw(a, 15); }
+
+// Fx55/Fx65: dump and reload all 16 registers
+static void build_regdump(Assembler *a)
+{
+    emit(a, 0xA000 | DATA);
+    emit(a, 0xFF55);
+    emit(a, 0x7001);
+    emit(a, 0xFF65);
+    emit(a, 0x1000 | LOOP_START);
+}
+
+// 2NNN/00EE: call a subroutine that only bumps a counter
+static void build_call(Assembler *a)
+{
+    emit(a, 0x6000);
+    emit(a, 0x2000 | (LOOP_START + 4));
+    emit(a, 0x1000 | LOOP_START);
+    emit(a, 0x7101);
+    emit(a, 0x00EE);
+}
+
+// Skips and jumps: a counter compared against a constant and another register, each skip guarding an increment
+static void build_branch(Assembler *a)
+{
+    emit(a, 0x6180);
+    emit(a, 0x7001);
+    emit(a, 0x3080);
+    emit(a, 0x7201);
+    emit(a, 0x4081);
+    emit(a, 0x7301);
+    emit(a, 0x5010);
+    emit(a, 0x7401);
+    emit(a, 0x9010);
+    emit(a, 0x7501);
+    emit(a, 0x1000 | LOOP_START);
+}
+
+// Cxnn feeding arithmetic
+static void build_rand(Assembler *a)
+{
+    emit(a, 0x6200);
+    emit(a, 0xC0FF);
+    emit(a, 0xC10F);
+    emit(a, 0x8014);
+    emit(a, 0x8215);
+    emit(a, 0x1000 | LOOP_START);
+}
+
+/* Whole-program mix shaped like a game frame: input polling, timer reads, random numbers,
+    index arithmetic, BCD, a subroutine and sprite drawing */
+static void build_game(Assembler *a)
+{
+    emit(a, 0x6E01);                        // 0x200  VE = 1
+    emit(a, 0x6500);                        // 0x202  loop: V5 = key
+    emit(a, 0xE59E);                        // 0x204  skip if key V5 pressed
+    emit(a, 0x7401);                        // 0x206  V4++ (player x)
+    emit(a, 0xE5A1);                        // 0x208  skip if key V5 not pressed
+    emit(a, 0x74FF);                        // 0x20A  V4--
+    emit(a, 0xF307);                        // 0x20C  V3 = DT
+    emit(a, 0x3300);                        // 0x20E  skip if V3 == 0
+    emit(a, 0x1000 | LOOP_START);           // 0x210  wait for the timer
+    emit(a, 0xC73F);                        // 0x212  V7 = random x
+    emit(a, 0xC81F);                        // 0x214  V8 = random y
+    emit(a, 0x2000 | 0x22A);                // 0x216  call draw
+    emit(a, 0xA000 | DATA);                 // 0x218  I = score digits
+    emit(a, 0xF433);                        // 0x21A  BCD V4
+    emit(a, 0xF265);                        // 0x21C  load V0..V2
+    emit(a, 0xF029);                        // 0x21E  I = font digit V0
+    emit(a, 0xD785);                        // 0x220  draw it
+    emit(a, 0x8E4E);                        // 0x222  VE = V4 << 1
+    emit(a, 0xF31E);                        // 0x224  I += V3
+    emit(a, 0x1000 | LOOP_START);           // 0x226
+    emit(a, 0x0000);                        // 0x228  padding
+    emit(a, 0xA000 | (DATA + 0x10));        // 0x22A  draw: I = sprite
+    emit(a, 0xD783);                        // 0x22C
+    emit(a, 0x00EE);                        // 0x22E
+    for (int i = 0; i < 3; i++)
+        a->vm->memory[DATA + 0x10 + i] = 0x7E;
+}
+
+typedef struct {
+    const char *name;
+    void (*build)(Assembler *a);
+} Workload;
+
+static const Workload workloads[] = {
+    { "alu_8xyn", build_alu },
+    { "draw_dxy1", build_draw1 },
+    { "draw_dxy5", build_draw5 },
+    { "draw_dxyf", build_draw15 },
+    { "regs_fx55_fx65", build_regdump },
+    { "call_2nnn_00ee", build_call },
+    { "branch_skip_jump", build_branch },
+    { "rand_cxnn", build_rand },
+    { "program_game_mix", build_game },
+};
+
+typedef struct {
+    uint32_t reps;
+    uint32_t warmup;
+    uint64_t instructions;  // Per repetition
+    const char *filter;     // Only run workloads whose name contains this (NULL = all)
+} BenchConfig;
+
+/* Executes `instructions` on a fresh copy of proto, returns the elapsed seconds (negative on a VM error) */
+static double time_run(const Chip8 *proto, Chip8 *vm, Chip8Jit *jit, bool profiled, uint64_t instructions)
+{
+    *vm = *proto;
+#ifdef CHIP8_PROFILE
+    static Chip8Profile profile;
+    vm->profile = profiled ? &profile : NULL;
+    if (profiled)
+        profile_reset(&profile, vm->pc);
+#else
+    (void)profiled;
+#endif
+    if (jit)
+        chip8_jit_flush(jit);
+    double start = runner_now();
+    while (instructions)
+    {
+        uint32_t budget = instructions < BENCH_CHUNK ? (uint32_t)instructions : BENCH_CHUNK;
+        uint32_t executed = 0;
+        bool failed = jit ? chip8_jit_run(jit, vm, budget, &executed) : chip8_run(vm, budget, &executed);
+        if (failed)
+            return -1;
+        instructions -= executed;
+    }
+    return runner_now() - start;
+}
+
+static bool first_result = true;
+
+// Prints s as a JSON string literal
+static void print_json_string(const char *s)
+{
+    putchar('"');
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            printf("\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            printf("\\u%04x", *s);
+        else
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+// Benchmarks one loaded program on one engine and prints its JSON record. Returns true on a VM error
+static bool bench_one(const char *name, const Chip8 *proto, Chip8Jit *jit, bool profiled, const BenchConfig *cfg)
+{
+    static Chip8 vm;
+    double *ns = malloc(cfg->reps * sizeof(double));
+    if (!ns)
+        return true;
+    double sum = 0, min = INFINITY, max = 0;
+    for (uint32_t r = 0; r < cfg->warmup + cfg->reps; r++)
+    {
+        double seconds = time_run(proto, &vm, jit, profiled, cfg->instructions);
+        if (seconds < 0)
+        {
+            log_msg(LOG_ERROR, "benchmark '%s' hit an invalid instruction", name);
+            free(ns);
+            return true;
+        }
+        if (r < cfg->warmup)
+            continue;
+        double v = seconds * 1e9 / cfg->instructions;
+        ns[r - cfg->warmup] = v;
+        sum += v;
+        if (v < min) min = v;
+        if (v > max) max = v;
+    }
+    double mean = sum / cfg->reps, var = 0;
+    for (uint32_t r = 0; r < cfg->reps; r++)
+        var += (ns[r] - mean) * (ns[r] - mean);
+    double stddev = cfg->reps > 1 ? sqrt(var / (cfg->reps - 1)) : 0;
+    free(ns);
+
+    printf("%s\n    {\"name\": ", first_result ? "" : ",");
+    print_json_string(name);
+    printf(", \"engine\": \"%s\", \"instructions\": %llu, \"reps\": %u, "
+           "\"ns_per_instruction\": {\"mean\": %.4f, \"stddev\": %.4f, \"min\": %.4f, \"max\": %.4f}, "
+           "\"ips\": {\"mean\": %.0f, \"best\": %.0f}}",
+        jit ? "jit" : profiled ? "interp+profile" : "interp", (unsigned long long)cfg->instructions, cfg->reps,
+        mean, stddev, min, max, 1e9 / mean, 1e9 / min);
+    first_result = false;
+    fflush(stdout);
+    return false;
+}
+
+// Runs a program on both engines (and on the profiled interpreter in PROFILE=1 builds)
+static bool bench_program(const char *name, const Chip8 *proto, Chip8Jit *jit, const BenchConfig *cfg)
+{
+    if (cfg->filter && !strstr(name, cfg->filter))
+        return false;
+    bool failed = bench_one(name, proto, NULL, false, cfg);
+#ifdef CHIP8_PROFILE
+    failed |= bench_one(name, proto, NULL, true, cfg);
+#endif
+    if (jit)
+        failed |= bench_one(name, proto, jit, false, cfg);
+    return failed;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: chip8-bench [-r repetitions] [-w warmup] [-n instructions_per_repetition] [-f name_filter] [rom ...]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static Chip8 proto;
+    static Chip8Jit jit;
+    BenchConfig cfg = { .reps = BENCH_DEFAULT_REPS, .warmup = BENCH_DEFAULT_WARMUP, .instructions = BENCH_DEFAULT_INSTRUCTIONS };
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i += 2)   // Read options
+    {
+        if (i + 1 >= argc)
+        {
+            usage();
+            return 1;
+        }
+        char *end = NULL;
+        unsigned long long v = strtoull(argv[i + 1], &end, 0);
+        bool number = argv[i + 1][0] && !*end;
+        if (!strcmp(argv[i], "-f"))                 cfg.filter = argv[i + 1];
+        else if (!strcmp(argv[i], "-r") && number && v > 0 && v <= UINT32_MAX) cfg.reps = (uint32_t)v;
+        else if (!strcmp(argv[i], "-w") && number && v <= UINT32_MAX)          cfg.warmup = (uint32_t)v;
+        else if (!strcmp(argv[i], "-n") && number && v > 0)                    cfg.instructions = v;
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    Chip8Jit *jitp = chip8_jit_init(&jit) ? NULL : &jit;   // Interpreter only if no executable memory
+    printf("{\n  \"suite\": \"chip8-bench\",\n  \"config\": {\"reps\": %u, \"warmup\": %u, \"instructions\": %llu},\n"
+           "  \"results\": [", cfg.reps, cfg.warmup, (unsigned long long)cfg.instructions);
+
+    int status = 0;
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++)
+    {
+        chip8_init(&proto);
+        Assembler a = { .vm = &proto, .at = CHIP8_PC_START_INDEX };
+        workloads[w].build(&a);
+        chip8_verify(&proto);
+        status |= bench_program(workloads[w].name, &proto, jitp, &cfg);
+    }
+    for (; i < argc; i++)   // Whole ROMs from the command line
+    {
+        char name[512];
+        snprintf(name, sizeof(name), "rom:%s", argv[i]);
+        if (chip8_init(&proto) || chip8_load_rom(&proto, argv[i]))
+        {
+            status = 1;
+            continue;
+        }
+        status |= bench_program(name, &proto, jitp, &cfg);
+    }
+    printf("\n  ]\n}\n");
+    if (jitp)
+        chip8_jit_cleanup(jitp);
+    return status;
+}
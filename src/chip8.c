@@ -1,7 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "chip8.h"
 #include "logger.h"
+#ifdef CHIP8_PROFILE
+#include "profile.h"
+#endif
 
 /* chip8.c is responsible to handle the chip-8 VM-
     Initializes the vm and translates + executes opcodes
@@ -32,7 +36,8 @@ static const uint8_t chip8_font[80] = {
 bool chip8_init(Chip8 *p)
 {
     // Maybe first set all bits to 0 and then check start index? not sure if required- but will be safer
-    *p = (Chip8){ .pc = CHIP8_PC_START_INDEX, .keys = {0} };
+    *p = (Chip8){ .pc = CHIP8_PC_START_INDEX, .keys = {0}, .dirty_rows = UINT32_MAX, .fuse = true };
+    chip8_seed(p, CHIP8_DEFAULT_SEED);
 
     // Load fontset into memory starting at 0x050
     for (int i = 0; i < 80; i++)
@@ -44,6 +49,80 @@ bool chip8_init(Chip8 *p)
     return false;
 }
 
+/* Seeds the VM's Cxnn random generator, each VM has its own state so runs are reproducible and thread-safe */
+void chip8_seed(Chip8 *p, uint32_t seed)
+{
+    p->rng_state = seed ? seed : CHIP8_DEFAULT_SEED;   // xorshift state must be non-zero
+}
+
+/* xorshift32 step */
+static uint8_t chip8_rand(Chip8 *p)
+{
+    uint32_t x = p->rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    p->rng_state = x;
+    return (uint8_t)(x >> 24);
+}
+
+/* Decrements the 60 Hz delay and sound timers, call once per emulated frame */
+void chip8_tick_timers(Chip8 *p)
+{
+    if (p->delay_timer) p->delay_timer--;
+    if (p->sound_timer) p->sound_timer--;
+}
+
+/* Returns a 64-bit FNV-1a hash of the display.
+    Each row word is hashed most significant byte first, so the value doesn't depend on host endianness */
+uint64_t chip8_display_hash(const Chip8 *p)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++)
+    {
+        for (int b = 7; b >= 0; b--)
+        {
+            hash ^= (uint8_t)(p->display[y] >> (b * 8));
+            hash *= 0x100000001B3ull;
+        }
+    }
+    return hash;
+}
+
+void chip8_idle_reset(Chip8IdleProbe *probe)
+{
+    probe->pc = CHIP8_MEM_SIZE;
+    probe->armed = false;
+}
+
+/* Feeds the probe after a backward jump, p->pc being the jump target and count the instructions executed so far.
+    Registers are compared first, the stack only once they matched on the previous iteration, so counting loops
+    cost a few compares per iteration.
+Returns: the loop length in instructions if the iteration just completed was idle, 0 otherwise */
+uint32_t chip8_idle_probe(Chip8IdleProbe *probe, const Chip8 *p, uint32_t writes, uint32_t count)
+{
+    uint64_t v[2];
+    memcpy(v, p->V, sizeof(v));
+    bool same = probe->pc == p->pc && probe->writes == writes && probe->I == p->I && probe->sp == p->sp
+        && probe->v[0] == v[0] && probe->v[1] == v[1];
+    if (same && probe->armed && !memcmp(probe->stack, p->stack, sizeof(p->stack)))
+        return count - probe->count;
+
+    probe->pc = p->pc;
+    probe->I = p->I;
+    probe->sp = p->sp;
+    probe->writes = writes;
+    probe->count = count;
+    probe->v[0] = v[0];
+    probe->v[1] = v[1];
+    probe->armed = same;
+    if (same)
+        memcpy(probe->stack, p->stack, sizeof(p->stack));
+    return 0;
+}
+
+/* Reads a ROM file into memory at CHIP8_PC_START_INDEX.
+Returns: true if the file can't be read or doesn't fit in memory */
 bool chip8_load_rom(Chip8 *p, char *filename)
 {
     FILE *f = fopen(filename, "rb");
@@ -52,453 +131,598 @@ bool chip8_load_rom(Chip8 *p, char *filename)
         log_msg(LOG_ERROR, "Couldn't open file: '%s'", filename);
         return true;
     }
-    fread(p->memory + CHIP8_PC_START_INDEX, 1, CHIP8_MEM_SIZE - CHIP8_PC_START_INDEX, f);    // Reads the rom bytes into the vm instance memory
+    size_t len = fread(p->memory + CHIP8_PC_START_INDEX, 1, CHIP8_ROM_MAX_SIZE, f);    // Reads the rom bytes into the vm instance memory
+    bool failed = ferror(f) != 0;
+    bool too_big = !failed && len == CHIP8_ROM_MAX_SIZE && fgetc(f) != EOF;
     fclose(f);
+    chip8_verify(p);
+    if (failed)
+        log_msg(LOG_ERROR, "Couldn't read file: '%s'", filename);
+    if (too_big)
+        log_msg(LOG_ERROR, "ROM '%s' is larger than %d bytes", filename, CHIP8_ROM_MAX_SIZE);
+    return failed || too_big;
+}
+
+/* Copies a ROM image into memory at CHIP8_PC_START_INDEX.
+Returns: true if it doesn't fit in memory */
+bool chip8_load_rom_mem(Chip8 *p, const uint8_t *rom, size_t len)
+{
+    if (len > CHIP8_ROM_MAX_SIZE)
+    {
+        log_msg(LOG_ERROR, "ROM is larger than %d bytes", CHIP8_ROM_MAX_SIZE);
+        return true;
+    }
+    memcpy(p->memory + CHIP8_PC_START_INDEX, rom, len);
+    chip8_verify(p);
     return false;
 }
 
-/* Fetches the next instruction from vm's memory at pc (program counter) and executes it, updates the vm values (p) accordingly.
-Returns: false if a command is invalid, true otherwise */
-bool chip8_cycle(Chip8 *p)
+/* Handler indexes stored in Chip8Decoded.op, named after the opcode pattern they execute */
+enum {
+    OP_UNDECODED = 0,
+    OP_0NNN, OP_00E0, OP_00EE,
+    OP_1NNN, OP_2NNN, OP_3XNN, OP_4XNN, OP_5XY0, OP_6XNN, OP_7XNN,
+    OP_8XY0, OP_8XY1, OP_8XY2, OP_8XY3, OP_8XY4, OP_8XY5, OP_8XY6, OP_8XY7, OP_8XYE,
+    OP_9XY0, OP_ANNN, OP_BNNN, OP_CXNN, OP_DXYN, OP_EX9E, OP_EXA1,
+    OP_FX07, OP_FX0A, OP_FX15, OP_FX18, OP_FX1E, OP_FX29, OP_FX33, OP_FX55, OP_FX65,
+    OP_DXYN_UNCHECKED, OP_FX33_UNCHECKED, OP_FX55_UNCHECKED, OP_FX65_UNCHECKED,  // Accesses chip8_verify proved in bounds
+    OP_6XNN_6XNN, OP_7XNN_ANNN, OP_ANNN_DXYN, OP_3XNN_1NNN, OP_4XNN_1NNN, OP_FX07_3XNN_1NNN,   // Superinstructions
+    OP_ILLEGAL,     // 5XYn/9XYn with n != 0
+    OP_UNKNOWN,
+    OP_COUNT
+};
+
+#ifdef CHIP8_PROFILE
+_Static_assert(OP_COUNT <= PROFILE_OPS, "profile op counters are too small");
+
+// Returns the opcode pattern a handler index executes, for profile output
+const char *chip8_op_name(unsigned op)
+{
+    static const char *const names[OP_COUNT] = {
+        "undecoded", "0NNN", "00E0", "00EE", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "6XNN", "7XNN",
+        "8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY6", "8XY7", "8XYE",
+        "9XY0", "ANNN", "BNNN", "CXNN", "DXYN", "EX9E", "EXA1",
+        "FX07", "FX0A", "FX15", "FX18", "FX1E", "FX29", "FX33", "FX55", "FX65",
+        "DXYN*", "FX33*", "FX55*", "FX65*",
+        "6XNN+6XNN", "7XNN+ANNN", "ANNN+DXYN", "3XNN+1NNN", "4XNN+1NNN", "FX07+3XNN+1NNN", "illegal", "unknown",
+    };
+    return op < OP_COUNT ? names[op] : "?";
+}
+#endif
+
+/* Translates a raw instruction into its handler index and operands */
+static void decode_instruction(Chip8Decoded *d, uint16_t instruction)
 {
-    // Fetch:
-    uint16_t instruction = fetch_instruction(p);
-    p->pc += 2; // Increment pc
-    p->draw_flag = false;
-    
-    // Decode instruction:
-    uint16_t NNN = instruction & 0x0FFF;
-    uint8_t NN = instruction & 0x00FF;
-    uint8_t N = instruction & 0x000F;
-    uint8_t X = (instruction & 0x0F00) >> 8;
-    uint8_t Y = (instruction & 0X00F0) >> 4;
+    d->opcode = instruction;
+    d->nnn = instruction & 0x0FFF;
+    d->nn = instruction & 0x00FF;
+    d->x = (instruction & 0x0F00) >> 8;
+    d->y = (instruction & 0x00F0) >> 4;
 
     switch (instruction & 0xF000)
     {
         case 0x0000:
-            switch (instruction)
-            {
-            case 0x00E0:
-                for (int i = 0; i < CHIP8_DISPLAY_WIDTH * CHIP8_DISPLAY_HEIGHT; i++)
-                    p->display[i] = 0;
-                p->draw_flag = true;
-                break;
-            case 0x00EE:
-                if(p->sp == 0)
-                {
-                    log_msg(LOG_ERROR, "chip8-vm stack underflow at PC=%X", p->pc - 2);
-                    return true;
-                }
-                p->sp--;
-                p->pc = p->stack[p->sp];
-                break;
-            default:
-                break;
-            }
+            d->op = instruction == 0x00E0 ? OP_00E0 : instruction == 0x00EE ? OP_00EE : OP_0NNN;
             break;
-        case 0x1000:
-            if (NNN >= CHIP8_MEM_SIZE || NNN < CHIP8_PC_START_INDEX)
+        case 0x1000: d->op = OP_1NNN; break;
+        case 0x2000: d->op = OP_2NNN; break;
+        case 0x3000: d->op = OP_3XNN; break;
+        case 0x4000: d->op = OP_4XNN; break;
+        case 0x5000: d->op = (instruction & 0x000F) ? OP_ILLEGAL : OP_5XY0; break;
+        case 0x6000: d->op = OP_6XNN; break;
+        case 0x7000: d->op = OP_7XNN; break;
+        case 0x8000:
+            switch (instruction & 0x000F)
             {
-                log_msg(LOG_ERROR, "illegal jump address: NNN=%X provided at PC=%X", NNN, p->pc - 2);
-                return true;
+                case 0x0000: d->op = OP_8XY0; break;
+                case 0x0001: d->op = OP_8XY1; break;
+                case 0x0002: d->op = OP_8XY2; break;
+                case 0x0003: d->op = OP_8XY3; break;
+                case 0x0004: d->op = OP_8XY4; break;
+                case 0x0005: d->op = OP_8XY5; break;
+                case 0x0006: d->op = OP_8XY6; break;
+                case 0x0007: d->op = OP_8XY7; break;
+                case 0x000E: d->op = OP_8XYE; break;
+                default:     d->op = OP_UNKNOWN; break;
             }
-            p->pc = NNN;
             break;
-        case 0x2000:
-            if (p->sp > CHIP8_STACK_SIZE - 1)
-            {
-                log_msg(LOG_ERROR, "memory stack overflow at PC=%X", p->pc - 2);
-                return true;
-            }
-            p->stack[p->sp++] = p->pc;
-            p->pc = NNN;
+        case 0x9000: d->op = (instruction & 0x000F) ? OP_ILLEGAL : OP_9XY0; break;
+        case 0xA000: d->op = OP_ANNN; break;
+        case 0xB000: d->op = OP_BNNN; break;
+        case 0xC000: d->op = OP_CXNN; break;
+        case 0xD000: d->op = OP_DXYN; break;
+        case 0xE000:
+            d->op = d->nn == 0x9E ? OP_EX9E : d->nn == 0xA1 ? OP_EXA1 : OP_UNKNOWN;
             break;
-        case 0x3000:
-            if (X < CHIP8_REGISTER_COUNT)
+        default:
+            switch (instruction & 0x00FF)
             {
-                if (p->V[X] == NN)
-                {
-                    p->pc += 2;
-                }
-            }
-            else
-            {
-                log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                return true;
+                case 0x0007: d->op = OP_FX07; break;
+                case 0x000A: d->op = OP_FX0A; break;
+                case 0x0015: d->op = OP_FX15; break;
+                case 0x0018: d->op = OP_FX18; break;
+                case 0x001E: d->op = OP_FX1E; break;
+                case 0x0029: d->op = OP_FX29; break;
+                case 0x0033: d->op = OP_FX33; break;
+                case 0x0055: d->op = OP_FX55; break;
+                case 0x0065: d->op = OP_FX65; break;
+                default:     d->op = OP_UNKNOWN; break;
             }
             break;
-        case 0x4000:
-            if (X < CHIP8_REGISTER_COUNT)
-            {
-                if (p->V[X] != NN)
-                {
-                    p->pc += 2;
-                }
-            }
-            else
-            {
-                log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                return true;
-            }
+    }
+}
+
+#ifdef CHIP8_PROFILE
+// Returns the handler index of a raw instruction, as decoded without fusion or proven accesses
+unsigned chip8_op_class(uint16_t instruction)
+{
+    Chip8Decoded d;
+    decode_instruction(&d, instruction);
+    return d.op;
+}
+#endif
+
+/* Decodes the cache entry of the instruction at addr (even, in memory), with the unchecked handler if
+    chip8_verify proved its memory access in bounds */
+static void decode_checked(Chip8 *p, Chip8Decoded *d, uint16_t addr)
+{
+    decode_instruction(d, (uint16_t)((p->memory[addr] << 8) | p->memory[addr + 1]));
+    if (!(p->proven[addr >> 4] & (1u << ((addr >> 1) & 7))))
+        return;
+    switch (d->op)
+    {
+        case OP_DXYN: d->op = OP_DXYN_UNCHECKED; break;
+        case OP_FX33: d->op = OP_FX33_UNCHECKED; break;
+        case OP_FX55: d->op = OP_FX55_UNCHECKED; break;
+        case OP_FX65: d->op = OP_FX65_UNCHECKED; break;
+        default: break;
+    }
+}
+
+/* Superinstructions: turns the entry at addr into a fused handler when it starts one of the common sequences below.
+    A fused handler executes its first instruction, then jumps straight to the next one's handler (see FUSED), so
+    the sequence pays for one fetch and one indirect dispatch. The entries it continues into are decoded here, and
+    chip8_invalidate_decoded drops the fused entry along with them */
+static void fuse(Chip8 *p, Chip8Decoded *d, uint16_t addr)
+{
+    if (addr > CHIP8_MEM_SIZE - 4)
+        return;
+    uint16_t second = (uint16_t)((p->memory[addr + 2] << 8) | p->memory[addr + 3]);
+    uint16_t third = addr <= CHIP8_MEM_SIZE - 6 ? (uint16_t)((p->memory[addr + 4] << 8) | p->memory[addr + 5]) : 0;
+    uint8_t op = OP_UNDECODED;
+    int length = 2;
+    switch (d->op)
+    {
+        case OP_6XNN:   // Register setup
+            if ((second & 0xF000) == 0x6000) op = OP_6XNN_6XNN;
             break;
-        case 0x5000:
-            if ((instruction & 0x000F) != 0) 
-            {
-                log_msg(LOG_ERROR, "illegal opcode %X at PC=%X", instruction, p->pc-2);
-                return true;
-            }
-            if (X < CHIP8_REGISTER_COUNT && Y < CHIP8_REGISTER_COUNT)
-            {
-                if (p->V[X] == p->V[Y])
-                {
-                    p->pc += 2;
-                }
-            }
-            else
-            {
-                log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                return true;
-            }
+        case OP_7XNN:   // Step an index, point I at a table
+            if ((second & 0xF000) == 0xA000) op = OP_7XNN_ANNN;
             break;
-        case 0x6000:
-            if (X < CHIP8_REGISTER_COUNT)
-            {
-                p->V[X] = NN;
-            }
-            else
-            {
-                log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                return true;
-            }
+        case OP_ANNN:   // Fixed sprite, only if it can't read past memory: the draw runs unchecked
+            if ((second & 0xF000) == 0xD000 && d->nnn + (second & 0x000F) <= CHIP8_MEM_SIZE) op = OP_ANNN_DXYN;
             break;
-        case 0x7000:
-            if (X < CHIP8_REGISTER_COUNT)
-            {
-                p->V[X] += NN;
-            }
-            else
-            {
-                log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                return true;
-            }
+        case OP_3XNN:   // Conditional branches
+            if ((second & 0xF000) == 0x1000) op = OP_3XNN_1NNN;
             break;
-        case 0x8000:
-            switch (instruction & 0x000F)
-            {
-                case 0x0000:
-                    if (X < CHIP8_REGISTER_COUNT && Y < CHIP8_REGISTER_COUNT)
-                    {
-                        p->V[X] = p->V[Y];
-                    }
-                    else
-                    {
-                        log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                        return true;
-                    }
-                    break;
-                case 0x0001:
-                    if (X < CHIP8_REGISTER_COUNT && Y < CHIP8_REGISTER_COUNT)
-                    {
-                        p->V[X] |= p->V[Y];
-                    }
-                    else
-                    {
-                        log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                        return true;
-                    }
-                    break;
-                case 0x0002:
-                    if (X < CHIP8_REGISTER_COUNT && Y < CHIP8_REGISTER_COUNT)
-                    {
-                        p->V[X] &= p->V[Y];
-                    }
-                    else
-                    {
-                        log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                        return true;
-                    }
-                    break;
-                case 0x0003:
-                    if (X < CHIP8_REGISTER_COUNT && Y < CHIP8_REGISTER_COUNT)
-                    {
-                        p->V[X] ^= p->V[Y];
-                    }
-                    else
-                    {
-                        log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                        return true;
-                    }
-                    break;
-                case 0x0004: {
-                    if (X < CHIP8_REGISTER_COUNT && Y < CHIP8_REGISTER_COUNT)
-                    {
-                        uint16_t sum = p->V[X] + p->V[Y];
-                        p->V[0xF] = (sum > 0xFF) ? 1 : 0;
-                        p->V[X] = (uint8_t)sum;
-                    }
-                    else
-                    {
-                        log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                        return true;
-                    } }
-                    break;
-                case 0x0005: {
-                    if (X < CHIP8_REGISTER_COUNT && Y < CHIP8_REGISTER_COUNT)
-                    {
-                        uint8_t borrow = p->V[X] >= p->V[Y];
-                        p->V[0xF] = borrow ? 1 : 0;
-                        p->V[X] = (uint8_t)(p->V[X] - p->V[Y]);
-                    }
-                    else
-                    {
-                        log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                        return true;
-                    } }
-                    break;
-                case 0x0006:
-                    if (X < CHIP8_REGISTER_COUNT)
-                    {
-                        //p->V[0xF] = p->V[X] & 0x01;
-                        //p->V[X] >>= 1;
-                        p->V[0xF] = p->V[X] & 0x01;
-                        p->V[X] = p->V[X] >> 1;
-                    }
-                    else
-                    {
-                        log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                        return true;
-                    }
-                    break;
-                case 0x0007: { 
-                    if (X < CHIP8_REGISTER_COUNT && Y < CHIP8_REGISTER_COUNT)
-                    {
-                        uint8_t borrow = (p->V[Y] >= p->V[X]);
-                        p->V[0xF] = borrow ? 1 : 0;
-                        p->V[X] = p->V[Y] - p->V[X];
-                    }
-                    else
-                    {
-                        log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                        return true;
-                    } }
-                    break;
-                case 0x000E:
-                    if (X < CHIP8_REGISTER_COUNT)
-                    {
-                        //p->V[0xF] = (p->V[X] >> 7) & 0x01;
-                        //p->V[X] <<= 1;
-                        p->V[0xF] = (p->V[X] >> 7) & 0x01;
-                        p->V[X] = p->V[X] << 1;
-                    }
-                    else
-                    {
-                        log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                        return true;
-                    }
-                    break;
-                default:
-                    log_msg(LOG_INFO, "Unknown opcode %X at PC=%X", instruction, p->pc - 2);
-                    return true;
-            }
+        case OP_4XNN:
+            if ((second & 0xF000) == 0x1000) op = OP_4XNN_1NNN;
             break;
-        case 0x9000:
-            if ((instruction & 0x000F) != 0) 
+        case OP_FX07:   // Timer wait: read the delay timer, leave the loop once it holds NN
+            if ((second & 0xFF00) == (0x3000 | d->x << 8) && (third & 0xF000) == 0x1000)
             {
-                log_msg(LOG_ERROR, "illegal opcode %X at PC=%X", instruction, p->pc-2);
-                return true;
+                op = OP_FX07_3XNN_1NNN;
+                length = 3;
             }
-            if (X < CHIP8_REGISTER_COUNT && Y < CHIP8_REGISTER_COUNT)
-            {
-                if (p->V[X] != p->V[Y])
-                    p->pc += 2;
-            }
-            else
-            {
-                log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                return true;
-            }
-            break;
-        case 0xA000:
-            p->I = NNN;
-            break;
-        case 0xB000:
-            p->pc = p->V[0] + NNN;
             break;
-        case 0xC000:
-            if (X < CHIP8_REGISTER_COUNT)
-            {
-                p->V[X] = (rand() & 0xFF) & NN;
-            }
-            else
-            {
-                log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                return true;
-            }
+        default:
             break;
-        case 0xD000: {
-            uint8_t x0 = p->V[X]; 
-            uint8_t y0 = p->V[Y]; 
-            
-            uint8_t collision = 0;
-            for (uint8_t row = 0; row < N; row++)
-            {
-                if (p->I + row >= CHIP8_MEM_SIZE) 
-                {
-                    log_msg(LOG_ERROR, "sprite read OOB at PC=%X", p->pc-2);
-                    return true;
-                }
-
-                uint8_t sprite = p->memory[p->I + row];
-                for (uint8_t col = 0; col < 8; col++)
-                {
-                    if (sprite & (0x80u >> col))
-                    {
-                        uint8_t x = (x0 + col) % CHIP8_DISPLAY_WIDTH;
-                        uint8_t y = (y0 + row) % CHIP8_DISPLAY_HEIGHT;
-
-                        int idx = y * CHIP8_DISPLAY_WIDTH + x;
-
-                        uint8_t before = p->display[idx];
-                        uint8_t after  = before ^ 1u;
-
-                        if (before && !after) collision = 1;
-                        p->display[idx] = after;
-                    }
-                }
-            }
-            p->V[0xF] = collision;
+    }
+    if (op == OP_UNDECODED)
+        return;
+    for (int i = 1; i < length; i++)
+        if (d[i].op == OP_UNDECODED)
+            decode_checked(p, &d[i], (uint16_t)(addr + 2 * i));
+    d->op = op;
+}
+
+// Decodes the cache entry of the instruction at addr (even, in memory) for the interpreter
+static void decode_cached(Chip8 *p, Chip8Decoded *d, uint16_t addr)
+{
+    decode_checked(p, d, addr);
+    if (p->fuse)
+        fuse(p, d, addr);
+}
+
+/* Enables or disables superinstruction fusion (chip8_init enables it), the predecoded instructions are dropped */
+void chip8_set_fusion(Chip8 *p, bool on)
+{
+    p->fuse = on;
+    for (int i = 0; i < CHIP8_MEM_SIZE / 2; i++)
+        p->decoded[i].op = OP_UNDECODED;
+}
+
+// Returns true if memory[addr .. end - 1] holds code chip8_verify analyzed, a bitmap word or byte at a time
+static bool touches_code(const Chip8 *p, uint32_t addr, uint32_t end)
+{
+    uint32_t first = addr >> 3;
+    if (first + 8 <= sizeof(p->code) && end - (first << 3) <= 64)
+    {
+        // Short range (stores through I): bits first * 8 .. + 63 in one word
+        uint64_t word = 0, span = end - addr;
+        for (int i = 0; i < 8; i++)
+            word |= (uint64_t)p->code[first + i] << (8 * i);
+        return word & (span == 64 ? ~0ull : (1ull << span) - 1) << (addr & 7);
+    }
+    for (uint32_t b = addr >> 3; b << 3 < end; b++)
+    {
+        uint8_t mask = 0xFF;
+        if (b == addr >> 3)
+            mask &= (uint8_t)(0xFF << (addr & 7));
+        if (b == (end - 1) >> 3)
+            mask &= (uint8_t)(0xFF >> (7 - ((end - 1) & 7)));
+        if (p->code[b] & mask)
+            return true;
+    }
+    return false;
+}
+
+/* Drops the predecoded entries covering memory[addr .. addr + len - 1], and the two before them, which may have
+    fused the instructions there. Must be called whenever memory is written outside the interpreter (ROM loads,
+    state restores). A write over verified code drops the proofs with every entry, the code then runs checked (and
+    unverified) until chip8_verify */
+void chip8_invalidate_decoded(Chip8 *p, uint16_t addr, uint16_t len)
+{
+    uint32_t start = addr & ~1u;
+    uint32_t end = (uint32_t)addr + len;
+    if (end > CHIP8_MEM_SIZE) end = CHIP8_MEM_SIZE;
+    if (p->verified && touches_code(p, addr, end))
+    {
+        p->verified = false;
+        memset(p->proven, 0, sizeof(p->proven));
+        start = 0;
+        end = CHIP8_MEM_SIZE;
+    }
+    else if (!p->verified)
+        start = start >= 4 ? start - 4 : 0;     // Verified code only fuses code, which this write doesn't touch
+    for (uint32_t a = start; a < end; a += 2)
+        p->decoded[a >> 1].op = OP_UNDECODED;
+}
+
+/* Executes a single instruction, see chip8_run.
+Returns: true if the command is invalid, false otherwise */
+bool chip8_cycle(Chip8 *p)
+{
+    return chip8_run(p, 1, NULL);
+}
+
+/* Threaded dispatch: with GCC/Clang each handler jumps straight to the next one through a label table,
+    other compilers fall back to a switch. FALLTHROUGH marks a handler that continues into the one below it */
+#if defined(__GNUC__)
+#define CHIP8_THREADED 1
+#define HANDLER(op) L_##op:
+#define DISPATCH() goto *handlers[d->op]
+#define FALLTHROUGH() do { } while (0)
+#else
+#define HANDLER(op) case op:
+#define DISPATCH() goto dispatch
+#define FALLTHROUGH() [[fallthrough]]
+#endif
+
+/* Guest profiler hooks (profile.h). They only do anything in the profiled interpreter instances, which a CHIP8_PROFILE
+    build adds and chip8_run only picks when a profiler is attached, so the plain instances stay as fast as in the
+    default build. Nothing is counted per instruction: addresses are counted per straight-line run, PROF_LEAVE before
+    an instruction moves pc anywhere but to the next one, PROF_ENTER after it (opcode classes are derived from the
+    addresses when the profile is written). Fetches past the end of memory (0000, a no-op) count at their pc like any
+    other, a run that wraps around to 0 starts again there. Instructions an idle path skips are credited to the
+    addresses that would have run them: PROF_SPIN repeats a straight-line run, and the profiled instances only skip
+    loop iterations when the loop is one (PROF_STRAIGHT, no run ended since the previous probe but the loop's jump) */
+#ifdef CHIP8_PROFILE
+#define PROF_ON             (CHIP8_RUN_PROFILED)
+#define PROF_MISS()         do { if (PROF_ON) prof->decode_misses++; } while (0)
+#define PROF_LEAVE()        do { if (PROF_ON) { prof->pc_runs[p->pc]--; prof->leaves++; } } while (0)
+#define PROF_ENTER()        do { if (PROF_ON) prof->pc_runs[p->pc]++; } while (0)
+#define PROF_OUTSIDE()      do { if (PROF_ON && p->pc >= UINT16_MAX - 1) prof->pc_runs[(uint16_t)(p->pc + 2)]++; } while (0)
+#define PROF_SPIN(addr, len, n) do { if (PROF_ON) { prof->pc_runs[(uint16_t)(addr)] += (n); prof->pc_runs[(uint16_t)((addr) + 2 * (len))] -= (n); } } while (0)
+#define PROF_STRAIGHT()     (!PROF_ON || prof->leaves - prof->probe_leaves == 1)
+#define PROF_PROBED()       do { if (PROF_ON) prof->probe_leaves = prof->leaves; } while (0)
+#define PROF_CALL()         do { if (PROF_ON) profile_enter(prof, prof->instructions + count, p->pc - 2, d->nnn); } while (0)
+#define PROF_RET()          do { if (PROF_ON) profile_leave(prof, prof->instructions + count); } while (0)
+#define PROF_DRAW_BEGIN()   uint64_t draw_start = PROF_ON && !(prof->draw_count++ & (PROFILE_DRAW_SAMPLE - 1)) ? profile_ticks() : 0
+#define PROF_DRAW_END()     do { if (draw_start) { prof->draw_timed++; prof->draw_ticks += profile_ticks() - draw_start; } } while (0)
+#define PROF_DONE()         do { if (PROF_ON) { PROF_LEAVE(); prof->instructions += count; } } while (0)
+#else
+#define PROF_MISS()         do { } while (0)
+#define PROF_LEAVE()        do { } while (0)
+#define PROF_ENTER()        do { } while (0)
+#define PROF_OUTSIDE()      do { } while (0)
+#define PROF_SPIN(addr, len, n) do { } while (0)
+#define PROF_STRAIGHT()     true
+#define PROF_PROBED()       do { } while (0)
+#define PROF_CALL()         do { } while (0)
+#define PROF_RET()          do { } while (0)
+#define PROF_DRAW_BEGIN()   do { } while (0)
+#define PROF_DRAW_END()     do { } while (0)
+#define PROF_DONE()         do { } while (0)
+#endif
+
+/* Fetches the next predecoded instruction (at most budget of them), advances pc and jumps to its handler.
+    Odd or out-of-memory pcs are decoded into a scratch entry instead of the cache */
+#define NEXT()                                                          \
+    do {                                                                \
+        if (count == budget) goto done;                                 \
+        count++;                                                        \
+        if (p->pc & 0xF001)                                             \
+        {                                                               \
+            PROF_OUTSIDE();                                             \
+            decode_instruction(&scratch, fetch_instruction(p));         \
+            d = &scratch;                                               \
+        }                                                               \
+        else                                                            \
+            d = &p->decoded[p->pc >> 1];                                \
+        p->pc += 2;                                                     \
+        DISPATCH();                                                     \
+    } while (0)
+
+/* Continues a superinstruction (see fuse) with the instruction after the one it just executed: counts it against
+    the budget like NEXT, then jumps to its handler, op, without the fetch or the indirect dispatch */
+#ifdef CHIP8_THREADED
+#define FUSED_JUMP(op) goto L_##op
+#else
+#define FUSED_JUMP(op) goto dispatch
+#endif
+#define FUSED(op)                                                       \
+    do {                                                                \
+        if (count == budget) goto done;                                 \
+        count++;                                                        \
+        d = &p->decoded[p->pc >> 1];                                    \
+        p->pc += 2;                                                     \
+        FUSED_JUMP(op);                                                 \
+    } while (0)
+
+#define FAIL() do { failed = true; goto done; } while (0)
+
+// Skips the next instruction
+#define SKIP() do { PROF_LEAVE(); p->pc += 2; PROF_ENTER(); } while (0)
+
+/* Compile-time quirk test inside an interpreter instance */
+#define QUIRK(q) ((CHIP8_RUN_QUIRKS & (q)) != 0)
+
+/* Helpers every instance must inline for its quirk flags to fold: the profiled instances double the size of this
+    file, past the point where GCC's inliner stops on its own */
+#if defined(__GNUC__)
+#define INSTANCE_INLINE inline __attribute__((always_inline))
+#else
+#define INSTANCE_INLINE inline
+#endif
+
+// Returns the sprite rows Dxyn draws: N, or only those above the bottom edge when clipping
+static INSTANCE_INLINE uint8_t sprite_rows(const Chip8 *p, const Chip8Decoded *d, bool clip)
+{
+    uint8_t n = d->nn & 0x0F;
+    uint8_t y0 = p->V[d->y] % CHIP8_DISPLAY_HEIGHT;
+    return clip && n > CHIP8_DISPLAY_HEIGHT - y0 ? (uint8_t)(CHIP8_DISPLAY_HEIGHT - y0) : n;
+}
+
+/* XORs the first rows of Dxyn's sprite (memory[I ..], the caller checked the bounds) onto the display.
+    Sprite rows are rotated into place so horizontal wrapping is free, collision is one AND per row.
+    Clipping drops the bits shifted out on the right instead.
+Returns: the collided pixels */
+static INSTANCE_INLINE uint64_t draw_sprite(Chip8 *p, const Chip8Decoded *d, uint8_t rows, bool clip)
+{
+    uint8_t x0 = p->V[d->x] % CHIP8_DISPLAY_WIDTH;
+    uint8_t y0 = p->V[d->y] % CHIP8_DISPLAY_HEIGHT;
+    uint64_t collision = 0;
+    for (uint8_t row = 0; row < rows; row++)
+    {
+        uint64_t sprite = (uint64_t)p->memory[p->I + row] << 56;
+        uint64_t bits = clip ? sprite >> x0 : (sprite >> x0) | (sprite << ((64 - x0) & 63));
+        uint8_t y = (y0 + row) % CHIP8_DISPLAY_HEIGHT;
+        uint64_t *line = &p->display[y];
+        collision |= *line & bits;
+        *line ^= bits;
+        if (bits)
+            p->dirty_rows |= 1u << y;
+    }
+    return collision;
+}
+
+#define QUIRKS_VIP      (CHIP8_QUIRK_SHIFT_VY | CHIP8_QUIRK_VF_RESET | CHIP8_QUIRK_MEMORY_I | CHIP8_QUIRK_CLIP)
+#define QUIRKS_CHIP48   (CHIP8_QUIRK_MEMORY_I_X | CHIP8_QUIRK_CLIP | CHIP8_QUIRK_JUMP_VX)
+#define QUIRKS_SCHIP    (CHIP8_QUIRK_CLIP | CHIP8_QUIRK_JUMP_VX)
+
+#define CHIP8_RUN_NAME run_modern
+#define CHIP8_RUN_QUIRKS 0
+#include "chip8_run.inc"
+
+#define CHIP8_RUN_NAME run_vip
+#define CHIP8_RUN_QUIRKS QUIRKS_VIP
+#include "chip8_run.inc"
+
+#define CHIP8_RUN_NAME run_chip48
+#define CHIP8_RUN_QUIRKS QUIRKS_CHIP48
+#include "chip8_run.inc"
+
+#define CHIP8_RUN_NAME run_schip
+#define CHIP8_RUN_QUIRKS QUIRKS_SCHIP
+#include "chip8_run.inc"
+
+#ifdef CHIP8_PROFILE
+#define CHIP8_RUN_NAME run_modern_profiled
+#define CHIP8_RUN_QUIRKS 0
+#define CHIP8_RUN_PROFILED 1
+#include "chip8_run.inc"
+
+#define CHIP8_RUN_NAME run_vip_profiled
+#define CHIP8_RUN_QUIRKS QUIRKS_VIP
+#define CHIP8_RUN_PROFILED 1
+#include "chip8_run.inc"
+
+#define CHIP8_RUN_NAME run_chip48_profiled
+#define CHIP8_RUN_QUIRKS QUIRKS_CHIP48
+#define CHIP8_RUN_PROFILED 1
+#include "chip8_run.inc"
+
+#define CHIP8_RUN_NAME run_schip_profiled
+#define CHIP8_RUN_QUIRKS QUIRKS_SCHIP
+#define CHIP8_RUN_PROFILED 1
+#include "chip8_run.inc"
+#endif
+
+/* Executes up to budget instructions on the interpreter instance of the VM's quirk profile (its profiled copy when a
+    profiler is attached), see chip8_run.inc.
+Returns: true if an instruction is invalid (execution stops there), false otherwise */
+bool chip8_run(Chip8 *p, uint32_t budget, uint32_t *executed)
+{
+#ifdef CHIP8_PROFILE
+    if (p->profile)
+    {
+        switch (p->quirks)
+        {
+            case CHIP8_QUIRKS_VIP:      return run_vip_profiled(p, budget, executed);
+            case CHIP8_QUIRKS_CHIP48:   return run_chip48_profiled(p, budget, executed);
+            case CHIP8_QUIRKS_SCHIP:    return run_schip_profiled(p, budget, executed);
+            default:                    return run_modern_profiled(p, budget, executed);
+        }
+    }
+#endif
+    switch (p->quirks)
+    {
+        case CHIP8_QUIRKS_VIP:      return run_vip(p, budget, executed);
+        case CHIP8_QUIRKS_CHIP48:   return run_chip48(p, budget, executed);
+        case CHIP8_QUIRKS_SCHIP:    return run_schip(p, budget, executed);
+        default:                    return run_modern(p, budget, executed);
+    }
+}
+
+/* Executes one of the instructions the JIT calls out of its translated code for (00E0, Dxyn, Fx33, Fx55, Fx65), as
+    the VM's interpreter instance would, pc excepted. The caller counts it, and invalidates its own code over the
+    memory Fx33/Fx55 write.
+Returns: true if the instruction would fault or isn't one of those, the VM is then unchanged */
+bool chip8_exec(Chip8 *p, uint16_t instruction)
+{
+    Chip8Decoded d = { .x = (instruction & 0x0F00) >> 8, .y = (instruction & 0x00F0) >> 4, .nn = instruction & 0x00FF };
+    uint32_t quirks = chip8_quirk_flags(p->quirks);
+    switch (instruction & 0xF0FF)
+    {
+        case 0x00E0:
+            for (int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++)
+                if (p->display[y])
+                    p->dirty_rows |= 1u << y;
+            memset(p->display, 0, sizeof(p->display));
             p->draw_flag = true;
-            }
-            break;
-        case 0xE000:
-            switch (instruction & 0x00FF)
-            {
-            case 0x009E:
-                if (p->keys[p->V[X] & 0x000F]) p->pc += 2;
-                break;
-            case 0x00A1:
-                if (!p->keys[p->V[X] & 0x000F]) p->pc += 2;
-                break;        
-            default:
-                log_msg(LOG_INFO, "Unknown opcode %X at PC=%X", instruction, p->pc - 2);
+            return false;
+        case 0xF033:
+            if (p->I > CHIP8_MEM_SIZE - 3)
                 return true;
-            }
-            break;
-        case 0xF000:
-            switch (instruction & 0x00FF)
+            p->memory[p->I] = p->V[d.x] / 100;
+            p->memory[p->I + 1] = (p->V[d.x] / 10) % 10;
+            p->memory[p->I + 2] = p->V[d.x] % 10;
+            chip8_invalidate_decoded(p, p->I, 3);
+            return false;
+        case 0xF055:
+        case 0xF065:
+            if (p->I + d.x >= CHIP8_MEM_SIZE)
+                return true;
+            if (d.nn == 0x55)
             {
-            case 0x0007:
-                if (X < CHIP8_REGISTER_COUNT)
-                {
-                    p->V[X] = p->delay_timer;
-                }
-                else
-                {
-                    log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                    return true;
-                }
-                break;
-            case 0x000A:
-                bool pressed = false;
-                for (int i = 0; i < CHIP8_KEY_COUNT; i++)
-                {
-                    if (p->keys[i])
-                    {
-                        p->V[X] = i;
-                        pressed = true;
-                        break;
-                    }
-                }
-                if (!pressed) // a key is not pressed - repeat command until it is.
-                    p->pc -= 2;
-                break;
-            case 0x0015:
-                if (X < CHIP8_REGISTER_COUNT)
-                {
-                    p->delay_timer = p->V[X];
-                }
-                else
-                {
-                    log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                    return true;
-                }
-                break;
-            case 0x0018:
-                if (X < CHIP8_REGISTER_COUNT)
-                {
-                    p->sound_timer = p->V[X];
-                }
-                else
-                {
-                    log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                    return true;
-                }
-                break;
-            case 0x001E:
-                if (X < CHIP8_REGISTER_COUNT)
-                {
-                    p->I += p->V[X];
-                }
-                else
-                {
-                    log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                    return true;
-                }
-                break;
-            case 0x0029:
-                if (X < CHIP8_REGISTER_COUNT)
-                {
-                    p->I = FONT_BASE + (p->V[X] * 5);
-                }
-                else
-                {
-                    log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                    return true;
-                }
-                break;
-            case 0x0033:
-                p->memory[p->I] = p->V[X] / 100;
-                p->memory[p->I + 1] = (p->V[X] / 10) % 10;
-                p->memory[p->I + 2] = p->V[X] % 10;
-                break;
-            case 0x0055:
-                if (X >= CHIP8_REGISTER_COUNT)
-                {
-                    log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                    return true;
-                }
-                for (int i = 0; i <= X; i++)
+                for (int i = 0; i <= d.x; i++)
                     p->memory[p->I + i] = p->V[i];
-                //p->I += X + 1; // LEGACY
-                break;
-            case 0x0065:
-                if (X >= CHIP8_REGISTER_COUNT)
-                {
-                    log_msg(LOG_ERROR, "[instruciton: %i] register index out-of-range at PC=%X", instruction, p->pc - 2);
-                    return true;
-                }
-                for (int i = 0; i <= X; i++)
+                chip8_invalidate_decoded(p, p->I, d.x + 1);
+            }
+            else
+            {
+                for (int i = 0; i <= d.x; i++)
                     p->V[i] = p->memory[p->I + i];
-                //p->I += X + 1; // LEGACY
-                break;
-            default:
-                log_msg(LOG_INFO, "Unknown opcode %X at PC=%X", instruction, p->pc - 2);
-                return true;
             }
-            break;
+            if (quirks & CHIP8_QUIRK_MEMORY_I)
+                p->I += d.x + 1;
+            else if (quirks & CHIP8_QUIRK_MEMORY_I_X)
+                p->I += d.x;
+            return false;
         default:
-            log_msg(LOG_INFO, "Unknown opcode %X at PC=%X", instruction, p->pc - 2);
-            return true;
+            break;
     }
+    if ((instruction & 0xF000) != 0xD000)
+        return true;
+    return quirks & CHIP8_QUIRK_CLIP ? chip8_draw_clip(p, instruction) : chip8_draw_wrap(p, instruction);
+}
 
-
+// Dxyn for chip8_exec and the JIT, with or without clipping
+static INSTANCE_INLINE bool exec_draw(Chip8 *p, uint16_t instruction, bool clip)
+{
+    Chip8Decoded d = { .x = (instruction & 0x0F00) >> 8, .y = (instruction & 0x00F0) >> 4, .nn = instruction & 0x00FF };
+    uint8_t rows = sprite_rows(p, &d, clip);
+    if (p->I + rows > CHIP8_MEM_SIZE)
+        return true;
+    p->V[0xF] = draw_sprite(p, &d, rows, clip) ? 1 : 0;
+    p->draw_flag = true;
     return false;
 }
 
+/* Dxyn as chip8_exec runs it, with the clipping quirk resolved: the JIT calls the one of its profile directly.
+Returns: true if the sprite would read past the end of memory, the VM is then unchanged */
+bool chip8_draw_wrap(Chip8 *p, uint16_t instruction)
+{
+    return exec_draw(p, instruction, false);
+}
+
+bool chip8_draw_clip(Chip8 *p, uint16_t instruction)
+{
+    return exec_draw(p, instruction, true);
+}
+
+static const struct {
+    const char *name;
+    uint32_t flags;
+} quirk_profiles[CHIP8_QUIRKS_COUNT] = {
+    [CHIP8_QUIRKS_MODERN] = { "modern", 0 },
+    [CHIP8_QUIRKS_VIP]    = { "vip", QUIRKS_VIP },
+    [CHIP8_QUIRKS_CHIP48] = { "chip48", QUIRKS_CHIP48 },
+    [CHIP8_QUIRKS_SCHIP]  = { "schip", QUIRKS_SCHIP },
+};
+
+/* Selects the interpreter instance (and the JIT's code) used for the VM's quirky instructions, verified code is
+    verified again since the memory quirks move I. A JIT that already translated this VM's code must be flushed */
+void chip8_set_quirks(Chip8 *p, Chip8Quirks quirks)
+{
+    uint8_t previous = p->quirks;
+    p->quirks = quirks < CHIP8_QUIRKS_COUNT ? (uint8_t)quirks : CHIP8_QUIRKS_MODERN;
+    if (p->verified && p->quirks != previous)
+        chip8_verify(p);
+}
+
+/* Returns the CHIP8_QUIRK_* flags of a profile */
+uint32_t chip8_quirk_flags(Chip8Quirks quirks)
+{
+    return quirks < CHIP8_QUIRKS_COUNT ? quirk_profiles[quirks].flags : 0;
+}
+
+const char *chip8_quirks_name(uint8_t quirks)
+{
+    return quirks < CHIP8_QUIRKS_COUNT ? quirk_profiles[quirks].name : "unknown";
+}
+
+/* Parses a profile name (modern, vip, chip48, schip).
+Returns: true if the name is unknown */
+bool chip8_parse_quirks(const char *name, Chip8Quirks *out)
+{
+    for (int q = 0; q < CHIP8_QUIRKS_COUNT; q++)
+    {
+        if (!strcmp(name, quirk_profiles[q].name))
+        {
+            *out = (Chip8Quirks)q;
+            return false;
+        }
+    }
+    log_msg(LOG_ERROR, "unknown quirk profile '%s' (modern, vip, chip48, schip)", name);
+    return true;
+}
+
 /* Returns a combined number with pc and pc+1 instuctions */
 static uint16_t fetch_instruction(Chip8 *p)
 {
-    if(p->pc > CHIP8_MEM_SIZE - 1)
+    if(p->pc > CHIP8_MEM_SIZE - 2)
     {
         log_msg(LOG_ERROR, "trying to fetch out-of-memory commands");
         return 0;
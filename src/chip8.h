@@ -1,6 +1,7 @@
 #ifndef CHIP8_H
 #define CHIP8_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include "constants.h"
@@ -10,8 +11,53 @@
 #define CHIP8_STACK_SIZE 16
 #define CHIP8_REGISTER_COUNT 16
 #define CHIP8_PC_START_INDEX 0x200
+#define CHIP8_ROM_MAX_SIZE (CHIP8_MEM_SIZE - CHIP8_PC_START_INDEX)
 #define CHIP8_KEY_COUNT 16
 #define FONT_BASE 0x050
+#define CHIP8_DEFAULT_SEED 0x2545F491u   // Cxnn PRNG seed used by chip8_init
+
+_Static_assert(CHIP8_DISPLAY_WIDTH == 64, "display rows are stored as 64-bit words");
+
+/* Predecoded instruction, one per even memory address.
+    op indexes the interpreter's handler table (0 = not decoded yet) */
+typedef struct {
+    uint8_t op;         // Handler index
+    uint8_t x;          // Second nibble
+    uint8_t y;          // Third nibble
+    uint8_t nn;         // Low byte (N = nn & 0xF)
+    uint16_t nnn;       // Low 12 bits
+    uint16_t opcode;    // Raw instruction, for error messages
+} Chip8Decoded;
+
+struct Chip8Profile;
+
+/* Quirks: instructions whose behaviour differs between CHIP-8 platforms */
+enum {
+    CHIP8_QUIRK_SHIFT_VY   = 1 << 0,    // 8XY6/8XYE shift VY into VX instead of shifting VX in place
+    CHIP8_QUIRK_VF_RESET   = 1 << 1,    // 8XY1/8XY2/8XY3 clear VF
+    CHIP8_QUIRK_MEMORY_I   = 1 << 2,    // Fx55/Fx65 leave I at I + X + 1
+    CHIP8_QUIRK_MEMORY_I_X = 1 << 3,    // Fx55/Fx65 leave I at I + X
+    CHIP8_QUIRK_CLIP       = 1 << 4,    // Dxyn clips sprites at the screen edges instead of wrapping them
+    CHIP8_QUIRK_JUMP_VX    = 1 << 5     // BXNN jumps to XNN + VX instead of NNN + V0
+};
+
+/* Quirk profiles, one specialized interpreter instance each (chip8_run picks it per call, the quirk checks inside
+    are compile-time constants) */
+typedef enum {
+    CHIP8_QUIRKS_MODERN,    // No quirk: this emulator's historical behaviour, the default
+    CHIP8_QUIRKS_VIP,       // COSMAC VIP: shift VY, VF reset, I + X + 1, clipping
+    CHIP8_QUIRKS_CHIP48,    // CHIP-48: I + X, clipping, BXNN
+    CHIP8_QUIRKS_SCHIP,     // SUPER-CHIP 1.1: clipping, BXNN
+    CHIP8_QUIRKS_COUNT
+} Chip8Quirks;
+
+// Why the last chip8_run stopped interpreting before its budget (the skipped instructions still count as executed)
+typedef enum {
+    CHIP8_IDLE_NONE,    // Every instruction was interpreted
+    CHIP8_IDLE_LOOP,    // Skipped iterations of a loop without side effects, it can only exit after a timer tick or key change
+    CHIP8_IDLE_HALT,    // Jump to self, the VM is stuck for good
+    CHIP8_IDLE_KEY      // Blocked in Fx0A until a key is pressed
+} Chip8Idle;
 
 /* VM struct */
 typedef struct {
@@ -22,14 +68,83 @@ typedef struct {
     uint16_t stack[CHIP8_STACK_SIZE];   // Memory stack
     uint8_t sp;                         // Stack pointer
     uint8_t memory[CHIP8_MEM_SIZE];     // Memory array
-    uint8_t display[CHIP8_DISPLAY_WIDTH * CHIP8_DISPLAY_HEIGHT];    // Display pixels 2d array
+    uint64_t display[CHIP8_DISPLAY_HEIGHT];    // Display rows, one bit per pixel (bit 63 = leftmost column)
     bool draw_flag;                     // render flag (1 = render, 0 = don't render)
+    uint32_t dirty_rows;                // Bit y set = display row y changed since the platform last consumed it
+    uint8_t idle;                       // Chip8Idle of the last chip8_run
     uint8_t delay_timer;                // delay timer
     uint8_t sound_timer;                // sound timer
+    uint32_t rng_state;                 // Per-VM xorshift32 state for Cxnn (never 0)
+    uint8_t quirks;                     // Chip8Quirks, chip8_init selects CHIP8_QUIRKS_MODERN
+    bool verified;                      // code and proven hold a chip8_verify analysis of the current code
+    uint8_t code[CHIP8_MEM_SIZE / 8];   // Bit per byte: reachable code the analysis read, writing it drops the proofs
+    uint8_t proven[CHIP8_MEM_SIZE / 16];    // Bit per even address: its memory access through I can't leave memory
+    bool fuse;                          // Predecode common instruction sequences into superinstructions (chip8_init: on)
+    Chip8Decoded decoded[CHIP8_MEM_SIZE / 2];   // Predecoded instruction cache, invalidated on memory writes
+#ifdef CHIP8_PROFILE
+    struct Chip8Profile *profile;       // Guest profiler fed by chip8_run when set (see profile.h)
+#endif
 } Chip8;
 
+/* Idle-loop probe, armed by every backward jump. A jump that comes back to the same address with the same registers,
+    stack and no writes to memory, display, timers or the PRNG in between (the caller counts those) closed a loop
+    iteration that will repeat identically until a timer tick or a key changes */
+typedef struct {
+    uint16_t pc;                        // Loop head, CHIP8_MEM_SIZE = none
+    uint16_t I;
+    uint8_t sp;
+    bool armed;                         // Registers matched the previous iteration, stack copied
+    uint32_t writes;                    // Side-effect counter at the last jump
+    uint32_t count;                     // Instruction count at the last jump
+    uint64_t v[2];
+    uint16_t stack[CHIP8_STACK_SIZE];
+} Chip8IdleProbe;
+
 bool chip8_init(Chip8 *p);
 bool chip8_load_rom(Chip8 *p, char *filename);
+bool chip8_load_rom_mem(Chip8 *p, const uint8_t *rom, size_t len);
 bool chip8_cycle(Chip8 *p);
+bool chip8_run(Chip8 *p, uint32_t budget, uint32_t *executed);
+bool chip8_exec(Chip8 *p, uint16_t instruction);
+bool chip8_draw_wrap(Chip8 *p, uint16_t instruction);
+bool chip8_draw_clip(Chip8 *p, uint16_t instruction);
+void chip8_invalidate_decoded(Chip8 *p, uint16_t addr, uint16_t len);
+bool chip8_verify(Chip8 *p);
+void chip8_set_fusion(Chip8 *p, bool on);
+void chip8_tick_timers(Chip8 *p);
+void chip8_seed(Chip8 *p, uint32_t seed);
+uint64_t chip8_display_hash(const Chip8 *p);
+void chip8_set_quirks(Chip8 *p, Chip8Quirks quirks);
+uint32_t chip8_quirk_flags(Chip8Quirks quirks);
+const char *chip8_quirks_name(uint8_t quirks);
+bool chip8_parse_quirks(const char *name, Chip8Quirks *out);
+void chip8_idle_reset(Chip8IdleProbe *probe);
+uint32_t chip8_idle_probe(Chip8IdleProbe *probe, const Chip8 *p, uint32_t writes, uint32_t count);
+#ifdef CHIP8_PROFILE
+const char *chip8_op_name(unsigned op);
+unsigned chip8_op_class(uint16_t instruction);
+#endif
+
+// Returns the pixel at (x, y), 1 = on
+static inline uint8_t chip8_pixel(const Chip8 *p, int x, int y)
+{
+    return (p->display[y] >> (63 - x)) & 1u;
+}
+
+// Key state as a mask, bit k = key k pressed
+static inline uint16_t chip8_key_mask(const Chip8 *p)
+{
+    uint16_t mask = 0;
+    for (int k = 0; k < CHIP8_KEY_COUNT; k++)
+        if (p->keys[k])
+            mask |= (uint16_t)(1u << k);
+    return mask;
+}
+
+static inline void chip8_set_key_mask(Chip8 *p, uint16_t mask)
+{
+    for (int k = 0; k < CHIP8_KEY_COUNT; k++)
+        p->keys[k] = (mask >> k) & 1;
+}
 
 #endif
@@ -0,0 +1,795 @@
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <string.h>
+#include "chip8_jit.h"
+#include "logger.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define CHIP8_JIT_SUPPORTED 1
+#endif
+
+/*
+    chip8_jit.c translates CHIP-8 basic blocks into x86-64 code:
+    - A block is a run of straight-line instructions ended by a control transfer (1NNN/2NNN/00EE/BNNN, skips), an
+      Fx33 (it may write over the block) or the first instruction the JIT doesn't handle (Fx0A, invalid opcodes),
+      which is then executed by chip8_run
+    - Register, timer, Cxnn, Fx55 and Fx65 instructions are emitted inline. 00E0 calls chip8_exec out of the block,
+      Dxyn the draw helper of the profile, Fx33 goes through jit_store. After its stores Fx55 calls jit_stored,
+      which drops the blocks they wrote over, and the block only ends there if one of them did
+    - Generated code takes the Chip8 pointer in rdi and the remaining budget in esi (SysV ABI), V[] and the timers
+      are addressed relative to rdi, I is kept in dx for the whole block and pc is written once on exit
+    - Blocks chain: a block ending in a call, a skip or a forward jump looks its successor up in the block table and
+      jumps straight into its code if it is translated and fits in the budget (r8d counts the instructions executed
+      so far, r9d holds the budget). Backward jumps, returns and BNNN go back to chip8_jit_run, which runs the idle
+      probe there
+    - A block returns the instructions it and the blocks it chained to executed. One that would fault (stack
+      over/underflow, out-of-bounds sprite or memory access) exits before it with JIT_FAULT_AHEAD set, so chip8_run
+      executes it and reports the error
+    - No page is writable and executable at once: the arena is one shared memory object mapped twice, blocks are
+      emitted through a read/write view and run from a read/execute one
+*/
+
+typedef uint32_t (*JitBlockFn)(Chip8 *p, uint32_t budget);
+
+#define JIT_FAULT_AHEAD 0x80000000u     // Block return flag: stopped before an instruction that faults
+#define JIT_ENTRY_BYTES 6               // Budget setup skipped by chained jumps
+
+// Max native bytes a single instruction expands to, plus the block prologue and terminator
+#define JIT_MAX_INSN_BYTES 256
+#define JIT_MAX_BLOCK_BYTES (CHIP8_JIT_MAX_BLOCK * JIT_MAX_INSN_BYTES + 256)
+
+bool chip8_jit_init(Chip8Jit *j)
+{
+    *j = (Chip8Jit){0};
+#ifdef CHIP8_JIT_SUPPORTED
+    int fd = memfd_create("chip8-jit", MFD_CLOEXEC);
+    void *code = MAP_FAILED, *write = MAP_FAILED;
+    if (fd >= 0 && !ftruncate(fd, CHIP8_JIT_CODE_SIZE))
+    {
+        write = mmap(NULL, CHIP8_JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        code = mmap(NULL, CHIP8_JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+    }
+    if (fd >= 0)
+        close(fd);      // The mappings keep the object alive
+    if (code == MAP_FAILED || write == MAP_FAILED)
+    {
+        log_msg(LOG_ERROR, "Failed to map JIT code arena");
+        if (code != MAP_FAILED)
+            munmap(code, CHIP8_JIT_CODE_SIZE);
+        if (write != MAP_FAILED)
+            munmap(write, CHIP8_JIT_CODE_SIZE);
+        return true;
+    }
+    j->code = code;
+    j->code_write = write;
+    return false;
+#else
+    log_msg(LOG_ERROR, "JIT is only supported on x86-64");
+    return true;
+#endif
+}
+
+void chip8_jit_cleanup(Chip8Jit *j)
+{
+#ifdef CHIP8_JIT_SUPPORTED
+    if (j->code)
+        munmap(j->code, CHIP8_JIT_CODE_SIZE);
+    if (j->code_write)
+        munmap(j->code_write, CHIP8_JIT_CODE_SIZE);
+#endif
+    j->code = j->code_write = NULL;
+}
+
+void chip8_jit_flush(Chip8Jit *j)
+{
+    memset(j->blocks, 0, sizeof(j->blocks));
+    memset(j->covered, 0, sizeof(j->covered));
+    j->code_used = 0;
+}
+
+// Returns true if a block translated some byte of memory[addr .. end - 1], a bitmap word or byte at a time
+static bool covered(const Chip8Jit *j, uint32_t addr, uint32_t end)
+{
+    uint32_t first = addr >> 3;
+    if (first + 8 <= sizeof(j->covered) && end - (first << 3) <= 64)
+    {
+        // Short range (the Fx33/Fx55 case): one little-endian load, bit k = memory[first * 8 + k]
+        uint64_t word, span = end - addr;
+        memcpy(&word, j->covered + first, sizeof(word));
+        return word & (span == 64 ? ~0ull : (1ull << span) - 1) << (addr & 7);
+    }
+    for (uint32_t b = addr >> 3; b << 3 < end; b++)
+    {
+        uint8_t mask = 0xFF;
+        if (b == addr >> 3)
+            mask &= (uint8_t)(0xFF << (addr & 7));
+        if (b == (end - 1) >> 3)
+            mask &= (uint8_t)(0xFF >> (7 - ((end - 1) & 7)));
+        if (j->covered[b] & mask)
+            return true;
+    }
+    return false;
+}
+
+void chip8_jit_invalidate(Chip8Jit *j, uint16_t addr, uint16_t len)
+{
+    uint32_t end = (uint32_t)addr + len;
+    if (end > CHIP8_MEM_SIZE) end = CHIP8_MEM_SIZE;
+    if (addr >= end || !covered(j, addr, end))
+        return;     // Data writes, the common case
+    // A block starting up to CHIP8_JIT_MAX_BLOCK instructions before addr may cover it
+    uint32_t first = addr > CHIP8_JIT_MAX_BLOCK * 2 ? addr - CHIP8_JIT_MAX_BLOCK * 2 : 0;
+    for (uint32_t a = first & ~1u; a < end; a += 2)
+    {
+        JitBlock *b = &j->blocks[a >> 1];
+        uint32_t span = b->state == JIT_BLOCK_NATIVE ? b->count * 2u : 2u;
+        if (b->state != JIT_BLOCK_NONE && a + span > addr)
+            b->state = JIT_BLOCK_NONE;
+    }
+}
+
+#ifdef CHIP8_JIT_SUPPORTED
+
+/* x86-64 emitter, every memory operand is [rdi + disp32] */
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+} Emitter;
+
+static void emit8(Emitter *e, uint8_t b)
+{
+    e->buf[e->len++] = b;
+}
+
+static void emit16(Emitter *e, uint16_t v)
+{
+    emit8(e, v & 0xFF);
+    emit8(e, v >> 8);
+}
+
+static void emit32(Emitter *e, uint32_t v)
+{
+    emit16(e, v & 0xFFFF);
+    emit16(e, v >> 16);
+}
+
+static void emit64(Emitter *e, uint64_t v)
+{
+    emit32(e, (uint32_t)v);
+    emit32(e, (uint32_t)(v >> 32));
+}
+
+// <op> reg, [rdi + disp] (reg: 0 = al/ax/eax, 1 = cl, 2 = dx)
+static void emit_mem(Emitter *e, uint8_t opcode, uint8_t reg, uint32_t disp)
+{
+    emit8(e, opcode);
+    emit8(e, 0x80 | (reg << 3) | 7);  // mod=10 (disp32), rm=rdi
+    emit32(e, disp);
+}
+
+#define V_OFF(x) ((uint32_t)(offsetof(Chip8, V) + (x)))
+#define REG_AL 0
+#define REG_CL 1
+#define REG_DX 2
+
+static void emit_load_al(Emitter *e, uint32_t disp)  { emit_mem(e, 0x8A, REG_AL, disp); }   // mov al, [m]
+static void emit_store_al(Emitter *e, uint32_t disp) { emit_mem(e, 0x88, REG_AL, disp); }   // mov [m], al
+static void emit_store_cl(Emitter *e, uint32_t disp) { emit_mem(e, 0x88, REG_CL, disp); }   // mov [m], cl
+static void emit_load_cl(Emitter *e, uint32_t disp)  { emit_mem(e, 0x8A, REG_CL, disp); }   // mov cl, [m]
+
+// Emits a short conditional jump to be patched by emit_patch, returns the position of its offset
+static size_t emit_jcc(Emitter *e, uint8_t jcc)
+{
+    emit8(e, jcc);
+    emit8(e, 0);
+    return e->len - 1;
+}
+
+// Points the jump emitted at pos to the current position
+static void emit_patch(Emitter *e, size_t pos)
+{
+    e->buf[pos] = (uint8_t)(e->len - pos - 1);
+}
+
+// mov word [pc], addr
+static void emit_set_pc(Emitter *e, uint16_t addr)
+{
+    emit8(e, 0x66); emit_mem(e, 0xC7, 0, (uint32_t)offsetof(Chip8, pc)); emit16(e, addr);
+}
+
+// Returns from the block, executed instructions after the chained ones: lea eax, [r8 + executed]; ret
+static void emit_return(Emitter *e, uint32_t executed)
+{
+    emit8(e, 0x41); emit8(e, 0x8D); emit8(e, 0x80); emit32(e, executed);
+    emit8(e, 0xC3);
+}
+
+_Static_assert(sizeof(JitBlock) == 8, "emit_chain_dynamic indexes the block table by 8");
+
+// Jumps into the block rax points to if it is translated and fits in the budget, else returns (pc already set)
+static void emit_chain_block(Emitter *e, Chip8Jit *j)
+{
+    emit8(e, 0x80); emit8(e, 0x78); emit8(e, (uint8_t)offsetof(JitBlock, state));
+    emit8(e, JIT_BLOCK_NATIVE);                                                         // cmp byte [rax + state]
+    size_t untranslated = emit_jcc(e, 0x75);                                            // jne
+    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0x48); emit8(e, (uint8_t)offsetof(JitBlock, count)); // movzx ecx, count
+    emit8(e, 0x44); emit8(e, 0x01); emit8(e, 0xC1);                                     // add ecx, r8d
+    emit8(e, 0x44); emit8(e, 0x39); emit8(e, 0xC9);                                     // cmp ecx, r9d
+    size_t over = emit_jcc(e, 0x77);                                                    // ja
+    emit8(e, 0x8B); emit8(e, 0x48); emit8(e, (uint8_t)offsetof(JitBlock, offset));     // mov ecx, [rax + offset]
+    emit8(e, 0x48); emit8(e, 0xB8); emit64(e, (uint64_t)(uintptr_t)(j->code + JIT_ENTRY_BYTES)); // mov rax, code
+    emit8(e, 0x48); emit8(e, 0x01); emit8(e, 0xC8);                                     // add rax, rcx
+    emit8(e, 0xFF); emit8(e, 0xE0);                                                     // jmp rax
+    emit_patch(e, untranslated);
+    emit_patch(e, over);
+    emit8(e, 0x44); emit8(e, 0x89); emit8(e, 0xC0);                                     // mov eax, r8d
+    emit8(e, 0xC3);                                                                     // ret
+}
+
+/* Leaves a block that set pc to target, executed instructions after the chained ones: continues in the target's
+    block if it is translated and fits in the budget, else returns */
+static void emit_chain(Emitter *e, Chip8Jit *j, uint16_t target, uint32_t executed)
+{
+    if ((target & 1) || target > CHIP8_MEM_SIZE - 2)
+    {
+        emit_return(e, executed);
+        return;
+    }
+    emit8(e, 0x45); emit8(e, 0x8D); emit8(e, 0x80); emit32(e, executed);              // lea r8d, [r8 + executed]
+    emit8(e, 0x48); emit8(e, 0xB8); emit64(e, (uint64_t)(uintptr_t)&j->blocks[target >> 1]);  // mov rax, block
+    emit_chain_block(e, j);
+}
+
+// Same as emit_chain for a target computed in eax (00EE, BNNN)
+static void emit_chain_dynamic(Emitter *e, Chip8Jit *j, uint32_t executed)
+{
+    emit8(e, 0x45); emit8(e, 0x8D); emit8(e, 0x80); emit32(e, executed);              // lea r8d, [r8 + executed]
+    emit8(e, 0xA9); emit32(e, 0xF001);                                                  // test eax, 0xF001
+    size_t outside = emit_jcc(e, 0x75);                                                 // jnz: odd or out of memory
+    emit8(e, 0xD1); emit8(e, 0xE8);                                                     // shr eax, 1
+    emit8(e, 0x48); emit8(e, 0xB9); emit64(e, (uint64_t)(uintptr_t)j->blocks);         // mov rcx, blocks
+    emit8(e, 0x48); emit8(e, 0x8D); emit8(e, 0x04); emit8(e, 0xC1);                     // lea rax, [rcx + rax*8]
+    emit_chain_block(e, j);
+    emit_patch(e, outside);
+    emit8(e, 0x44); emit8(e, 0x89); emit8(e, 0xC0);                                     // mov eax, r8d
+    emit8(e, 0xC3);                                                                     // ret
+}
+
+/* Calls fn(p, instruction, arg) out of the block, then reloads I (the callee may have moved it), fn's result is left
+    in al. store_i writes dx back to I first */
+static void emit_call(Emitter *e, const void *fn, uint16_t instruction, const void *arg, bool store_i)
+{
+    if (store_i)
+    {
+        emit8(e, 0x66); emit_mem(e, 0x89, REG_DX, (uint32_t)offsetof(Chip8, I));      // mov [I], dx
+    }
+    emit8(e, 0x57);                                                                     // push rdi
+    emit8(e, 0x41); emit8(e, 0x50);                                                     // push r8
+    emit8(e, 0x41); emit8(e, 0x51);                                                     // push r9 (aligns rsp)
+    emit8(e, 0xBE); emit32(e, instruction);                                             // mov esi, instruction
+    if (arg)
+    {
+        emit8(e, 0x48); emit8(e, 0xBA); emit64(e, (uint64_t)(uintptr_t)arg);          // mov rdx, arg
+    }
+    emit8(e, 0x48); emit8(e, 0xB8); emit64(e, (uint64_t)(uintptr_t)fn);               // mov rax, fn
+    emit8(e, 0xFF); emit8(e, 0xD0);                                                     // call rax
+    emit8(e, 0x41); emit8(e, 0x59);                                                     // pop r9
+    emit8(e, 0x41); emit8(e, 0x58);                                                     // pop r8
+    emit8(e, 0x5F);                                                                     // pop rdi
+    emit8(e, 0x0F); emit8(e, 0xB7); emit8(e, 0x97); emit32(e, (uint32_t)offsetof(Chip8, I)); // movzx edx, word [I]
+}
+
+/* emit_call for an instruction fn executes: if fn returns true the block exits at addr, the executed instructions
+    before it counted, with JIT_FAULT_AHEAD */
+static void emit_call_out(Emitter *e, const void *fn, uint16_t instruction, const void *arg, bool store_i,
+                          uint16_t addr, uint32_t executed)
+{
+    emit_call(e, fn, instruction, arg, store_i);
+    emit8(e, 0x84); emit8(e, 0xC0);                                                     // test al, al
+    size_t ok = emit_jcc(e, 0x74);                                                      // jz
+    emit_set_pc(e, addr);
+    emit_return(e, executed | JIT_FAULT_AHEAD);
+    emit_patch(e, ok);
+}
+
+/* Fx33 out of the block: chip8_exec, then drops the blocks the write covers (the calling block ends here, its code
+    stays valid until it returns) */
+static bool jit_store(Chip8 *p, uint16_t instruction, Chip8Jit *j)
+{
+    uint16_t i = p->I;
+    if (chip8_exec(p, instruction))
+        return true;
+    chip8_jit_invalidate(j, i, 3);
+    return false;
+}
+
+/* After the inline stores of an Fx55 (I not advanced yet): drops the predecoded entries and the blocks they covered.
+Returns: true if it dropped blocks, the calling block may be one of them and must exit */
+static bool jit_stored(Chip8 *p, uint16_t instruction, Chip8Jit *j)
+{
+    uint16_t len = ((instruction & 0x0F00) >> 8) + 1;
+    chip8_invalidate_decoded(p, p->I, len);
+    if (!covered(j, p->I, (uint32_t)p->I + len))
+        return false;   // Data, the common case
+    chip8_jit_invalidate(j, p->I, len);
+    return true;
+}
+
+/* Stores the result in al to VX, then VF from the carry flag (setc, or setae for "no borrow"). The flag goes last so
+    that with X = F it overwrites the result, as in the interpreter */
+static void emit_store_al_vf(Emitter *e, uint8_t x, uint8_t setcc)
+{
+    emit8(e, 0x0F); emit8(e, setcc); emit8(e, 0xC1);    // setcc cl
+    emit_store_al(e, V_OFF(x));
+    emit_store_cl(e, V_OFF(0xF));
+}
+
+/* Emits the instruction at addr, executed instructions of the block before it, for a VM with the given
+    CHIP8_QUIRK_* flags. Returns false if it isn't translatable inline (it ends the block) */
+static bool emit_instruction(Emitter *e, Chip8Jit *j, uint16_t instruction, uint16_t addr, uint32_t executed,
+                             uint32_t quirks, bool *uses_i)
+{
+    uint8_t x = (instruction & 0x0F00) >> 8;
+    uint8_t y = (instruction & 0x00F0) >> 4;
+    uint8_t nn = instruction & 0x00FF;
+
+    switch (instruction & 0xF000)
+    {
+        case 0x0000:
+            if (instruction == 0x00E0)
+                emit_call_out(e, (const void *)chip8_exec, instruction, NULL, *uses_i, addr, executed);
+            return instruction != 0x00EE;   // 0NNN is a no-op
+        case 0x6000:
+            emit_mem(e, 0xC6, 0, V_OFF(x)); emit8(e, nn);          // mov byte [VX], nn
+            return true;
+        case 0x7000:
+            emit_mem(e, 0x80, 0, V_OFF(x)); emit8(e, nn);          // add byte [VX], nn
+            return true;
+        case 0x8000:
+            switch (instruction & 0x000F)
+            {
+                case 0x0000:
+                    emit_load_al(e, V_OFF(y));
+                    emit_store_al(e, V_OFF(x));
+                    return true;
+                case 0x0001:
+                case 0x0002:
+                case 0x0003: {
+                    static const uint8_t ops[] = { 0, 0x08, 0x20, 0x30 };  // or/and/xor [VX], al
+                    emit_load_al(e, V_OFF(y));
+                    emit_mem(e, ops[instruction & 0x000F], REG_AL, V_OFF(x));
+                    if (quirks & CHIP8_QUIRK_VF_RESET)
+                    {
+                        emit_mem(e, 0xC6, 0, V_OFF(0xF)); emit8(e, 0);     // mov byte [VF], 0
+                    }
+                    return true; }
+                case 0x0004:
+                    emit_load_al(e, V_OFF(x));
+                    emit_mem(e, 0x02, REG_AL, V_OFF(y));           // add al, [VY]
+                    emit_store_al_vf(e, x, 0x92);
+                    return true;
+                case 0x0005:
+                case 0x0007: {
+                    // VX = minuend - subtrahend, VF = no borrow
+                    uint8_t a = (instruction & 0x000F) == 5 ? x : y;
+                    uint8_t b = (instruction & 0x000F) == 5 ? y : x;
+                    emit_load_al(e, V_OFF(a));
+                    emit_mem(e, 0x2A, REG_AL, V_OFF(b));           // sub al, [b]
+                    emit_store_al_vf(e, x, 0x93);
+                    return true; }
+                case 0x0006:
+                    emit_load_al(e, V_OFF(quirks & CHIP8_QUIRK_SHIFT_VY ? y : x));
+                    emit8(e, 0xD0); emit8(e, 0xE8);                // shr al, 1 (the bit shifted out goes to CF)
+                    emit_store_al_vf(e, x, 0x92);
+                    return true;
+                case 0x000E:
+                    emit_load_al(e, V_OFF(quirks & CHIP8_QUIRK_SHIFT_VY ? y : x));
+                    emit8(e, 0x00); emit8(e, 0xC0);                // add al, al
+                    emit_store_al_vf(e, x, 0x92);
+                    return true;
+                default:
+                    return false;
+            }
+        case 0xA000:
+            emit8(e, 0x66); emit8(e, 0xBA); emit16(e, instruction & 0x0FFF);   // mov dx, nnn
+            *uses_i = true;
+            return true;
+        case 0xC000: {
+            // xorshift32 step of rng_state (chip8_rand), VX = top byte & nn
+            uint32_t rng = (uint32_t)offsetof(Chip8, rng_state);
+            static const uint8_t shifts[3][3] = { { 0xE1, 13 }, { 0xE9, 17 }, { 0xE1, 5 } };   // shl/shr/shl ecx
+            emit_mem(e, 0x8B, REG_AL, rng);                                // mov eax, [rng]
+            for (int i = 0; i < 3; i++)
+            {
+                emit8(e, 0x89); emit8(e, 0xC1);                            // mov ecx, eax
+                emit8(e, 0xC1); emit8(e, shifts[i][0]); emit8(e, shifts[i][1]);
+                emit8(e, 0x31); emit8(e, 0xC8);                            // xor eax, ecx
+            }
+            emit_mem(e, 0x89, REG_AL, rng);                                // mov [rng], eax
+            emit8(e, 0xC1); emit8(e, 0xE8); emit8(e, 24);                  // shr eax, 24
+            emit8(e, 0x24); emit8(e, nn);                                  // and al, nn
+            emit_store_al(e, V_OFF(x));
+            return true; }
+        case 0xD000:
+            emit_call_out(e, quirks & CHIP8_QUIRK_CLIP ? (const void *)chip8_draw_clip : (const void *)chip8_draw_wrap,
+                          instruction, NULL, *uses_i, addr, executed);
+            return true;
+        case 0xF000:
+            switch (nn)
+            {
+                case 0x07:
+                    emit_load_al(e, (uint32_t)offsetof(Chip8, delay_timer));
+                    emit_store_al(e, V_OFF(x));
+                    return true;
+                case 0x15:
+                case 0x18:
+                    emit_load_al(e, V_OFF(x));
+                    emit_store_al(e, (uint32_t)(nn == 0x15 ? offsetof(Chip8, delay_timer) : offsetof(Chip8, sound_timer)));
+                    return true;
+                case 0x1E:
+                    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0x87); emit32(e, V_OFF(x));   // movzx eax, byte [VX]
+                    emit8(e, 0x66); emit8(e, 0x01); emit8(e, 0xC2);                        // add dx, ax
+                    *uses_i = true;
+                    return true;
+                case 0x29:
+                    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0x87); emit32(e, V_OFF(x));   // movzx eax, byte [VX]
+                    emit8(e, 0x8D); emit8(e, 0x54); emit8(e, 0x80); emit8(e, FONT_BASE);  // lea edx, [rax + rax*4 + FONT_BASE]
+                    *uses_i = true;
+                    return true;
+                case 0x55: {
+                    // Stores inline like Fx65, the invalidation out of the block, which exits if they hit translated code
+                    *uses_i = true;
+                    emit8(e, 0x0F); emit8(e, 0xB7); emit8(e, 0xC2);                    // movzx eax, dx
+                    emit8(e, 0x3D); emit32(e, CHIP8_MEM_SIZE - 1 - x);                  // cmp eax, last valid I
+                    size_t in_bounds = emit_jcc(e, 0x76);                               // jbe
+                    emit8(e, 0x66); emit_mem(e, 0x89, REG_DX, (uint32_t)offsetof(Chip8, I));  // mov [I], dx
+                    emit_set_pc(e, addr);
+                    emit_return(e, executed | JIT_FAULT_AHEAD);
+                    emit_patch(e, in_bounds);
+                    for (int i = 0; i <= x; i++)
+                    {
+                        emit_load_cl(e, V_OFF(i));
+                        emit8(e, 0x88); emit8(e, 0x8C); emit8(e, 0x07);                // mov [memory + rax + i], cl
+                        emit32(e, (uint32_t)offsetof(Chip8, memory) + i);
+                    }
+                    emit_call(e, (const void *)jit_stored, instruction, j, true);
+                    uint8_t advance = quirks & CHIP8_QUIRK_MEMORY_I ? x + 1 : quirks & CHIP8_QUIRK_MEMORY_I_X ? x : 0;
+                    if (advance)
+                    {
+                        emit8(e, 0x66); emit8(e, 0x83); emit8(e, 0xC2); emit8(e, advance);  // add dx, advance
+                    }
+                    emit8(e, 0x84); emit8(e, 0xC0);                                     // test al, al
+                    size_t kept = emit_jcc(e, 0x74);                                    // jz
+                    // The block-end count of side effects is skipped: count this one
+                    emit8(e, 0x66); emit_mem(e, 0x89, REG_DX, (uint32_t)offsetof(Chip8, I));  // mov [I], dx
+                    emit8(e, 0x48); emit8(e, 0xB8); emit64(e, (uint64_t)(uintptr_t)&j->writes);    // mov rax, &j->writes
+                    emit8(e, 0x83); emit8(e, 0x00); emit8(e, 1);                        // add dword [rax], 1
+                    emit_set_pc(e, addr + 2);
+                    emit_chain(e, j, addr + 2, executed + 1);
+                    emit_patch(e, kept);
+                    return true; }
+                case 0x65: {
+                    // Bounds check on I (loaded by the prologue), then one byte move per register
+                    *uses_i = true;
+                    emit8(e, 0x0F); emit8(e, 0xB7); emit8(e, 0xC2);                    // movzx eax, dx
+                    emit8(e, 0x3D); emit32(e, CHIP8_MEM_SIZE - 1 - x);                  // cmp eax, last valid I
+                    size_t in_bounds = emit_jcc(e, 0x76);                               // jbe
+                    emit8(e, 0x66); emit_mem(e, 0x89, REG_DX, (uint32_t)offsetof(Chip8, I));  // mov [I], dx
+                    emit_set_pc(e, addr);
+                    emit_return(e, executed | JIT_FAULT_AHEAD);
+                    emit_patch(e, in_bounds);
+                    for (int i = 0; i <= x; i++)
+                    {
+                        emit8(e, 0x8A); emit8(e, 0x8C); emit8(e, 0x07);                // mov cl, [memory + rax + i]
+                        emit32(e, (uint32_t)offsetof(Chip8, memory) + i);
+                        emit_store_cl(e, V_OFF(i));
+                    }
+                    uint8_t advance = quirks & CHIP8_QUIRK_MEMORY_I ? x + 1 : quirks & CHIP8_QUIRK_MEMORY_I_X ? x : 0;
+                    if (advance)
+                    {
+                        emit8(e, 0x66); emit8(e, 0x83); emit8(e, 0xC2); emit8(e, advance);  // add dx, advance
+                    }
+                    return true; }
+                default:
+                    return false;
+            }
+        default:
+            return false;
+    }
+}
+
+/* Emits the control transfer (or memory write) ending a block at addr, executed instructions before it, returns
+    false if the instruction isn't a supported terminator. I is already stored */
+static bool emit_terminator(Emitter *e, Chip8Jit *j, uint16_t instruction, uint16_t addr, uint32_t executed,
+                            uint32_t quirks)
+{
+    uint8_t x = (instruction & 0x0F00) >> 8;
+    uint8_t y = (instruction & 0x00F0) >> 4;
+    uint32_t sp = (uint32_t)offsetof(Chip8, sp);
+    uint32_t stack = (uint32_t)offsetof(Chip8, stack);
+    uint8_t jcc;    // Jump opcode taken when the skip does NOT happen
+
+    switch (instruction & 0xF000)
+    {
+        case 0x0000: {
+            if (instruction != 0x00EE)
+                return false;
+            emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0x87); emit32(e, sp);   // movzx eax, byte [sp]
+            emit8(e, 0x84); emit8(e, 0xC0);                                   // test al, al
+            size_t underflow = emit_jcc(e, 0x74);                             // jz
+            emit8(e, 0xFF); emit8(e, 0xC8);                                   // dec eax
+            emit_mem(e, 0x88, REG_AL, sp);                                    // mov [sp], al
+            emit8(e, 0x0F); emit8(e, 0xB7); emit8(e, 0x84); emit8(e, 0x47); emit32(e, stack); // movzx eax, [stack + rax*2]
+            emit8(e, 0x66); emit_mem(e, 0x89, REG_AL, (uint32_t)offsetof(Chip8, pc));          // mov [pc], ax
+            emit_chain_dynamic(e, j, executed + 1);
+            emit_patch(e, underflow);
+            emit_set_pc(e, addr);
+            emit_return(e, executed | JIT_FAULT_AHEAD);
+            return true; }
+        case 0x2000: {
+            emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0x87); emit32(e, sp);   // movzx eax, byte [sp]
+            emit8(e, 0x3C); emit8(e, CHIP8_STACK_SIZE - 1);                   // cmp al, 15
+            size_t overflow = emit_jcc(e, 0x77);                              // ja
+            emit8(e, 0x66); emit8(e, 0xC7); emit8(e, 0x84); emit8(e, 0x47); emit32(e, stack);
+            emit16(e, addr + 2);                                              // mov word [stack + rax*2], addr + 2
+            emit_mem(e, 0xFE, 0, sp);                                         // inc byte [sp]
+            emit_set_pc(e, instruction & 0x0FFF);
+            emit_chain(e, j, instruction & 0x0FFF, executed + 1);
+            emit_patch(e, overflow);
+            emit_set_pc(e, addr);
+            emit_return(e, executed | JIT_FAULT_AHEAD);
+            return true; }
+        case 0xB000:
+            emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0x87);                 // movzx eax, byte [V0 or VX]
+            emit32(e, V_OFF(quirks & CHIP8_QUIRK_JUMP_VX ? x : 0));
+            emit8(e, 0x05); emit32(e, instruction & 0x0FFF);                  // add eax, nnn
+            emit8(e, 0x66); emit_mem(e, 0x89, REG_AL, (uint32_t)offsetof(Chip8, pc));          // mov [pc], ax
+            emit_chain_dynamic(e, j, executed + 1);
+            return true;
+        case 0xF000:
+            if ((instruction & 0x00FF) != 0x33)
+                return false;
+            emit_call_out(e, (const void *)jit_store, instruction, j, false, addr, executed);
+            emit_set_pc(e, addr + 2);
+            emit_chain(e, j, addr + 2, executed + 1);   // Looked up after the write, which may have dropped it
+            return true;
+        case 0x1000:
+            if ((instruction & 0x0FFF) < CHIP8_PC_START_INDEX)
+                return false;   // Illegal jump, let the interpreter report it
+            emit_set_pc(e, instruction & 0x0FFF);
+            if ((instruction & 0x0FFF) > addr)
+                emit_chain(e, j, instruction & 0x0FFF, executed + 1);
+            else
+                emit_return(e, executed + 1);   // Loops go back to chip8_jit_run for the idle probe
+            return true;
+        case 0x3000:
+        case 0x4000:
+            emit_mem(e, 0x80, 7, V_OFF(x)); emit8(e, instruction & 0x00FF);   // cmp byte [VX], nn
+            jcc = (instruction & 0xF000) == 0x3000 ? 0x75 : 0x74;             // jne / je
+            break;
+        case 0x5000:
+        case 0x9000:
+            if (instruction & 0x000F)
+                return false;
+            emit_load_al(e, V_OFF(x));
+            emit_mem(e, 0x3A, REG_AL, V_OFF(y));                               // cmp al, [VY]
+            jcc = (instruction & 0xF000) == 0x5000 ? 0x75 : 0x74;
+            break;
+        case 0xE000:
+            if ((instruction & 0x00FF) != 0x9E && (instruction & 0x00FF) != 0xA1)
+                return false;
+            emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0x87); emit32(e, V_OFF(x));   // movzx eax, byte [VX]
+            emit8(e, 0x83); emit8(e, 0xE0); emit8(e, 0x0F);                         // and eax, 15
+            emit8(e, 0x80); emit8(e, 0xBC); emit8(e, 0x07);                         // cmp byte [keys + rax], 0
+            emit32(e, (uint32_t)offsetof(Chip8, keys)); emit8(e, 0);
+            jcc = (instruction & 0x00FF) == 0x9E ? 0x74 : 0x75;
+            break;
+        default:
+            return false;
+    }
+    size_t no_skip = emit_jcc(e, jcc);
+    emit_set_pc(e, addr + 4);
+    emit_chain(e, j, addr + 4, executed + 1);
+    emit_patch(e, no_skip);
+    emit_set_pc(e, addr + 2);
+    emit_chain(e, j, addr + 2, executed + 1);
+    return true;
+}
+
+// Instructions with side effects the idle probe doesn't compare, as counted by chip8_run
+static bool jit_writes(uint16_t instruction)
+{
+    switch (instruction & 0xF000)
+    {
+        case 0x0000: return instruction == 0x00E0;
+        case 0xC000:
+        case 0xD000: return true;
+        case 0xF000: {
+            uint8_t low = instruction & 0x00FF;
+            return low == 0x15 || low == 0x18 || low == 0x33 || low == 0x55; }
+        default:     return false;
+    }
+}
+
+/* Translates the block starting at pc into the arena */
+static void compile_block(Chip8Jit *j, const Chip8 *p, uint16_t pc)
+{
+    JitBlock *b = &j->blocks[pc >> 1];
+    if (j->code_used + JIT_MAX_BLOCK_BYTES > CHIP8_JIT_CODE_SIZE)
+        chip8_jit_flush(j);
+
+    Emitter e = { .buf = j->code_write + j->code_used, .len = 0 };
+    b->writes = 0;
+    bool uses_i = false;
+    uint32_t quirks = chip8_quirk_flags(p->quirks);
+    emit8(&e, 0x45); emit8(&e, 0x31); emit8(&e, 0xC0);     // xor r8d, r8d
+    emit8(&e, 0x41); emit8(&e, 0x89); emit8(&e, 0xF1);     // mov r9d, esi
+    // Chained blocks enter here. Load I into dx: movzx edx, word [rdi + I]
+    emit8(&e, 0x0F); emit8(&e, 0xB7); emit8(&e, 0x97); emit32(&e, (uint32_t)offsetof(Chip8, I));
+    size_t prologue = e.len - JIT_ENTRY_BYTES;
+
+    uint8_t count = 0;
+    uint16_t addr = pc;
+    while (count < CHIP8_JIT_MAX_BLOCK && addr <= CHIP8_MEM_SIZE - 2)
+    {
+        uint16_t instruction = (uint16_t)((p->memory[addr] << 8) | p->memory[addr + 1]);
+        if (!emit_instruction(&e, j, instruction, addr, count, quirks, &uses_i))
+            break;
+        b->writes += jit_writes(instruction);
+        count++;
+        addr += 2;
+    }
+
+    if (!uses_i)
+    {
+        // Drop the load of I, it is untouched
+        memmove(e.buf + JIT_ENTRY_BYTES, e.buf + JIT_ENTRY_BYTES + prologue, e.len - JIT_ENTRY_BYTES - prologue);
+        e.len -= prologue;
+    }
+    else
+    {
+        emit8(&e, 0x66); emit_mem(&e, 0x89, REG_DX, (uint32_t)offsetof(Chip8, I));     // mov [I], dx
+    }
+
+    // The side effects of the block, terminator included (only Fx33/Fx55 among the terminators have any)
+    bool ends = count < CHIP8_JIT_MAX_BLOCK && addr <= CHIP8_MEM_SIZE - 2;
+    uint16_t next = ends ? (uint16_t)((p->memory[addr] << 8) | p->memory[addr + 1]) : 0;
+    b->writes += ends && jit_writes(next);
+    if (b->writes)
+    {
+        emit8(&e, 0x48); emit8(&e, 0xB8); emit64(&e, (uint64_t)(uintptr_t)&j->writes);    // mov rax, &j->writes
+        emit8(&e, 0x83); emit8(&e, 0x00); emit8(&e, b->writes);                             // add dword [rax], writes
+    }
+
+    // End with the jump/skip that stopped translation if it's supported, else fall through to the interpreter
+    if (ends && emit_terminator(&e, j, next, addr, count, quirks))
+        count++;
+    else if (count == 0)
+    {
+        b->state = JIT_BLOCK_INTERP;
+        return;
+    }
+    else
+    {
+        emit_set_pc(&e, addr);
+        emit_chain(&e, j, addr, count);
+    }
+
+    for (uint32_t a = pc; a < pc + 2u * count; a++)
+        j->covered[a >> 3] |= (uint8_t)(1u << (a & 7));
+    b->offset = (uint32_t)j->code_used;
+    b->count = count;
+    b->state = JIT_BLOCK_NATIVE;
+    j->code_used += (e.len + 15) & ~(size_t)15;
+}
+
+static uint16_t jit_fetch(const Chip8 *p, uint32_t addr)
+{
+    return addr <= CHIP8_MEM_SIZE - 2 ? (uint16_t)((p->memory[addr] << 8) | p->memory[addr + 1]) : 0;
+}
+
+/* Runs the instruction at pc on the interpreter, then drops the blocks it wrote over.
+Returns: true if the instruction is invalid, false otherwise */
+static bool jit_interpret(Chip8Jit *j, Chip8 *p, uint32_t *executed)
+{
+    uint16_t instruction = jit_fetch(p, p->pc);
+    uint16_t i = p->I;
+    bool failed = chip8_run(p, 1, executed);
+    j->writes += jit_writes(instruction);
+    if ((instruction & 0xF0FF) == 0xF033)
+        chip8_jit_invalidate(j, i, 3);
+    else if ((instruction & 0xF0FF) == 0xF055)
+        chip8_jit_invalidate(j, i, ((instruction & 0x0F00) >> 8) + 1);
+    return failed;
+}
+
+bool chip8_jit_run(Chip8Jit *j, Chip8 *p, uint32_t budget, uint32_t *executed)
+{
+    uint32_t count = 0;
+    uint8_t idle = CHIP8_IDLE_NONE;
+    Chip8IdleProbe probe;
+    bool drew = false;
+    bool failed = false;
+
+    chip8_idle_reset(&probe);
+    j->writes = 0;
+    p->draw_flag = false;
+    while (count < budget)
+    {
+        uint16_t pc = p->pc;
+        bool interpret = true;
+        JitBlock *b = !(pc & 0xF001) ? &j->blocks[pc >> 1] : NULL;
+        if (b && b->state == JIT_BLOCK_NONE)
+            compile_block(j, p, pc);
+        if (b && b->state == JIT_BLOCK_NATIVE)
+        {
+            if (b->count > budget - count)
+            {
+                /* Longer than the rest of the budget: interpret its first instructions. They are straight-line,
+                    the runs between its Fx55 go in one call each, an Fx55 alone to drop the blocks it writes over */
+                while (count < budget && !failed)
+                {
+                    uint32_t run = 0, n = 0;
+                    while (run < budget - count && (jit_fetch(p, p->pc + 2 * run) & 0xF0FF) != 0xF055)
+                        run++;
+                    failed = run ? chip8_run(p, run, &n) : jit_interpret(j, p, &n);
+                    count += n;
+                    drew |= p->draw_flag;
+                }
+                break;
+            }
+            uint32_t n = ((JitBlockFn)(void *)(j->code + b->offset))(p, budget - count);
+            count += n & ~JIT_FAULT_AHEAD;
+            drew |= p->draw_flag;
+            interpret = n & JIT_FAULT_AHEAD;    // The interpreter reports the fault
+        }
+        if (interpret)
+        {
+            // Fall back to the interpreter for a single instruction
+            pc = p->pc;
+            uint32_t n = 0;
+            failed = jit_interpret(j, p, &n);
+            count += n;
+            drew |= p->draw_flag;
+            if (failed)
+                break;
+            if (p->idle == CHIP8_IDLE_KEY || p->idle == CHIP8_IDLE_HALT)
+            {
+                idle = p->idle;
+                count = budget;
+                break;
+            }
+            if (p->pc > pc)
+                continue;
+        }
+
+        /* Back here after a backward jump, a return or BNNN: skip whole iterations of a loop that repeats without
+            side effects */
+        if (count < budget)
+        {
+            uint32_t period = chip8_idle_probe(&probe, p, j->writes, count);
+            if (period)
+            {
+                count += (budget - count) / period * period;
+                idle = period == 1 ? CHIP8_IDLE_HALT : CHIP8_IDLE_LOOP;     // A one-instruction loop is a jump to self
+            }
+        }
+    }
+
+    p->draw_flag = drew;
+    p->idle = idle;
+    if (executed) *executed = count;
+    return failed;
+}
+
+#else
+
+bool chip8_jit_run(Chip8Jit *j, Chip8 *p, uint32_t budget, uint32_t *executed)
+{
+    (void)j;
+    return chip8_run(p, budget, executed);
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef CHIP8_JIT_H
+#define CHIP8_JIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+
+/* Optional x86-64 dynamic recompiler.
+    Straight-line code up to a jump, call, return, skip or memory write is translated into native blocks (sprites and
+    memory accesses call back into chip8.c), Fx0A, faulting and invalid instructions run on the interpreter */
+
+#define CHIP8_JIT_CODE_SIZE (1 << 20)   // Executable arena size, flushed when full
+#define CHIP8_JIT_MAX_BLOCK 64          // Max instructions per block
+
+// Translation state of a block start address
+typedef enum {
+    JIT_BLOCK_NONE = 0,     // Not translated yet
+    JIT_BLOCK_NATIVE,       // Native code available
+    JIT_BLOCK_INTERP        // First instruction isn't translatable, always interpret
+} JitBlockState;
+
+typedef struct {
+    uint32_t offset;        // Code offset in the arena
+    uint8_t count;          // Instructions covered by the block
+    uint8_t state;          // JitBlockState
+    uint8_t writes;         // Instructions with side effects the idle probe doesn't compare (timers, display...)
+} JitBlock;
+
+typedef struct {
+    uint8_t *code;                          // Code arena, read/execute view
+    uint8_t *code_write;                    // Read/write view of the same pages, blocks are emitted through it
+    size_t code_used;
+    JitBlock blocks[CHIP8_MEM_SIZE / 2];    // Code cache keyed by (even) guest address
+    uint8_t covered[CHIP8_MEM_SIZE / 8];    // Bit per byte: translated by a block since the last flush
+    uint32_t writes;                        // Side effects counted by translated code during chip8_jit_run
+} Chip8Jit;
+
+// Allocates the code arena, returns true if the host doesn't support the JIT
+bool chip8_jit_init(Chip8Jit *j);
+void chip8_jit_cleanup(Chip8Jit *j);
+
+// Drops every translated block (call when loading a new ROM or restoring memory)
+void chip8_jit_flush(Chip8Jit *j);
+
+// Drops the blocks covering memory[addr .. addr + len - 1]
+void chip8_jit_invalidate(Chip8Jit *j, uint16_t addr, uint16_t len);
+
+// Same contract as chip8_run, executing translated blocks where possible
+bool chip8_jit_run(Chip8Jit *j, Chip8 *p, uint32_t budget, uint32_t *executed);
+
+#endif
@@ -0,0 +1,234 @@
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+#include "logger.h"
+
+/*
+    chip8_verify.c proves memory accesses in bounds before the ROM runs:
+    - Every instruction reachable from the VM's pc (and the return addresses on its stack) is visited with the range
+      of values I can hold on entry to it. Ranges are joined where paths meet and widened to any value after
+      VERIFY_WIDEN growths, so loops that walk I (Fx1E, Fx55/Fx65 with a memory quirk) settle quickly
+    - V registers, keys and timers are unknown: both sides of every skip are taken, BNNN reaches its 256 targets,
+      a return lands after any call with I unknown, and a pc that runs off the end of memory wraps around to 0
+    - Dxyn, Fx33, Fx55 and Fx65 whose highest I keeps the whole access in memory are proven, the interpreter decodes
+      them to handlers without a bounds check. Everything else keeps its check
+    - The proofs hold as long as the reachable code doesn't change: a write to it drops them (see
+      chip8_invalidate_decoded), the ROM then runs fully checked
+*/
+
+#define VERIFY_WIDEN 8     // Growths of an instruction's I range before it becomes [0, 0xFFFF]
+
+typedef struct {
+    uint16_t lo[CHIP8_MEM_SIZE];        // Range of I on entry to the instruction at each address
+    uint16_t hi[CHIP8_MEM_SIZE];
+    uint8_t growths[CHIP8_MEM_SIZE];
+    bool reached[CHIP8_MEM_SIZE];
+    bool queued[CHIP8_MEM_SIZE];
+    uint16_t queue[CHIP8_MEM_SIZE];     // Ring of the addresses to (re)visit, each queued at most once
+    uint32_t head, count;
+} Verifier;
+
+/* Merges I in [lo, hi] into the state on entry to addr, queueing addr if that added anything */
+static void flow(Verifier *v, uint32_t addr, uint16_t lo, uint16_t hi)
+{
+    // Past the end of memory the fetch yields 0000 (a no-op) until pc wraps around to 0, or 1 if it is odd
+    if (addr > CHIP8_MEM_SIZE - 2)
+        addr &= 1;
+    if (v->reached[addr])
+    {
+        if (lo >= v->lo[addr] && hi <= v->hi[addr])
+            return;
+        if (lo > v->lo[addr]) lo = v->lo[addr];
+        if (hi < v->hi[addr]) hi = v->hi[addr];
+        if (++v->growths[addr] > VERIFY_WIDEN)
+        {
+            lo = 0;
+            hi = UINT16_MAX;
+        }
+    }
+    v->reached[addr] = true;
+    v->lo[addr] = lo;
+    v->hi[addr] = hi;
+    if (!v->queued[addr])
+    {
+        v->queued[addr] = true;
+        v->queue[(v->head + v->count++) % CHIP8_MEM_SIZE] = (uint16_t)addr;
+    }
+}
+
+// Adds n to the I range [*lo, *hi], any value if the top can wrap around
+static void advance(uint16_t *lo, uint16_t *hi, uint32_t n)
+{
+    if (*hi + n > UINT16_MAX)
+    {
+        *lo = 0;
+        *hi = UINT16_MAX;
+        return;
+    }
+    *lo = (uint16_t)(*lo + n);
+    *hi = (uint16_t)(*hi + n);
+}
+
+/* Flows the state on entry to the instruction at a to its successors. Instructions that always fault (unknown and
+    illegal opcodes, jumps below CHIP8_PC_START_INDEX) have none */
+static void step(Verifier *v, const Chip8 *p, uint32_t quirks, uint16_t a)
+{
+    uint16_t instruction = (uint16_t)((p->memory[a] << 8) | p->memory[a + 1]);
+    uint16_t nnn = instruction & 0x0FFF;
+    uint8_t nn = instruction & 0x00FF;
+    uint8_t x = (instruction & 0x0F00) >> 8;
+    uint16_t lo = v->lo[a], hi = v->hi[a];
+    uint32_t next = (uint32_t)a + 2;
+
+    switch (instruction >> 12)
+    {
+        case 0x0:
+            if (instruction != 0x00EE)  // Returns continue at the instruction after a call, which the call flows to
+                flow(v, next, lo, hi);
+            break;
+        case 0x1:
+            if (nnn >= CHIP8_PC_START_INDEX)
+                flow(v, nnn, lo, hi);
+            break;
+        case 0x2:
+            flow(v, nnn, lo, hi);
+            flow(v, next, 0, UINT16_MAX);   // After the return I is whatever the subroutine left
+            break;
+        case 0x5:
+        case 0x9:
+            if (instruction & 0x000F)
+                break;
+            /* fall through */
+        case 0x3:
+        case 0x4:
+            flow(v, next, lo, hi);
+            flow(v, next + 2, lo, hi);
+            break;
+        case 0x8:
+            if ((instruction & 0x000F) <= 0x7 || (instruction & 0x000F) == 0xE)
+                flow(v, next, lo, hi);
+            break;
+        case 0xA:
+            flow(v, next, nnn, nnn);
+            break;
+        case 0xB:
+            // NNN + V0, or XNN + VX with the jump quirk: the same 256 targets either way
+            for (uint32_t t = nnn; t <= (uint32_t)nnn + 0xFF; t++)
+                flow(v, t, lo, hi);
+            break;
+        case 0xE:
+            if (nn == 0x9E || nn == 0xA1)
+            {
+                flow(v, next, lo, hi);
+                flow(v, next + 2, lo, hi);
+            }
+            break;
+        case 0xF:
+            switch (nn)
+            {
+                case 0x07: case 0x0A: case 0x15: case 0x18: case 0x33:
+                    flow(v, next, lo, hi);
+                    break;
+                case 0x1E:
+                    if (hi + 0xFFu > UINT16_MAX)
+                        flow(v, next, 0, UINT16_MAX);
+                    else
+                        flow(v, next, lo, (uint16_t)(hi + 0xFF));   // VX may be 0, the bottom stays
+                    break;
+                case 0x29:
+                    flow(v, next, FONT_BASE, FONT_BASE + 0xFF * 5);
+                    break;
+                case 0x55:
+                case 0x65:
+                    if (quirks & CHIP8_QUIRK_MEMORY_I)
+                        advance(&lo, &hi, x + 1u);
+                    else if (quirks & CHIP8_QUIRK_MEMORY_I_X)
+                        advance(&lo, &hi, x);
+                    flow(v, next, lo, hi);
+                    break;
+                default:
+                    break;
+            }
+            break;
+        default:    // 6XNN, 7XNN, CXNN, DXYN
+            flow(v, next, lo, hi);
+            break;
+    }
+}
+
+// Returns the number of bytes from I on the instruction reads or writes, 0 if it doesn't access memory through I
+static uint32_t access_size(uint16_t instruction)
+{
+    switch (instruction >> 12)
+    {
+        case 0xD:
+            return instruction & 0x000F;
+        case 0xF:
+            switch (instruction & 0x00FF)
+            {
+                case 0x33: return 3;
+                case 0x55:
+                case 0x65: return ((instruction & 0x0F00) >> 8) + 1u;
+                default:   return 0;
+            }
+        default:
+            return 0;
+    }
+}
+
+/* Analyzes the code reachable from the VM's current state and records which memory accesses are proven in bounds
+    (p->proven) and which bytes that proof read (p->code). Call after loading code or restoring a state; the
+    predecoded instructions are dropped so the proven ones get decoded to their unchecked handlers.
+Returns: true if the analysis couldn't run, every access then stays checked */
+bool chip8_verify(Chip8 *p)
+{
+    p->verified = false;
+    memset(p->proven, 0, sizeof(p->proven));
+    memset(p->code, 0, sizeof(p->code));
+    chip8_invalidate_decoded(p, 0, CHIP8_MEM_SIZE);
+
+    Verifier *v = calloc(1, sizeof(Verifier));
+    if (!v)
+    {
+        log_msg(LOG_ERROR, "Failed to allocate the ROM verifier, memory accesses stay checked");
+        return true;
+    }
+    uint32_t quirks = chip8_quirk_flags((Chip8Quirks)p->quirks);
+    flow(v, p->pc, p->I, p->I);
+    for (uint8_t s = 0; s < p->sp && s < CHIP8_STACK_SIZE; s++)
+        flow(v, p->stack[s], 0, UINT16_MAX);
+    while (v->count)
+    {
+        uint16_t a = v->queue[v->head];
+        v->head = (v->head + 1) % CHIP8_MEM_SIZE;
+        v->count--;
+        v->queued[a] = false;
+        step(v, p, quirks, a);
+    }
+
+    uint32_t reachable = 0, accesses = 0, proven = 0;
+    for (uint32_t a = 0; a <= CHIP8_MEM_SIZE - 2; a++)
+    {
+        if (!v->reached[a])
+            continue;
+        reachable++;
+        p->code[a >> 3] |= (uint8_t)(1u << (a & 7));
+        p->code[(a + 1) >> 3] |= (uint8_t)(1u << ((a + 1) & 7));
+
+        // Only even addresses are predecoded, odd ones always go through the checked handlers
+        uint32_t size = access_size((uint16_t)((p->memory[a] << 8) | p->memory[a + 1]));
+        if (a & 1 || !size)
+            continue;
+        accesses++;
+        if (v->hi[a] + size <= CHIP8_MEM_SIZE)
+        {
+            p->proven[a >> 4] |= (uint8_t)(1u << ((a >> 1) & 7));
+            proven++;
+        }
+    }
+    free(v);
+    p->verified = true;
+    log_msg(LOG_DEBUG, "verifier: %u reachable instructions, %u of %u memory accesses proven in bounds",
+        reachable, proven, accesses);
+    return false;
+}
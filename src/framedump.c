@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "framedump.h"
+#include "logger.h"
+
+/*
+    framedump.c writes frame streams:
+    - framedump_frames runs on the VM thread: a 32-row compare per output frame, a queue push per display change
+    - The writer thread encodes the records; PNGs are built by hand (stored deflate blocks, the images are tiny)
+      so there's no zlib dependency
+*/
+
+#define FRAMEDUMP_RATE 60       // Emulated frames per second
+#define PNG_ROW_BYTES (1 + CHIP8_DISPLAY_WIDTH / 8)     // Filter byte + 1-bpp pixels
+
+static uint32_t crc_table[256];
+
+static void put32le(uint8_t *b, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        b[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void put32be(uint8_t *b, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        b[i] = (uint8_t)(v >> (24 - 8 * i));
+}
+
+static void crc_init(void)
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t crc32(const uint8_t *b, size_t len)
+{
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++)
+        c = crc_table[(c ^ b[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+// A display row as 1-bpp bytes, most significant bit = leftmost pixel
+static void pack_row(uint8_t *out, uint64_t row)
+{
+    for (int b = 0; b < 8; b++)
+        out[b] = (uint8_t)(row >> (56 - 8 * b));
+}
+
+// Appends a PNG chunk (length, type, data, CRC over type and data) at out, returns its size
+static size_t png_chunk(uint8_t *out, const char *type, const uint8_t *data, uint32_t len)
+{
+    put32be(out, len);
+    memcpy(out + 4, type, 4);
+    memcpy(out + 8, data, len);
+    put32be(out + 8 + len, crc32(out + 4, len + 4));
+    return 12 + len;
+}
+
+/* Encodes a frame as a 2-colour indexed PNG into out, returns its size. The image data is a zlib stream with
+    one stored block: 288 bytes don't compress enough to be worth a deflate encoder */
+static size_t png_encode(const FrameDumpRecord *r, uint8_t *out)
+{
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    static const uint8_t palette[6] = { 0, 0, 0, 255, 255, 255 };
+    uint8_t ihdr[13];
+    put32be(ihdr, CHIP8_DISPLAY_WIDTH);
+    put32be(ihdr + 4, CHIP8_DISPLAY_HEIGHT);
+    ihdr[8] = 1;        // Bit depth
+    ihdr[9] = 3;        // Indexed colour
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+    enum { RAW = CHIP8_DISPLAY_HEIGHT * PNG_ROW_BYTES };
+    uint8_t idat[2 + 5 + RAW + 4];
+    idat[0] = 0x78;     // zlib: deflate, 32K window, no dictionary
+    idat[1] = 0x01;
+    idat[2] = 1;        // Final stored block
+    idat[3] = RAW & 0xFF;
+    idat[4] = RAW >> 8;
+    idat[5] = (uint8_t)~idat[3];
+    idat[6] = (uint8_t)~idat[4];
+    uint32_t a = 1, b = 0;      // Adler-32 of the raw scanlines
+    uint8_t *raw = idat + 7;
+    for (int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++)
+    {
+        raw[y * PNG_ROW_BYTES] = 0;     // Filter: none
+        pack_row(raw + y * PNG_ROW_BYTES + 1, r->display[y]);
+    }
+    for (int i = 0; i < RAW; i++)
+    {
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    put32be(idat + 7 + RAW, b << 16 | a);
+
+    size_t len = 0;
+    memcpy(out, signature, sizeof(signature));
+    len += sizeof(signature);
+    len += png_chunk(out + len, "IHDR", ihdr, sizeof(ihdr));
+    len += png_chunk(out + len, "PLTE", palette, sizeof(palette));
+    len += png_chunk(out + len, "IDAT", idat, sizeof(idat));
+    len += png_chunk(out + len, "IEND", NULL, 0);
+    return len;
+}
+
+// Writer thread: encodes and writes one record, returns true on failure
+static bool write_record(FrameDump *d, const FrameDumpRecord *r)
+{
+    switch (d->format)
+    {
+        case FRAMEDUMP_RAW:
+        {
+            // Only the rows that differ from the previous record follow the mask
+            uint8_t rec[12 + FRAMEDUMP_FRAME_BYTES];
+            uint32_t mask = 0;
+            size_t len = 12;
+            for (int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++)
+            {
+                if (r->display[y] == d->previous[y])
+                    continue;
+                mask |= 1u << y;
+                pack_row(rec + len, r->display[y]);
+                len += 8;
+            }
+            put32le(rec, (uint32_t)r->duration);
+            put32le(rec + 4, (uint32_t)(r->duration >> 32));
+            put32le(rec + 8, mask);
+            memcpy(d->previous, r->display, sizeof(d->previous));
+            d->bytes += len;
+            return fwrite(rec, 1, len, d->f) != len;
+        }
+        case FRAMEDUMP_Y4M:
+        {
+            uint8_t frame[6 + CHIP8_DISPLAY_WIDTH * CHIP8_DISPLAY_HEIGHT];
+            memcpy(frame, "FRAME\n", 6);
+            for (int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++)
+                for (int x = 0; x < CHIP8_DISPLAY_WIDTH; x++)
+                    frame[6 + y * CHIP8_DISPLAY_WIDTH + x] = (r->display[y] >> (63 - x)) & 1 ? 235 : 16;
+            for (uint64_t i = 0; i < r->duration; i++)
+                if (fwrite(frame, 1, sizeof(frame), d->f) != sizeof(frame))
+                    return true;
+            d->bytes += r->duration * sizeof(frame);
+            return false;
+        }
+        case FRAMEDUMP_PNG:
+        {
+            uint8_t png[512];
+            size_t len = png_encode(r, png);
+            char path[4200];
+            snprintf(path, sizeof(path), "%s_%06llu.png", d->stem, (unsigned long long)d->written);
+            FILE *f = fopen(path, "wb");
+            bool failed = !f || fwrite(png, 1, len, f) != len;
+            if (f)
+                failed |= fclose(f) != 0;
+            const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+            failed |= fprintf(d->f, "file '%s'\nduration %.6f\n", name, (double)r->duration / d->fps) < 0;
+            d->bytes += len;
+            return failed;
+        }
+    }
+    return true;
+}
+
+/* Writer thread: takes the queued records in batches and writes them in order until the dump is closed and the
+    queue drained. Batching keeps the two threads from waking each other up for every record */
+static void *framedump_writer(void *arg)
+{
+    FrameDump *d = arg;
+    pthread_mutex_lock(&d->lock);
+    for (;;)
+    {
+        while (d->count < FRAMEDUMP_BATCH && !d->closing)
+            pthread_cond_wait(&d->ready, &d->lock);
+        if (!d->count)
+            break;
+        unsigned n = d->count;
+        for (unsigned i = 0; i < n; i++)
+            d->batch[i] = d->queue[(d->head + i) % FRAMEDUMP_QUEUE];
+        d->head = (d->head + n) % FRAMEDUMP_QUEUE;
+        d->count = 0;
+        pthread_cond_signal(&d->freed);
+        pthread_mutex_unlock(&d->lock);
+
+        bool failed = false;
+        for (unsigned i = 0; i < n; i++, d->written++)
+            failed |= write_record(d, &d->batch[i]);
+
+        pthread_mutex_lock(&d->lock);
+        d->failed |= failed;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return NULL;
+}
+
+// Hands a finished record to the writer, waits only if the queue is full
+static void framedump_push(FrameDump *d, const FrameDumpRecord *r)
+{
+    pthread_mutex_lock(&d->lock);
+    while (d->count == FRAMEDUMP_QUEUE)
+        pthread_cond_wait(&d->freed, &d->lock);
+    d->queue[(d->head + d->count) % FRAMEDUMP_QUEUE] = *r;
+    if (++d->count == FRAMEDUMP_BATCH)
+        pthread_cond_signal(&d->ready);
+    pthread_mutex_unlock(&d->lock);
+}
+
+bool framedump_open(FrameDump *d, const char *path, uint32_t fps)
+{
+    memset(d, 0, sizeof(*d));
+    if (fps < 1 || fps > FRAMEDUMP_MAX_FPS)
+    {
+        log_msg(LOG_ERROR, "frame dump rate must be between 1 and %d fps", FRAMEDUMP_MAX_FPS);
+        return true;
+    }
+    d->fps = fps;
+    const char *ext = strrchr(path, '.');
+    if (ext && strchr(ext, '/'))
+        ext = NULL;
+    d->format = ext && !strcmp(ext, ".y4m") ? FRAMEDUMP_Y4M : ext && !strcmp(ext, ".png") ? FRAMEDUMP_PNG :
+                FRAMEDUMP_RAW;
+
+    char list[4200];
+    const char *file = path;
+    if (d->format == FRAMEDUMP_PNG)
+    {
+        snprintf(d->stem, sizeof(d->stem), "%.*s", (int)(ext - path), path);
+        snprintf(list, sizeof(list), "%s.ffconcat", d->stem);
+        file = list;
+    }
+    d->f = fopen(file, "wb");
+    if (!d->f)
+    {
+        log_msg(LOG_ERROR, "Couldn't open file: '%s'", file);
+        return true;
+    }
+    setvbuf(d->f, NULL, _IOFBF, 1 << 16);
+
+    bool failed = false;
+    if (d->format == FRAMEDUMP_RAW)
+    {
+        uint8_t h[FRAMEDUMP_HEADER_SIZE];
+        memcpy(h, FRAMEDUMP_MAGIC, 4);
+        h[4] = FRAMEDUMP_VERSION;
+        h[5] = CHIP8_DISPLAY_WIDTH;
+        h[6] = CHIP8_DISPLAY_HEIGHT;
+        h[7] = 0;
+        put32le(h + 8, fps);
+        failed = fwrite(h, 1, sizeof(h), d->f) != sizeof(h);
+        d->bytes = sizeof(h);
+    }
+    else if (d->format == FRAMEDUMP_Y4M)
+    {
+        int n = fprintf(d->f, "YUV4MPEG2 W%d H%d F%u:1 Ip A1:1 Cmono\n", CHIP8_DISPLAY_WIDTH, CHIP8_DISPLAY_HEIGHT,
+            fps);
+        failed = n < 0;
+        d->bytes = n > 0 ? (uint64_t)n : 0;
+    }
+    else
+    {
+        crc_init();
+        failed = fprintf(d->f, "ffconcat version 1.0\n") < 0;
+    }
+    if (failed)
+    {
+        log_msg(LOG_ERROR, "Couldn't write file: '%s'", file);
+        fclose(d->f);
+        return true;
+    }
+
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_cond_init(&d->ready, NULL);
+    pthread_cond_init(&d->freed, NULL);
+    if (pthread_create(&d->writer, NULL, framedump_writer, d))
+    {
+        log_msg(LOG_ERROR, "Couldn't start the frame dump writer");
+        fclose(d->f);
+        return true;
+    }
+    return false;
+}
+
+void framedump_frames(FrameDump *d, const Chip8 *vm, uint64_t frames)
+{
+    uint64_t credit = d->credit + frames * d->fps;
+    uint64_t out = credit / FRAMEDUMP_RATE;
+    d->credit = (uint32_t)(credit % FRAMEDUMP_RATE);
+    if (!out)
+        return;
+    d->frames += out;
+    if (d->has_pending && !memcmp(d->pending.display, vm->display, sizeof(d->pending.display)))
+    {
+        d->pending.duration += out;
+        return;
+    }
+    if (d->has_pending)
+        framedump_push(d, &d->pending);
+    memcpy(d->pending.display, vm->display, sizeof(d->pending.display));
+    d->pending.duration = out;
+    d->has_pending = true;
+    d->records++;
+}
+
+bool framedump_close(FrameDump *d)
+{
+    if (d->has_pending)
+        framedump_push(d, &d->pending);
+    pthread_mutex_lock(&d->lock);
+    d->closing = true;
+    pthread_cond_signal(&d->ready);
+    pthread_mutex_unlock(&d->lock);
+    pthread_join(d->writer, NULL);
+    pthread_mutex_destroy(&d->lock);
+    pthread_cond_destroy(&d->ready);
+    pthread_cond_destroy(&d->freed);
+
+    bool failed = d->failed;
+    if (d->format == FRAMEDUMP_PNG && d->written)
+    {
+        // ffmpeg ignores the last entry's duration unless the file is listed once more
+        char path[4200];
+        snprintf(path, sizeof(path), "%s_%06llu.png", d->stem, (unsigned long long)(d->written - 1));
+        const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+        failed |= fprintf(d->f, "file '%s'\n", name) < 0;
+    }
+    failed |= ferror(d->f) != 0;
+    failed |= fclose(d->f) != 0;
+    if (failed)
+        log_msg(LOG_ERROR, "Couldn't write the frame dump");
+    return failed;
+}
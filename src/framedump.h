@@ -0,0 +1,80 @@
+#ifndef FRAMEDUMP_H
+#define FRAMEDUMP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "chip8.h"
+
+/* Frame stream export: the display sampled at a chosen rate, straight from Chip8.display.
+    Consecutive identical frames collapse into one record with a duration (in output frames), so a ROM that
+    sits on a static screen for hours costs one record. The VM thread only compares the display with the pending
+    record and, when it changes, queues the record; a writer thread encodes and writes it. Formats, picked by the
+    file extension:
+    - raw (any other extension): header "C8FD", u8 version, u8 width, u8 height, u8 0, u32 fps, then per record a
+      u64 duration, a u32 mask of the rows that differ from the previous record (a blank screen before the first)
+      and those rows, 1 bpp with the most significant bit = leftmost pixel; integers are little-endian
+    - .y4m: YUV4MPEG2, mono 8-bit; every output frame is written out (Y4M has no durations), 2 KB per frame
+    - .png: an indexed (1-bit) PNG per record, <stem>_<n>.png, plus <stem>.ffconcat listing each file with its
+      duration, which ffmpeg plays back as a video */
+
+#define FRAMEDUMP_MAGIC "C8FD"
+#define FRAMEDUMP_VERSION 1
+#define FRAMEDUMP_HEADER_SIZE 12
+#define FRAMEDUMP_FRAME_BYTES (CHIP8_DISPLAY_HEIGHT * CHIP8_DISPLAY_WIDTH / 8)
+#define FRAMEDUMP_QUEUE 256             // Records queued for the writer, the VM only waits if the disk is that far behind
+#define FRAMEDUMP_BATCH 64              // Records the writer waits for before waking up (or the dump closing)
+#define FRAMEDUMP_MAX_FPS 240
+
+typedef enum {
+    FRAMEDUMP_RAW,
+    FRAMEDUMP_Y4M,
+    FRAMEDUMP_PNG
+} FrameDumpFormat;
+
+typedef struct {
+    uint64_t display[CHIP8_DISPLAY_HEIGHT];
+    uint64_t duration;                  // Output frames it stays on screen
+} FrameDumpRecord;
+
+typedef struct {
+    FrameDumpFormat format;
+    FILE *f;                            // Stream (raw, Y4M) or ffconcat list (PNG)
+    char stem[4096];                    // PNG: path without the extension
+    uint32_t fps;
+    uint32_t credit;                    // Emulated frames * fps not yet turned into output frames
+
+    FrameDumpRecord pending;            // VM thread: record being extended
+    bool has_pending;
+
+    FrameDumpRecord queue[FRAMEDUMP_QUEUE];
+    FrameDumpRecord batch[FRAMEDUMP_QUEUE];     // Writer: records taken off the queue
+    unsigned head, count;
+    bool closing;
+    bool failed;                        // A write failed, set by the writer
+    pthread_mutex_t lock;
+    pthread_cond_t ready;               // A batch was queued or the dump is closing
+    pthread_cond_t freed;               // The writer took a record
+    pthread_t writer;
+
+    uint64_t frames;                    // Output frames so far
+    uint64_t records;                   // Distinct frames so far
+    uint64_t written;                   // Writer: records written (names the next PNG)
+    uint64_t previous[CHIP8_DISPLAY_HEIGHT];    // Writer: last raw record's frame, the next one is a delta
+    uint64_t bytes;                     // Writer: bytes written, valid after framedump_close
+} FrameDump;
+
+/* Creates the dump (format from the extension of path) and starts its writer thread, fps output frames per
+    second of emulated time (1 to FRAMEDUMP_MAX_FPS).
+Returns: true on failure (nothing to close) */
+bool framedump_open(FrameDump *d, const char *path, uint32_t fps);
+
+// Accounts for `frames` emulated frames that all end on vm's current display, call after ticking the timers
+void framedump_frames(FrameDump *d, const Chip8 *vm, uint64_t frames);
+
+/* Queues the last record, waits for the writer and closes the files.
+Returns: true if any part of the dump couldn't be written */
+bool framedump_close(FrameDump *d);
+
+#endif
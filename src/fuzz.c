@@ -0,0 +1,408 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "chip8.h"
+
+/* In-process fuzzing harness
+    An input is a ROM plus a key schedule. Each one runs twice from pristine VM snapshots (memcpy, no chip8_init and no
+    file I/O between executions):
+    - the production path: chip8_load_rom_mem (verifier proofs, unchecked handlers) with superinstructions
+    - the reference: the ROM copied in unverified and without fusion, so every access goes through its bounds check
+    Both run FUZZ_FRAMES frames of FUZZ_IPF instructions. The harness aborts if they end in a different state, and
+    the sanitizers (make fuzz builds with ASan and UBSan, whose bounds check covers memory[] inside the VM) catch
+    an access the verifier wrongly proved in bounds
+    Input layout:
+        byte 0          quirk profile (low 2 bits)
+        byte 1          number of key steps k
+        3 * k bytes     key steps: frame (mod FUZZ_FRAMES), key mask low byte, high byte; applied at the start of
+                        their frame, in input order
+        the rest        the ROM (up to CHIP8_ROM_MAX_SIZE bytes), missing fields read as 0
+    Engines:
+        libFuzzer   make fuzz CC=clang FUZZ_ENGINE=libfuzzer (LLVMFuzzerTestOneInput, no main)
+        AFL++       make fuzz CC=afl-clang-fast (persistent mode, shared-memory test cases)
+        standalone  otherwise: runs the given inputs, or with -n mutates them blindly for that many executions
+    Program usage: ./chip8-fuzz [-n executions] [-s seed] [-o crash_file] [input|dir ...]
+        -n  mutate the inputs (or an empty one) for that many executions and report executions/sec
+        -s  mutation seed (default 1)
+        -o  file holding the input being executed in mutation mode, left behind if it crashed (default
+            fuzz-crash.bin) */
+
+#define FUZZ_FRAMES 8       // Emulated frames per execution
+#define FUZZ_IPF 32         // Instructions per frame
+#define FUZZ_MAX_INPUT (2 + 3 * 255 + CHIP8_ROM_MAX_SIZE)
+#define FUZZ_MUTATIONS 8    // Most mutations stacked on one input
+
+typedef struct {
+    uint32_t executed;      // Instructions, including the one that faulted
+    bool faulted;
+} Outcome;
+
+// Pristine VMs per quirk profile: [profile][0] production, [profile][1] reference
+static Chip8 pristine[CHIP8_QUIRKS_COUNT][2];
+static Chip8 vms[2];
+
+static void fuzz_init(void)
+{
+    static bool done;
+    if (done)
+        return;
+    done = true;
+    for (int q = 0; q < CHIP8_QUIRKS_COUNT; q++)
+    {
+        for (int reference = 0; reference < 2; reference++)
+        {
+            Chip8 *p = &pristine[q][reference];
+            chip8_init(p);
+            chip8_set_quirks(p, (Chip8Quirks)q);
+            chip8_set_fusion(p, !reference);
+        }
+    }
+}
+
+// Resets vm to its snapshot, loads the input's ROM and runs its frames
+static Outcome execute(Chip8 *vm, const uint8_t *data, size_t size, bool reference)
+{
+    uint8_t quirks = size ? data[0] % CHIP8_QUIRKS_COUNT : 0;
+    size_t steps = size > 1 ? data[1] : 0;
+    const uint8_t *schedule = data + 2;
+    if (steps * 3 > (size > 2 ? size - 2 : 0))
+        steps = size > 2 ? (size - 2) / 3 : 0;
+    size_t header = size < 2 ? size : 2 + steps * 3;
+    const uint8_t *rom = data + header;
+    size_t rom_size = size - header;
+    if (rom_size > CHIP8_ROM_MAX_SIZE)
+        rom_size = CHIP8_ROM_MAX_SIZE;
+
+    memcpy(vm, &pristine[quirks][reference], sizeof(Chip8));
+    if (reference)
+        memcpy(vm->memory + CHIP8_PC_START_INDEX, rom, rom_size);   // No proofs: every access stays checked
+    else
+        chip8_load_rom_mem(vm, rom, rom_size);
+
+    Outcome out = { 0 };
+    for (uint32_t frame = 0; frame < FUZZ_FRAMES; frame++)
+    {
+        for (size_t s = 0; s < steps; s++)
+            if (schedule[3 * s] % FUZZ_FRAMES == frame)
+                chip8_set_key_mask(vm, (uint16_t)(schedule[3 * s + 1] | schedule[3 * s + 2] << 8));
+        uint32_t executed = 0;
+        out.faulted = chip8_run(vm, FUZZ_IPF, &executed);
+        out.executed += executed;
+        if (out.faulted)
+            break;
+        chip8_tick_timers(vm);
+    }
+    return out;
+}
+
+// Prints the first guest-visible difference between the two runs and aborts
+static void diverged(const char *what, const Outcome *a, const Outcome *b)
+{
+    const Chip8 *p = &vms[0], *r = &vms[1];
+    fprintf(stderr, "chip8-fuzz: production and reference runs differ in %s\n", what);
+    fprintf(stderr, "  production: %u instructions%s pc=%03X I=%03X sp=%u\n", a->executed,
+        a->faulted ? " (fault)" : "", p->pc, p->I, p->sp);
+    fprintf(stderr, "  reference:  %u instructions%s pc=%03X I=%03X sp=%u\n", b->executed,
+        b->faulted ? " (fault)" : "", r->pc, r->I, r->sp);
+    abort();
+}
+
+// Runs one input on both paths and checks they agree
+static void fuzz_one(const uint8_t *data, size_t size)
+{
+    fuzz_init();
+    if (size > FUZZ_MAX_INPUT)
+        size = FUZZ_MAX_INPUT;
+    Outcome a = execute(&vms[0], data, size, false);
+    Outcome b = execute(&vms[1], data, size, true);
+    const Chip8 *p = &vms[0], *r = &vms[1];
+    if (a.executed != b.executed || a.faulted != b.faulted)
+        diverged("the instruction count or fault", &a, &b);
+    if (p->pc != r->pc || p->I != r->I || p->sp != r->sp || memcmp(p->V, r->V, sizeof(p->V)) ||
+        memcmp(p->stack, r->stack, sizeof(p->stack)))
+        diverged("the registers", &a, &b);
+    if (p->delay_timer != r->delay_timer || p->sound_timer != r->sound_timer || p->rng_state != r->rng_state)
+        diverged("the timers or the PRNG", &a, &b);
+    if (memcmp(p->memory, r->memory, sizeof(p->memory)))
+        diverged("memory", &a, &b);
+    if (memcmp(p->display, r->display, sizeof(p->display)))
+        diverged("the display", &a, &b);
+}
+
+#if defined(CHIP8_LIBFUZZER)
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    fuzz_one(data, size);
+    return 0;
+}
+
+#else
+
+#ifdef __AFL_FUZZ_TESTCASE_LEN
+__AFL_FUZZ_INIT();
+#endif
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+} Input;
+
+static Input *inputs;
+static size_t input_count, input_cap;
+static uint8_t current[FUZZ_MAX_INPUT];     // Input being executed in mutation mode
+static size_t current_size;
+static const char *crash_path = "fuzz-crash.bin";
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: chip8-fuzz [-n executions] [-s seed] [-o crash_file] [input|dir ...]\n");
+}
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+// Reads a file into the input list. Returns: true if it couldn't be read
+static bool add_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "chip8-fuzz: couldn't open '%s'\n", path);
+        return true;
+    }
+    if (input_count == input_cap)
+    {
+        input_cap = input_cap ? input_cap * 2 : 64;
+        Input *grown = realloc(inputs, input_cap * sizeof(Input));
+        if (!grown)
+        {
+            fclose(f);
+            return true;
+        }
+        inputs = grown;
+    }
+    Input *in = &inputs[input_count];
+    in->data = malloc(FUZZ_MAX_INPUT);
+    in->size = in->data ? fread(in->data, 1, FUZZ_MAX_INPUT, f) : 0;
+    fclose(f);
+    if (!in->data)
+        return true;
+    input_count++;
+    return false;
+}
+
+// Adds a file, or every regular file of a directory
+static bool add_path(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) || !S_ISDIR(st.st_mode))
+        return add_file(path);
+    DIR *d = opendir(path);
+    if (!d)
+    {
+        fprintf(stderr, "chip8-fuzz: couldn't open '%s'\n", path);
+        return true;
+    }
+    bool failed = false;
+    for (struct dirent *e; (e = readdir(d)); )
+    {
+        char file[4096];
+        snprintf(file, sizeof(file), "%s/%s", path, e->d_name);
+        if (!stat(file, &st) && S_ISREG(st.st_mode))
+            failed |= add_file(file);
+    }
+    closedir(d);
+    return failed;
+}
+
+// xorshift64 step of the mutation generator
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+// Offset of the ROM in current, after the quirk byte and the key schedule
+static size_t rom_offset(void)
+{
+    size_t header = 2 + (size_t)current[1] * 3;
+    return header < current_size ? header : current_size;
+}
+
+/* Blind mutations of current that keep its layout: bit flips and random bytes in the ROM, instructions that move or
+    use I written over or inserted between its instructions (the accesses the verifier has to get right), a new quirk
+    profile, an added key step and truncation */
+static void mutate(uint64_t *rng)
+{
+    static const uint16_t opcodes[] = { 0xA000, 0xF01E, 0xF033, 0xF055, 0xF065, 0xF029, 0xD001, 0xB000, 0x2000,
+        0x1000, 0x00EE, 0x3000, 0x7000, 0x6000 };
+    if (current_size < 2)
+    {
+        current[0] = current[1] = 0;
+        current_size = 2;
+    }
+    uint32_t count = 1 + (uint32_t)(next_random(rng) % FUZZ_MUTATIONS);
+    for (uint32_t m = 0; m < count; m++)
+    {
+        uint64_t r = next_random(rng);
+        size_t rom = rom_offset(), rom_size = current_size - rom;
+        size_t at = rom + (rom_size ? (size_t)(r >> 32) % rom_size : 0);
+        switch (r % 6)
+        {
+            case 0:
+                if (rom_size)
+                    current[at] ^= (uint8_t)(1u << ((r >> 8) & 7));
+                break;
+            case 1:
+                if (rom_size)
+                    current[at] = (uint8_t)(r >> 16);
+                break;
+            case 2:     // An instruction with random operands at an even ROM offset, inserted or written over
+            {
+                uint16_t op = opcodes[(r >> 8) % (sizeof(opcodes) / sizeof(opcodes[0]))];
+                op |= (uint16_t)((r >> 16) & (op == 0x00EE ? 0 : op >= 0xE000 ? 0x0F00 : 0x0FFF));
+                if (op >> 12 == 0xA && (r >> 40) & 1)
+                    op |= 0x0F00;   // Half of the ANNN point into the last 256 bytes, next to the edge
+                at = rom + (size_t)(r >> 44) % (rom_size / 2 + 1) * 2;
+                if (current_size + 2 > FUZZ_MAX_INPUT)
+                    break;
+                if ((r >> 41) & 1 && at < current_size)
+                {
+                    memmove(current + at + 2, current + at, current_size - at);
+                    current_size += 2;
+                }
+                else if (at + 2 > current_size)
+                    current_size = at + 2;
+                current[at] = (uint8_t)(op >> 8);
+                current[at + 1] = (uint8_t)op;
+                break;
+            }
+            case 3:
+                current[0] = (uint8_t)(r >> 16);
+                break;
+            case 4:     // Now and then a key step, put in front of the ROM
+                if (!((r >> 32) % 8) && current[1] < 255 && current_size + 3 <= FUZZ_MAX_INPUT &&
+                    rom == 2 + (size_t)current[1] * 3)
+                {
+                    memmove(current + rom + 3, current + rom, rom_size);
+                    current[rom] = (uint8_t)(r >> 8);
+                    current[rom + 1] = (uint8_t)(r >> 16);
+                    current[rom + 2] = (uint8_t)(r >> 24);
+                    current[1]++;
+                    current_size += 3;
+                }
+                break;
+            default:
+                current_size = at;
+                break;
+        }
+    }
+}
+
+/* Writes current to the crash file before it runs, so whatever kills the process (a sanitizer report, the
+    divergence check's abort, a signal) leaves the input behind. Returns: true if the write failed */
+static bool keep_input(int fd)
+{
+    return pwrite(fd, current, current_size, 0) != (ssize_t)current_size || ftruncate(fd, (off_t)current_size);
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef __AFL_FUZZ_TESTCASE_LEN
+    (void)argc;
+    (void)argv;
+    fuzz_init();
+    __AFL_INIT();
+    const uint8_t *buf = __AFL_FUZZ_TESTCASE_BUF;
+    while (__AFL_LOOP(100000))
+        fuzz_one(buf, (size_t)__AFL_FUZZ_TESTCASE_LEN);
+    return 0;
+#endif
+    uint64_t executions = 0;
+    uint64_t seed = 1;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++)    // Read options
+    {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            executions = strtoull(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            crash_path = argv[++i];
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    for (; i < argc; i++)
+        if (add_path(argv[i]))
+            return 1;
+    if (!executions && !input_count)
+    {
+        usage();
+        return 1;
+    }
+
+    fuzz_init();
+    double start = now();
+    if (!executions)
+    {
+        for (size_t k = 0; k < input_count; k++)
+            fuzz_one(inputs[k].data, inputs[k].size);
+        printf("%zu inputs, production and reference runs agree\n", input_count);
+        return 0;
+    }
+
+    int fd = open(crash_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        fprintf(stderr, "chip8-fuzz: couldn't create '%s'\n", crash_path);
+        return 1;
+    }
+    uint64_t rng = seed ? seed : 1;
+    for (uint64_t n = 0; n < executions; n++)
+    {
+        if (input_count)
+        {
+            const Input *in = &inputs[next_random(&rng) % input_count];
+            memcpy(current, in->data, in->size);
+            current_size = in->size;
+        }
+        else if (!(n % 64))
+        {
+            current[1] = 0;     // Start over from an empty ROM and key schedule now and then
+            current_size = 2;
+        }
+        mutate(&rng);
+        if (keep_input(fd))
+        {
+            fprintf(stderr, "chip8-fuzz: couldn't write '%s'\n", crash_path);
+            close(fd);
+            return 1;
+        }
+        fuzz_one(current, current_size);
+    }
+    close(fd);
+    unlink(crash_path);     // Nothing crashed
+    double seconds = now() - start;
+    printf("%llu executions in %.2f s (%.0f/s), production and reference runs agree\n",
+        (unsigned long long)executions, seconds, (double)executions / seconds);
+    return 0;
+}
+
+#endif
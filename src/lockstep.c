@@ -0,0 +1,420 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lockstep.h"
+#include "logger.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+    lockstep.c steps many VMs of one ROM together:
+    - Every step picks the pc of the first live lane; lanes at that pc whose code matches form the group
+    - Register-only instructions run on the whole group at once (SSE2 over 16 lanes per vector, masked blends
+      keep the other lanes untouched), anything else runs lane by lane on chip8_run
+    - Lanes outside the group step on the scalar interpreter in the same call, so all lanes stay in lockstep
+      (same instruction count)
+*/
+
+#define VROW(ls, r) ((ls)->V + (size_t)(r) * (ls)->padded)
+
+static void *lane_array(size_t padded, size_t elem)
+{
+    void *p = aligned_alloc(LOCKSTEP_LANE_ALIGN, padded * elem);
+    if (p) memset(p, 0, padded * elem);
+    return p;
+}
+
+// Copies a lane's registers from its Chip8 into the arrays
+static void load_lane(Lockstep *ls, size_t l)
+{
+    const Chip8 *vm = &ls->vms[l];
+    ls->pc[l] = vm->pc;
+    ls->I[l] = vm->I;
+    for (int r = 0; r < CHIP8_REGISTER_COUNT; r++)
+        VROW(ls, r)[l] = vm->V[r];
+    ls->delay_timer[l] = vm->delay_timer;
+    ls->sound_timer[l] = vm->sound_timer;
+    ls->sp[l] = vm->sp;
+}
+
+void lockstep_sync(Lockstep *ls, size_t l)
+{
+    Chip8 *vm = &ls->vms[l];
+    vm->pc = ls->pc[l];
+    vm->I = ls->I[l];
+    for (int r = 0; r < CHIP8_REGISTER_COUNT; r++)
+        vm->V[r] = VROW(ls, r)[l];
+    vm->delay_timer = ls->delay_timer[l];
+    vm->sound_timer = ls->sound_timer[l];
+    vm->sp = ls->sp[l];
+}
+
+bool lockstep_init(Lockstep *ls, const Chip8 *proto, size_t lanes, uint32_t seed)
+{
+    *ls = (Lockstep){ .lanes = lanes };
+    ls->padded = (lanes + LOCKSTEP_LANE_ALIGN - 1) / LOCKSTEP_LANE_ALIGN * LOCKSTEP_LANE_ALIGN;
+    ls->proto = *proto;
+
+    ls->pc = lane_array(ls->padded, sizeof(uint16_t));
+    ls->I = lane_array(ls->padded, sizeof(uint16_t));
+    ls->V = lane_array(ls->padded, CHIP8_REGISTER_COUNT);
+    ls->delay_timer = lane_array(ls->padded, 1);
+    ls->sound_timer = lane_array(ls->padded, 1);
+    ls->sp = lane_array(ls->padded, 1);
+    ls->alive = lane_array(ls->padded, 1);
+    ls->mem_written = lane_array(ls->padded, 1);
+    ls->mask = lane_array(ls->padded, 1);
+    ls->vms = malloc(lanes * sizeof(Chip8));
+    if (!ls->pc || !ls->I || !ls->V || !ls->delay_timer || !ls->sound_timer || !ls->sp ||
+        !ls->alive || !ls->mem_written || !ls->mask || !ls->vms)
+    {
+        log_msg(LOG_ERROR, "Failed to allocate %zu lockstep lanes", lanes);
+        lockstep_cleanup(ls);
+        return true;
+    }
+
+    for (size_t l = 0; l < lanes; l++)
+    {
+        ls->vms[l] = *proto;
+        chip8_seed(&ls->vms[l], seed + (uint32_t)l);
+        load_lane(ls, l);
+        ls->alive[l] = 0xFF;
+    }
+    ls->live = lanes;
+    return false;
+}
+
+void lockstep_cleanup(Lockstep *ls)
+{
+    free(ls->pc);
+    free(ls->I);
+    free(ls->V);
+    free(ls->delay_timer);
+    free(ls->sound_timer);
+    free(ls->sp);
+    free(ls->alive);
+    free(ls->mem_written);
+    free(ls->mask);
+    free(ls->vms);
+    *ls = (Lockstep){0};
+}
+
+// Runs one instruction of a lane on the interpreter
+static void scalar_step(Lockstep *ls, size_t l)
+{
+    Chip8 *vm = &ls->vms[l];
+    lockstep_sync(ls, l);
+    uint16_t instruction = vm->pc <= CHIP8_MEM_SIZE - 2 ? (uint16_t)((vm->memory[vm->pc] << 8) | vm->memory[vm->pc + 1]) : 0;
+    if (((instruction & 0xF0FF) == 0xF033 || (instruction & 0xF0FF) == 0xF055) && !ls->mem_written[l])
+    {
+        ls->mem_written[l] = 1;
+        ls->written_lanes++;
+    }
+    if (chip8_run(vm, 1, NULL))
+    {
+        ls->alive[l] = 0;
+        ls->live--;
+    }
+    load_lane(ls, l);
+    ls->scalar_instructions++;
+}
+
+/* Instructions whose quirk the vector path doesn't implement (shifts of VY, logic ops resetting VF): the lanes run
+    them on their own interpreter instance */
+static bool quirky_op(const Lockstep *ls, uint16_t instruction)
+{
+    uint32_t quirks = chip8_quirk_flags(ls->proto.quirks);
+    if ((instruction & 0xF000) != 0x8000 || !quirks)
+        return false;
+    uint8_t n = instruction & 0x000F;
+    return ((n == 0x6 || n == 0xE) && (quirks & CHIP8_QUIRK_SHIFT_VY)) ||
+        (n >= 0x1 && n <= 0x3 && (quirks & CHIP8_QUIRK_VF_RESET));
+}
+
+#ifdef __SSE2__
+
+// Instructions the vector path handles: register, timer and I updates, skips and in-range jumps
+static bool is_vector_op(uint16_t instruction)
+{
+    switch (instruction & 0xF000)
+    {
+        case 0x0000: return instruction != 0x00E0 && instruction != 0x00EE;
+        case 0x1000: return (instruction & 0x0FFF) >= CHIP8_PC_START_INDEX;
+        case 0x3000:
+        case 0x4000:
+        case 0x6000:
+        case 0x7000:
+        case 0xA000: return true;
+        case 0x5000:
+        case 0x9000: return (instruction & 0x000F) == 0;
+        case 0x8000: {
+            uint8_t n = instruction & 0x000F;
+            return n <= 7 || n == 0xE; }
+        case 0xF000:
+            switch (instruction & 0x00FF)
+            {
+                case 0x07: case 0x15: case 0x18: case 0x1E: case 0x29: return true;
+                default: return false;
+            }
+        default: return false;
+    }
+}
+
+static inline __m128i blend(__m128i old, __m128i val, __m128i m)
+{
+    return _mm_or_si128(_mm_and_si128(m, val), _mm_andnot_si128(m, old));
+}
+
+static inline __m128i ld(const uint8_t *p) { return _mm_load_si128((const __m128i *)p); }
+static inline void st(uint8_t *p, __m128i v) { _mm_store_si128((__m128i *)p, v); }
+
+/* 8XYn on every masked lane, 16 at a time. Like the interpreter, VX and VF are computed from the values before the
+    instruction and VF is written last, so with X = F the flag wins */
+static void vector_alu(Lockstep *ls, uint8_t x, uint8_t y, uint8_t n)
+{
+    const __m128i one = _mm_set1_epi8(1);
+    uint8_t *vx = VROW(ls, x), *vy = VROW(ls, y), *vf = VROW(ls, 0xF);
+
+    for (size_t b = 0; b < ls->padded; b += 16)
+    {
+        __m128i m = ld(ls->mask + b);
+        __m128i a = ld(vx + b), c = ld(vy + b), res, flag;
+        bool flags = true;
+        switch (n)
+        {
+            case 0x0: res = c; flags = false; break;
+            case 0x1: res = _mm_or_si128(a, c); flags = false; break;
+            case 0x2: res = _mm_and_si128(a, c); flags = false; break;
+            case 0x3: res = _mm_xor_si128(a, c); flags = false; break;
+            case 0x4: {
+                res = _mm_add_epi8(a, c);
+                __m128i no_carry = _mm_cmpeq_epi8(_mm_max_epu8(res, a), res);   // sum >= VX
+                flag = _mm_andnot_si128(no_carry, one);
+                break; }
+            case 0x5:
+            case 0x7: {
+                __m128i lhs = n == 0x5 ? a : c, rhs = n == 0x5 ? c : a;
+                flag = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(lhs, rhs), lhs), one);
+                res = _mm_sub_epi8(lhs, rhs);
+                break; }
+            case 0x6:
+                flag = _mm_and_si128(a, one);
+                res = _mm_and_si128(_mm_srli_epi16(a, 1), _mm_set1_epi8(0x7F));
+                break;
+            default:    // 0xE
+                flag = _mm_and_si128(_mm_srli_epi16(a, 7), one);
+                res = _mm_add_epi8(a, a);
+                break;
+        }
+        st(vx + b, blend(ld(vx + b), res, m));
+        if (flags)
+            st(vf + b, blend(ld(vf + b), flag, m));
+    }
+}
+
+// Sets dst = src on masked lanes (byte arrays)
+static void vector_copy(Lockstep *ls, uint8_t *dst, const uint8_t *src)
+{
+    for (size_t b = 0; b < ls->padded; b += 16)
+        st(dst + b, blend(ld(dst + b), ld(src + b), ld(ls->mask + b)));
+}
+
+// Applies a per-lane 16-bit update to a uint16_t lane array: dst = blend(dst, f(dst, widened src bytes), mask)
+#define U16_LANES(ls, dst, srcbytes, expr)                                          \
+    for (size_t b = 0; b < (ls)->padded; b += 16)                                   \
+    {                                                                               \
+        __m128i m8 = ld((ls)->mask + b), s8 = (srcbytes);                           \
+        for (int h = 0; h < 2; h++)                                                 \
+        {                                                                           \
+            __m128i *ptr = (__m128i *)((dst) + b + h * 8);                          \
+            __m128i m = h ? _mm_unpackhi_epi8(m8, m8) : _mm_unpacklo_epi8(m8, m8);  \
+            __m128i src = h ? _mm_unpackhi_epi8(s8, zero) : _mm_unpacklo_epi8(s8, zero); \
+            __m128i cur = _mm_load_si128(ptr);                                      \
+            (void)src;                                                              \
+            _mm_store_si128(ptr, blend(cur, (expr), m));                            \
+        }                                                                           \
+    }
+
+/* Executes a register-only instruction on every masked lane */
+static void vector_exec(Lockstep *ls, uint16_t instruction)
+{
+    uint8_t x = (instruction & 0x0F00) >> 8;
+    uint8_t y = (instruction & 0x00F0) >> 4;
+    uint8_t nn = instruction & 0x00FF;
+    uint16_t nnn = instruction & 0x0FFF;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    uint8_t *vx = VROW(ls, x), *vy = VROW(ls, y);
+    const uint8_t *mask = ls->mask;
+
+    // pc: +2 for every instruction, +2 more for taken skips, or the jump target
+    switch (instruction & 0xF000)
+    {
+        case 0x1000:
+            U16_LANES(ls, ls->pc, zero, _mm_set1_epi16((short)nnn));
+            break;
+        case 0x3000:
+            U16_LANES(ls, ls->pc, _mm_cmpeq_epi8(ld(vx + b), _mm_set1_epi8((char)nn)),
+                _mm_add_epi16(cur, _mm_add_epi16(two, _mm_and_si128(_mm_srli_epi16(src, 6), two))));
+            break;
+        case 0x4000:
+            U16_LANES(ls, ls->pc, _mm_cmpeq_epi8(ld(vx + b), _mm_set1_epi8((char)nn)),
+                _mm_add_epi16(cur, _mm_add_epi16(two, _mm_andnot_si128(_mm_srli_epi16(src, 6), two))));
+            break;
+        case 0x5000:
+            U16_LANES(ls, ls->pc, _mm_cmpeq_epi8(ld(vx + b), ld(vy + b)),
+                _mm_add_epi16(cur, _mm_add_epi16(two, _mm_and_si128(_mm_srli_epi16(src, 6), two))));
+            break;
+        case 0x9000:
+            U16_LANES(ls, ls->pc, _mm_cmpeq_epi8(ld(vx + b), ld(vy + b)),
+                _mm_add_epi16(cur, _mm_add_epi16(two, _mm_andnot_si128(_mm_srli_epi16(src, 6), two))));
+            break;
+        default:
+            U16_LANES(ls, ls->pc, zero, _mm_add_epi16(cur, two));
+            break;
+    }
+
+    switch (instruction & 0xF000)
+    {
+        case 0x6000:
+            for (size_t b = 0; b < ls->padded; b += 16)
+                st(vx + b, blend(ld(vx + b), _mm_set1_epi8((char)nn), ld(mask + b)));
+            break;
+        case 0x7000:
+            for (size_t b = 0; b < ls->padded; b += 16)
+                st(vx + b, blend(ld(vx + b), _mm_add_epi8(ld(vx + b), _mm_set1_epi8((char)nn)), ld(mask + b)));
+            break;
+        case 0x8000:
+            vector_alu(ls, x, y, instruction & 0x000F);
+            break;
+        case 0xA000:
+            U16_LANES(ls, ls->I, zero, _mm_set1_epi16((short)nnn));
+            break;
+        case 0xF000:
+            switch (nn)
+            {
+                case 0x07: vector_copy(ls, vx, ls->delay_timer); break;
+                case 0x15: vector_copy(ls, ls->delay_timer, vx); break;
+                case 0x18: vector_copy(ls, ls->sound_timer, vx); break;
+                case 0x1E:
+                    U16_LANES(ls, ls->I, ld(vx + b), _mm_add_epi16(cur, src));
+                    break;
+                case 0x29:
+                    U16_LANES(ls, ls->I, ld(vx + b),
+                        _mm_add_epi16(_mm_set1_epi16(FONT_BASE), _mm_mullo_epi16(src, _mm_set1_epi16(5))));
+                    break;
+            }
+            break;
+        default:    // 0NNN no-op, jumps and skips only touch pc
+            break;
+    }
+}
+
+/* Builds the group mask (live lanes at pc) 16 lanes at a time, returns the group size */
+static size_t vector_group(Lockstep *ls, uint16_t pc)
+{
+    const __m128i target = _mm_set1_epi16((short)pc);
+    size_t group = 0;
+    for (size_t b = 0; b < ls->padded; b += 16)
+    {
+        __m128i lo = _mm_cmpeq_epi16(_mm_load_si128((const __m128i *)(ls->pc + b)), target);
+        __m128i hi = _mm_cmpeq_epi16(_mm_load_si128((const __m128i *)(ls->pc + b + 8)), target);
+        __m128i m = _mm_and_si128(_mm_packs_epi16(lo, hi), ld(ls->alive + b));
+        st(ls->mask + b, m);
+        group += __builtin_popcount(_mm_movemask_epi8(m));
+    }
+    return group;
+}
+
+#else
+
+static bool is_vector_op(uint16_t instruction)
+{
+    (void)instruction;
+    return false;
+}
+
+static void vector_exec(Lockstep *ls, uint16_t instruction)
+{
+    (void)ls;
+    (void)instruction;
+}
+
+static size_t vector_group(Lockstep *ls, uint16_t pc)
+{
+    size_t group = 0;
+    for (size_t l = 0; l < ls->lanes; l++)
+    {
+        ls->mask[l] = ls->alive[l] && ls->pc[l] == pc ? 0xFF : 0;
+        group += ls->mask[l] != 0;
+    }
+    return group;
+}
+
+#endif
+
+static uint16_t opcode_at(const Chip8 *vm, uint16_t pc)
+{
+    return (uint16_t)((vm->memory[pc] << 8) | vm->memory[pc + 1]);
+}
+
+size_t lockstep_step(Lockstep *ls)
+{
+    size_t lanes = ls->lanes;
+    if (!ls->live)
+        return 0;
+    size_t leader = 0;
+    while (leader < lanes && !ls->alive[leader])
+        leader++;
+    if (leader == lanes)
+        return 0;
+    ls->steps++;
+
+    // Group = live lanes at the leader's pc running the same instruction there
+    uint16_t pc = ls->pc[leader];
+    bool in_memory = pc <= CHIP8_MEM_SIZE - 2;
+    uint16_t instruction = in_memory ? opcode_at(&ls->vms[leader], pc) : 0;
+    size_t group = in_memory ? vector_group(ls, pc) : 0;
+    if (!in_memory)
+        memset(ls->mask, 0, ls->padded);
+    if (group && ls->written_lanes)
+    {
+        // Lanes whose memory was written may run different code at the same pc
+        bool proto_match = opcode_at(&ls->proto, pc) == instruction;
+        for (size_t l = 0; l < lanes; l++)
+        {
+            if (ls->mask[l] && !(ls->mem_written[l] ? opcode_at(&ls->vms[l], pc) == instruction : proto_match))
+            {
+                ls->mask[l] = 0;
+                group--;
+            }
+        }
+    }
+    if (group < ls->live)
+        ls->divergent_steps++;
+
+    bool vector = group && is_vector_op(instruction) && !quirky_op(ls, instruction);
+    if (vector)
+    {
+        vector_exec(ls, instruction);
+        ls->vector_instructions += group;
+        if (group == ls->live)
+            return ls->live;
+    }
+
+    // Everything the vector path didn't run steps on the interpreter
+    for (size_t l = 0; l < lanes; l++)
+        if (ls->alive[l] && !(vector && ls->mask[l]))
+            scalar_step(ls, l);
+    return ls->live;
+}
+
+void lockstep_tick_timers(Lockstep *ls)
+{
+    // Halted lanes keep their final timer values, like a VM whose run stopped
+    for (size_t l = 0; l < ls->padded; l++)
+    {
+        ls->delay_timer[l] -= ls->delay_timer[l] != 0 && ls->alive[l];
+        ls->sound_timer[l] -= ls->sound_timer[l] != 0 && ls->alive[l];
+    }
+}
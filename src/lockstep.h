@@ -0,0 +1,55 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+
+/* Lockstep engine: N VMs of the same ROM stepped one instruction at a time together.
+    Hot registers are kept as structure-of-arrays so lanes sharing a pc execute register-only
+    instructions as one SSE2 operation, other lanes (and other instructions) step on the scalar interpreter */
+
+#define LOCKSTEP_LANE_ALIGN 16  // Lane count is padded to a multiple of one SSE2 vector
+
+typedef struct {
+    size_t lanes;           // Lanes in use
+    size_t padded;          // Array stride, lanes rounded up to LOCKSTEP_LANE_ALIGN
+
+    // Structure-of-arrays registers, indexed [lane] (V is [register * padded + lane])
+    uint16_t *pc;
+    uint16_t *I;
+    uint8_t *V;
+    uint8_t *delay_timer;
+    uint8_t *sound_timer;
+    uint8_t *sp;
+    uint8_t *alive;         // 0xFF while the lane runs, 0 after an invalid instruction (and for padding)
+    uint8_t *mem_written;   // Lane memory may differ from the prototype (Fx33/Fx55 executed)
+    uint8_t *mask;          // Scratch: lanes taking part in the current vector step
+    size_t live;            // Lanes still running
+    size_t written_lanes;   // Lanes with mem_written set
+
+    Chip8 *vms;             // Per-lane cold state (memory, stack, display, keys, rng), registers synced on scalar steps
+    Chip8 proto;            // Pristine copy of the loaded ROM
+
+    // Statistics
+    uint64_t steps;                 // lockstep_step calls
+    uint64_t divergent_steps;       // Steps where not every live lane shared the leader's pc
+    uint64_t vector_instructions;   // Lane-instructions executed by the vector path
+    uint64_t scalar_instructions;   // Lane-instructions executed by the scalar interpreter
+} Lockstep;
+
+// Creates `lanes` copies of proto, lane i seeded with seed + i. Returns true on allocation failure
+bool lockstep_init(Lockstep *ls, const Chip8 *proto, size_t lanes, uint32_t seed);
+void lockstep_cleanup(Lockstep *ls);
+
+// Executes one instruction on every live lane, returns the number of live lanes afterwards
+size_t lockstep_step(Lockstep *ls);
+
+// Decrements every lane's delay and sound timers (once per 60 Hz frame)
+void lockstep_tick_timers(Lockstep *ls);
+
+// Copies a lane's registers back into ls->vms[lane] so it can be inspected as a regular Chip8
+void lockstep_sync(Lockstep *ls, size_t lane);
+
+#endif
@@ -1,16 +1,78 @@
+#define _POSIX_C_SOURCE 200809L
 #include "logger.h"
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
 
 /*
     logger.c outputs log msgs based on current logging level (current_level)
     - logging levels are declared in logger.h
+    - log_write only captures the format pointer and the raw arguments into a fixed ring of records (bounded
+      multi-producer queue, a sequence number per slot), no formatting, no I/O, no allocation
+    - A background thread started on the first message formats the records and writes them to stderr in batches
+    - At exit the thread drains the ring; messages logged after that, or if the thread can't start, are written
+      synchronously
 */
 
-static LogLevel current_level = LOG_INFO;
+#define LOG_RING 1024           // Records, power of two
+#define LOG_MAX_ARGS 8          // Arguments per message, more are logged as the bare format string
+#define LOG_STRINGS 192         // Bytes per record for copies of %s arguments
+#define LOG_LINE 512            // Longest line written, longer ones are truncated
+#define LOG_BATCH 16384         // Bytes gathered before a write
+#define LOG_IDLE_NS 10000000    // Longest sleep of the writer thread between checks (covers a missed wakeup)
+#define LOG_RAW 0xFF            // nargs of a record whose format isn't supported
+
+typedef union {
+    long long i;
+    unsigned long long u;
+    double f;
+    const void *p;
+} LogArg;
+
+typedef struct {
+    _Atomic uint64_t seq;       // == position: free for that producer, == position + 1: filled
+    const char *fmt;
+    uint8_t level;
+    uint8_t nargs;
+    uint16_t strings_used;
+    LogArg args[LOG_MAX_ARGS];
+    char strings[LOG_STRINGS];  // %s copies, args[].u is the offset, the last byte always stays 0
+} LogRecord;
+
+// One conversion specification of a format string
+typedef enum { ARG_INT, ARG_UINT, ARG_DOUBLE, ARG_CHAR, ARG_STR, ARG_PTR, ARG_BAD } ArgKind;
+
+typedef struct {
+    const char *start;      // The '%'
+    const char *length;     // Length modifier, or the conversion if there's none
+    const char *end;        // One past the conversion
+    char modifier;          // 0, 'H' (hh), 'h', 'l', 'q' (ll), 'z', 'j', 't', 'L'
+    ArgKind kind;
+} Spec;
+
+static _Atomic LogLevel current_level = LOG_INFO;
+
+static LogRecord ring[LOG_RING];
+static _Atomic uint64_t head;           // Next position handed to a producer
+static _Atomic uint64_t written;        // Positions consumed by the writer thread
+static _Atomic uint64_t dropped;        // Messages lost to a full ring since the last report
+static _Atomic bool running;            // Writer thread up, producers enqueue
+static _Atomic bool sleeping;           // Writer thread waiting on `wake`
+static _Atomic bool stopping;
+static pthread_t writer;
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_once_t start_once = PTHREAD_ONCE_INIT;
 
 void log_set_level(LogLevel level) {
-    current_level = level;
+    atomic_store_explicit(&current_level, level, memory_order_relaxed);
 }
 
 static const char* level_to_string(LogLevel level) {
@@ -24,15 +86,331 @@ static const char* level_to_string(LogLevel level) {
 }
 
 /*
-    Writes to stderr if the error is appropriate to the declared logging level.
+    Finds the next conversion specification in s, "%%" is skipped as literal text.
+    Returns: the specification's end, or NULL if there's none left
+*/
+static const char* next_spec(const char* s, Spec* spec) {
+    while ((s = strchr(s, '%')) && s[1] == '%')
+        s += 2;
+    if (!s) return NULL;
+
+    spec->start = s++;
+    s += strspn(s, "-+ #0'");
+    s += strspn(s, "0123456789");
+    if (*s == '.') {
+        s++;
+        s += strspn(s, "0123456789");
+    }
+    spec->length = s;
+    spec->modifier = 0;
+    if (s[0] == 'h' && s[1] == 'h') { spec->modifier = 'H'; s += 2; }
+    else if (s[0] == 'l' && s[1] == 'l') { spec->modifier = 'q'; s += 2; }
+    else if (*s && strchr("hlzjtL", *s)) spec->modifier = *s++;
+
+    switch (*s) {
+        case 'd': case 'i':                     spec->kind = ARG_INT; break;
+        case 'u': case 'x': case 'X': case 'o': spec->kind = ARG_UINT; break;
+        case 'f': case 'F': case 'e': case 'E':
+        case 'g': case 'G': case 'a': case 'A': spec->kind = ARG_DOUBLE; break;
+        case 'c':                               spec->kind = ARG_CHAR; break;
+        case 's':                               spec->kind = ARG_STR; break;
+        case 'p':                               spec->kind = ARG_PTR; break;
+        default:                                spec->kind = ARG_BAD; break;   // '*', %n, end of string...
+    }
+    if (spec->length - spec->start > 16) spec->kind = ARG_BAD;  // Doesn't fit the rebuilt specification
+    spec->end = *s ? s + 1 : s;
+    return spec->end;
+}
+
+// Pulls one argument as its real type, integers are narrowed the way printf would
+static LogArg capture_arg(const Spec* spec, va_list* args, LogRecord* r) {
+    LogArg a = { 0 };
+    switch (spec->kind) {
+        case ARG_INT:
+            switch (spec->modifier) {
+                case 'H': a.i = (signed char)va_arg(*args, int); break;
+                case 'h': a.i = (short)va_arg(*args, int); break;
+                case 'l': a.i = va_arg(*args, long); break;
+                case 'q': a.i = va_arg(*args, long long); break;
+                case 'z': case 't': a.i = va_arg(*args, ptrdiff_t); break;
+                case 'j': a.i = va_arg(*args, intmax_t); break;
+                default:  a.i = va_arg(*args, int); break;
+            }
+            break;
+        case ARG_UINT:
+            switch (spec->modifier) {
+                case 'H': a.u = (unsigned char)va_arg(*args, unsigned); break;
+                case 'h': a.u = (unsigned short)va_arg(*args, unsigned); break;
+                case 'l': a.u = va_arg(*args, unsigned long); break;
+                case 'q': a.u = va_arg(*args, unsigned long long); break;
+                case 'z': case 't': a.u = va_arg(*args, size_t); break;
+                case 'j': a.u = va_arg(*args, uintmax_t); break;
+                default:  a.u = va_arg(*args, unsigned); break;
+            }
+            break;
+        case ARG_DOUBLE:
+            a.f = spec->modifier == 'L' ? (double)va_arg(*args, long double) : va_arg(*args, double);
+            break;
+        case ARG_CHAR:
+            a.i = va_arg(*args, int);
+            break;
+        case ARG_PTR:
+            a.p = va_arg(*args, void*);
+            break;
+        case ARG_STR: {
+            const char* str = va_arg(*args, const char*);
+            if (!str) str = "(null)";
+            size_t room = LOG_STRINGS - 1 - r->strings_used;    // The last byte stays the shared empty string
+            size_t len = strnlen(str, room ? room - 1 : 0);
+            a.u = room ? r->strings_used : LOG_STRINGS - 1;
+            if (room) {
+                memcpy(r->strings + r->strings_used, str, len);
+                r->strings[r->strings_used + len] = '\0';
+                r->strings_used += (uint16_t)(len + 1);
+            }
+            break;
+        }
+        case ARG_BAD:
+            break;
+    }
+    return a;
+}
+
+// Fills r from the format and its arguments
+static void capture(LogRecord* r, LogLevel level, const char* fmt, va_list args) {
+    r->fmt = fmt;
+    r->level = (uint8_t)level;
+    r->nargs = 0;
+    r->strings_used = 0;
+    r->strings[LOG_STRINGS - 1] = '\0';
+
+    // Check the whole format first, the arguments can only be read once
+    Spec spec;
+    int count = 0;
+    for (const char* s = fmt; (s = next_spec(s, &spec)); count++)
+        if (spec.kind == ARG_BAD || count == LOG_MAX_ARGS) {
+            r->nargs = LOG_RAW;
+            return;
+        }
+
+    va_list ap;
+    va_copy(ap, args);
+    for (const char* s = fmt; (s = next_spec(s, &spec)); )
+        r->args[r->nargs++] = capture_arg(&spec, &ap, r);
+    va_end(ap);
+}
+
+typedef struct {
+    char* buf;
+    size_t len, cap;    // len < cap, one byte is kept for the newline
+} Line;
+
+static void put(Line* l, const char* s, size_t n) {
+    if (n > l->cap - 1 - l->len) n = l->cap - 1 - l->len;
+    memcpy(l->buf + l->len, s, n);
+    l->len += n;
+}
+
+// Appends literal text from a format, "%%" becomes '%'
+static void put_literal(Line* l, const char* s, const char* end) {
+    while (s < end) {
+        const char* pct = memchr(s, '%', end - s);
+        const char* stop = pct ? pct + 1 : end;
+        put(l, s, stop - s);
+        s = pct ? pct + 2 : end;
+    }
+}
+
+static void put_arg(Line* l, const Spec* spec, const LogArg* a, const LogRecord* r) {
+    char conv[24];
+    size_t n = spec->length - spec->start;
+    memcpy(conv, spec->start, n);
+    if (spec->kind == ARG_INT || spec->kind == ARG_UINT) {  // Captured as 64-bit
+        conv[n++] = 'l';
+        conv[n++] = 'l';
+    }
+    conv[n++] = spec->end[-1];
+    conv[n] = '\0';
+
+    size_t room = l->cap - l->len;
+    int len = 0;
+    switch (spec->kind) {
+        case ARG_INT:    len = snprintf(l->buf + l->len, room, conv, a->i); break;
+        case ARG_UINT:   len = snprintf(l->buf + l->len, room, conv, a->u); break;
+        case ARG_DOUBLE: len = snprintf(l->buf + l->len, room, conv, a->f); break;
+        case ARG_CHAR:   len = snprintf(l->buf + l->len, room, conv, (int)a->i); break;
+        case ARG_STR:    len = snprintf(l->buf + l->len, room, conv, r->strings + a->u); break;
+        case ARG_PTR:    len = snprintf(l->buf + l->len, room, conv, a->p); break;
+        case ARG_BAD:    break;
+    }
+    if (len > 0) l->len += (size_t)len < room - 1 ? (size_t)len : room - 1;
+}
+
+/*
+    Formats a record as one line ending in '\n' into buf (cap >= 2).
+    Returns: the length of the line
+*/
+static size_t format_record(const LogRecord* r, char* buf, size_t cap) {
+    Line l = { buf, 0, cap };
+    const char* prefix = level_to_string(r->level);
+    put(&l, prefix, strlen(prefix));
+    put(&l, " ", 1);
+
+    const char* s = r->fmt;
+    if (r->nargs == LOG_RAW)
+        put(&l, s, strlen(s));
+    else {
+        Spec spec;
+        for (int i = 0; next_spec(s, &spec); i++) {
+            put_literal(&l, s, spec.start);
+            put_arg(&l, &spec, &r->args[i], r);
+            s = spec.end;
+        }
+        put_literal(&l, s, s + strlen(s));
+    }
+    buf[l.len++] = '\n';
+    return l.len;
+}
+
+// Formats every filled record into batches and writes them. Returns: true if any record was written
+static bool drain(void) {
+    static char batch[LOG_BATCH];
+    size_t len = 0;
+    uint64_t pos = atomic_load_explicit(&written, memory_order_relaxed);
+    bool any = false;
+    for (;;) {
+        LogRecord* r = &ring[pos & (LOG_RING - 1)];
+        if (atomic_load_explicit(&r->seq, memory_order_acquire) != pos + 1)
+            break;
+        if (len > LOG_BATCH - LOG_LINE) {
+            fwrite(batch, 1, len, stderr);
+            len = 0;
+        }
+        len += format_record(r, batch + len, LOG_LINE);
+        atomic_store_explicit(&r->seq, pos + LOG_RING, memory_order_release);  // Free for the next lap
+        atomic_store_explicit(&written, ++pos, memory_order_release);
+        any = true;
+    }
+    uint64_t lost = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+    if (lost) {
+        if (len > LOG_BATCH - LOG_LINE) {  // The notice must fit, snprintf returns the untruncated length
+            fwrite(batch, 1, len, stderr);
+            len = 0;
+        }
+        len += snprintf(batch + len, LOG_BATCH - len, "[WARN] %llu log messages dropped, the log ring was full\n",
+            (unsigned long long)lost);
+    }
+    if (len) {
+        fwrite(batch, 1, len, stderr);
+        fflush(stderr);
+    }
+    return any;
+}
+
+static bool pending(void) {
+    uint64_t pos = atomic_load_explicit(&written, memory_order_relaxed);
+    return atomic_load(&ring[pos & (LOG_RING - 1)].seq) == pos + 1;
+}
+
+static void* writer_main(void* arg) {
+    (void)arg;
+    for (;;) {
+        if (drain())
+            continue;
+        if (atomic_load(&stopping))
+            break;
+
+        // Nothing to write: sleep until a producer signals, with a timeout in case the signal raced the check
+        pthread_mutex_lock(&wake_lock);
+        atomic_store(&sleeping, true);
+        if (!pending() && !atomic_load(&stopping)) {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += LOG_IDLE_NS;
+            if (until.tv_nsec >= 1000000000) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&wake, &wake_lock, &until);
+        }
+        atomic_store(&sleeping, false);
+        pthread_mutex_unlock(&wake_lock);
+    }
+    return NULL;
+}
+
+// atexit: lets the writer thread empty the ring, then switches to synchronous writes
+static void log_stop(void) {
+    atomic_store(&stopping, true);
+    pthread_cond_signal(&wake);
+    pthread_join(writer, NULL);
+    atomic_store(&running, false);
+    drain();
+}
+
+static void log_start(void) {
+    for (uint64_t i = 0; i < LOG_RING; i++)
+        atomic_init(&ring[i].seq, i);
+    if (pthread_create(&writer, NULL, writer_main, NULL))
+        return;     // Stays synchronous
+    atomic_store(&running, true);
+    atexit(log_stop);
+}
+
+/*
+    Queues a message if its level passes the runtime threshold, without blocking.
+    Without the writer thread the line is formatted and written right away, as a single write.
 */
-void log_msg(LogLevel level, const char* fmt, ...) {
-    if (level < current_level) return;  // respect threshold
+void log_write(LogLevel level, const char* fmt, ...) {
+    if (level < atomic_load_explicit(&current_level, memory_order_relaxed)) return;  // respect threshold
+    pthread_once(&start_once, log_start);
 
     va_list args;
     va_start(args, fmt);
-    fprintf(stderr, "%s ", level_to_string(level));
-    vfprintf(stderr, fmt, args);
-    fprintf(stderr, "\n");
+    if (!atomic_load_explicit(&running, memory_order_acquire)) {
+        LogRecord r;
+        char line[LOG_LINE];
+        capture(&r, level, fmt, args);
+        fwrite(line, 1, format_record(&r, line, sizeof(line)), stderr);
+        va_end(args);
+        return;
+    }
+
+    // Claim a slot: its sequence equals our position when the writer has freed it
+    uint64_t pos = atomic_load_explicit(&head, memory_order_relaxed);
+    LogRecord* r;
+    for (;;) {
+        r = &ring[pos & (LOG_RING - 1)];
+        uint64_t seq = atomic_load_explicit(&r->seq, memory_order_acquire);
+        if (seq == pos) {
+            if (atomic_compare_exchange_weak_explicit(&head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (seq < pos) {   // Full: the writer is a whole lap behind
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            va_end(args);
+            return;
+        }
+        else
+            pos = atomic_load_explicit(&head, memory_order_relaxed);
+    }
+    capture(r, level, fmt, args);
     va_end(args);
+    atomic_store(&r->seq, pos + 1);     // Publish (seq_cst, ordered before the `sleeping` check)
+
+    if (atomic_load(&sleeping))
+        pthread_cond_signal(&wake);
+}
+
+void log_flush(void) {
+    if (!atomic_load(&running)) {
+        fflush(stderr);
+        return;
+    }
+    uint64_t target = atomic_load(&head);
+    pthread_cond_signal(&wake);
+    struct timespec nap = { 0, 100000 };
+    // Stops early if a producer claimed a slot but hasn't published it yet and the writer is stuck behind it
+    for (int tries = 0; atomic_load(&written) < target && tries < 10000 && atomic_load(&running); tries++)
+        nanosleep(&nap, NULL);
 }
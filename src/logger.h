@@ -11,7 +11,24 @@ typedef enum {
     LOG_ERROR
 } LogLevel;
 
+/* Messages below this level are compiled out entirely, arguments included (e.g. -DLOG_MIN_LEVEL=LOG_WARN).
+    log_set_level filters at runtime on top of it */
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_DEBUG
+#endif
+
+/* Logs a printf-style message to stderr.
+    The caller only copies the format pointer and the raw arguments into a lock-free ring (%s strings are copied,
+    truncated if very long); a background thread formats and writes the messages in batches. Never blocks: when the
+    ring is full the message is dropped and counted. Supports the d i u x X o c s p f e g conversions with the
+    hh h l ll z j t length modifiers, but not '*' widths */
+#define log_msg(level, ...) \
+    do { if ((level) >= LOG_MIN_LEVEL) log_write((level), __VA_ARGS__); } while (0)
+
 void log_set_level(LogLevel level);
-void log_msg(LogLevel level, const char* fmt, ...);
+void log_write(LogLevel level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Waits until every message logged before the call has been written
+void log_flush(void);
 
 #endif
@@ -1,102 +1,520 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "chip8.h"
 #include "platform_sdl.h"
+#include "audio_sdl.h"
+#include "savestate.h"
+#include "rewind.h"
+#include "movie.h"
+#include "romlib.h"
+#include "triplebuf.h"
 #include "logger.h"
 
 /* Chip8 entry point
-    Responsible for initializing the SDL, the VM and running the main command loop
-    Program usage: ./chip8-emulator path_to_rom [path_to_rom_2] ... */
+    Responsible for initializing the SDL, the VM and running the main command loop.
+    The VM runs on its own thread (emu_thread) with its own frame pacing. The main thread polls input, forwards it
+    through a lock-free queue and, once per host refresh, shows the latest frame the VM thread published into a
+    triple buffer, so a blocking present (vsync, compositor stalls) never delays emulation
+    Program usage: ./chip8-emulator [--ips instructions_per_second] [--record movie] [--audio-buffer samples]
+                                    [--quirks profile] [--scaler name] [--persistence percent]
+                                    path_to_rom [path_to_rom_2] ...
+        --record        record the session into an input movie for chip8-headless -M (<movie>.<n> with several ROMs)
+        --audio-buffer  audio buffer size in samples, i.e. the beeper's latency (default 512, ~10.7 ms)
+        --quirks        quirk profile: modern, vip, chip48 or schip (default: schip for ROMs using SUPER-CHIP
+                        instructions, modern otherwise)
+        --scaler        upscaler: nearest or scale2x (default nearest)
+        --persistence   percent of its brightness an unlit pixel keeps per frame, hides XOR-drawing flicker
+                        (0 to 95, default 60, 0 = off) */
 
-// Main loop + timer delay constants
-#define TIMER_FREQ 16   // ~60 hz timer
-#define CPU_FREQ 500.0  // CPU freq
-#define CPU_CMDS 1000.0 // Commands per cycle
+// Frame scheduler constants
+#define FRAME_RATE 60       // Emulated frames (timer ticks) per second
+#define DEFAULT_IPS 500     // Instructions per second, ~500 Hz CPU
+#define MIN_IPS FRAME_RATE
+#define MAX_IPS 100000000
+#define TURBO_MAX_FRAMES 100000 // Emulated frames per host frame in turbo mode, bounds the time between input checks
+#define INPUT_QUEUE 256         // Input events in flight to the VM thread, power of two
+
+/* Frame-budget scheduler: every 60 Hz frame runs the instruction budget in one burst, ticks the timers once,
+    publishes the display and then sleeps until the next frame is due */
+typedef struct {
+    uint32_t ips;           // Instructions per second
+    uint32_t credit;        // Instructions * FRAME_RATE not yet handed out (ips needn't be a multiple of FRAME_RATE)
+    bool turbo;             // Uncapped: run frames back to back for a whole host frame, no sleeping
+    uint64_t frame_ticks;   // Performance-counter ticks per frame
+    uint64_t deadline;      // Performance counter at which the next frame is due
+} Scheduler;
+
+// Input forwarded from the main thread to the VM thread
+typedef enum {
+    INPUT_KEY,          // Chip-8 key `key` pressed (down) or released
+    INPUT_REWIND,       // Backspace pressed (down) or released
+    INPUT_SAVE,         // F5
+    INPUT_LOAD,         // F9
+    INPUT_FASTER,       // +
+    INPUT_SLOWER,       // -
+    INPUT_TURBO,        // Tab
+    INPUT_QUIT          // Esc or window closed: ends the current ROM
+} InputType;
+
+typedef struct {
+    uint8_t type;       // InputType
+    uint8_t key;
+    bool down;
+} InputEvent;
+
+// Single-producer (main thread) single-consumer (VM thread) ring
+typedef struct {
+    InputEvent events[INPUT_QUEUE];
+    _Alignas(64) _Atomic uint32_t tail;
+    _Alignas(64) _Atomic uint32_t head;
+} InputQueue;
+
+// State shared by the main thread and the VM thread
+typedef struct {
+    Chip8 vm;                   // Owned by the VM thread
+    char **roms;
+    int rom_count;
+    const char *record_path;
+    int quirks;                 // Chip8Quirks for every ROM, ROMLIB_QUIRKS_AUTO = guessed per ROM
+    Scheduler sched;            // Owned by the VM thread
+    InputQueue input;
+    TripleBuffer frames;
+    _Atomic uint32_t speed;     // IPS to show in the window title, 0 in turbo mode
+    _Atomic bool done;          // The VM thread went through every ROM
+    int status;                 // Exit status, valid once done
+} Emulator;
+
+static Rewind history;  // Snapshot of every frame, for rewinding with Backspace
+static Movie movie;     // Input movie being recorded
+static Beeper beeper;   // Sounds while the sound timer runs
+static Emulator emu;
+
+// Movie recording of the current ROM
+typedef struct {
+    bool active;
+    char path[4096];
+    uint64_t instructions;  // Executed since recording started
+    uint64_t frames;
+} Recording;
 
 void main_cleanup(Platform *plat, Chip8 *vm);
 
-int main(int argc, char *argv[]) {
-    Platform plat = {0};
-    Chip8 vm = {0};
+// Main thread: queues an event for the VM thread, dropped if the VM thread is that far behind
+static void input_push(InputQueue *q, InputType type, uint8_t key, bool down)
+{
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&q->head, memory_order_acquire) == INPUT_QUEUE)
+        return;
+    q->events[tail % INPUT_QUEUE] = (InputEvent){ .type = (uint8_t)type, .key = key, .down = down };
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+}
+
+// VM thread: returns true and the oldest queued event, false if there's none
+static bool input_pop(InputQueue *q, InputEvent *e)
+{
+    uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&q->tail, memory_order_acquire))
+        return false;
+    *e = q->events[head % INPUT_QUEUE];
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return true;
+}
 
-    const double cpu_delay = CPU_CMDS / CPU_FREQ;   // The delay between each command the vm executes
+// Publishes the speed setting for the window title
+static void sched_show(const Scheduler *s)
+{
+    atomic_store_explicit(&emu.speed, s->turbo ? 0 : s->ips, memory_order_relaxed);
+}
+
+static void sched_set_ips(Scheduler *s, uint64_t ips)
+{
+    if (ips < MIN_IPS) ips = MIN_IPS;
+    if (ips > MAX_IPS) ips = MAX_IPS;
+    s->ips = (uint32_t)ips;
+    sched_show(s);
+}
+
+// Returns the instruction budget of the next frame
+static uint32_t sched_budget(Scheduler *s)
+{
+    s->credit += s->ips;
+    uint32_t budget = s->credit / FRAME_RATE;
+    s->credit %= FRAME_RATE;
+    return budget;
+}
 
-    if (plat_init(&plat))   // Initialize the SDL2 platform
+/* Sleeps until the next frame is due. Doesn't try to catch up after a stall or in turbo mode,
+    but turbo mode sleeps too while the VM is stuck until a key press (stalled) */
+static void sched_wait(Scheduler *s, bool stalled)
+{
+    uint64_t now = SDL_GetPerformanceCounter();
+    s->deadline += s->frame_ticks;
+    if ((s->turbo && !stalled) || now > s->deadline + 4 * s->frame_ticks)
     {
-        main_cleanup(&plat, &vm);
-        exit(1);
+        s->deadline = now;
+        return;
     }
+    if (now < s->deadline)
+        SDL_Delay((uint32_t)((s->deadline - now) * 1000 / SDL_GetPerformanceFrequency()));
+}
+
+// Ends the recording and writes the movie, `why` is logged if it ended before the session did
+static void record_stop(Recording *rec, const Chip8 *vm, const char *why)
+{
+    if (!rec->active)
+        return;
+    rec->active = false;
+    movie_finish(&movie, rec->instructions, rec->frames, vm);
+    if (why)
+        log_msg(LOG_WARN, "movie recording stopped: %s", why);
+    if (!movie_write(&movie, rec->path))
+        log_msg(LOG_INFO, "movie written: '%s' (%llu frames)", rec->path, (unsigned long long)rec->frames);
+}
 
-    if (argc < 2)
+// VM thread: hands the display to the main thread if it changed
+static void publish_frame(Emulator *e, uint64_t frame)
+{
+    if (!e->vm.dirty_rows)
+        return;
+    e->vm.dirty_rows = 0;
+    DisplayFrame *f = triplebuf_back(&e->frames);
+    memcpy(f->display, e->vm.display, sizeof(f->display));
+    f->frame = frame;
+    triplebuf_publish(&e->frames);
+}
+
+/* VM thread: runs one ROM until it's quit
+    - Input arrives from the main thread at the start of each frame:
+        - Chip-8 keys, mapped by the main thread
+        - Backspace held: rewind, one frame per timer tick
+        - F5 saves the state to <rom>.state, F9 loads it back
+        - +/- raise/lower the instructions per second by 25%, Tab toggles turbo (uncapped) mode
+        - Esc or closing the window quits the ROM
+    - The beeper sounds while the sound timer runs
+    - With --record, key and speed changes are recorded at the start of each frame; rewinding or loading a state
+      ends the recording */
+static void emu_run_rom(Emulator *e, int index)
+{
+    Chip8 *vm = &e->vm;
+    Scheduler *sched = &e->sched;
+    const char *path_to_file = e->roms[index];
+    bool running = true;    // Keyboard interrupt flag
+    bool rewinding = false; // Backspace held
+    uint64_t frame = 0;     // Emulated frames, for the published display
+    char state_path[4096];
+    snprintf(state_path, sizeof(state_path), "%s.state", path_to_file);
+    rewind_clear(&history);
+    Recording rec = { .active = e->record_path != NULL };
+    if (rec.active)
     {
-        log_msg(LOG_ERROR, "Excepted at least 1 argument");
-        main_cleanup(&plat, &vm);
+        if (e->rom_count > 1)
+            snprintf(rec.path, sizeof(rec.path), "%s.%d", e->record_path, index);
+        else
+            snprintf(rec.path, sizeof(rec.path), "%s", e->record_path);
+        movie_start(&movie, vm, sched->ips, sched->credit);
+    }
+    sched->deadline = SDL_GetPerformanceCounter();
+
+    while (running)
+    {
+        InputEvent in;
+        while (input_pop(&e->input, &in))
+        {
+            switch ((InputType)in.type)
+            {
+                case INPUT_KEY:
+                    vm->keys[in.key] = in.down;
+                    break;
+                case INPUT_REWIND:
+                    rewinding = in.down;
+                    break;
+                case INPUT_SAVE:
+                    savestate_write_file(vm, state_path);
+                    break;
+                case INPUT_LOAD:
+                    if (!savestate_read_file(vm, state_path))
+                    {
+                        rewind_clear(&history);
+                        record_stop(&rec, vm, "a state was loaded");
+                    }
+                    break;
+                case INPUT_FASTER:
+                    sched_set_ips(sched, (uint64_t)sched->ips * 5 / 4);
+                    break;
+                case INPUT_SLOWER:
+                    sched_set_ips(sched, (uint64_t)sched->ips * 4 / 5);
+                    break;
+                case INPUT_TURBO:
+                    sched->turbo = !sched->turbo;
+                    sched_show(sched);
+                    break;
+                case INPUT_QUIT:
+                    running = false;
+                    break;
+            }
+        }
+
+        if (rewinding)
+            record_stop(&rec, vm, "rewinding");
+        if (rec.active && movie_record(&movie, rec.instructions, chip8_key_mask(vm), sched->ips))
+            record_stop(&rec, vm, "out of memory");
+
+        // One frame: the instruction budget in one burst, then a timer tick. Turbo keeps going for a host frame
+        uint64_t frame_start = SDL_GetPerformanceCounter();
+        bool stalled = false;   // VM halted or waiting for a key, more frames would only tick the timers
+        for (int frames = 0; frames < TURBO_MAX_FRAMES; frames++)
+        {
+            if (rewinding)
+            {
+                rewind_step_back(&history, vm, 1);
+                break;
+            }
+            uint32_t executed = 0;
+            if (chip8_run(vm, sched_budget(sched), &executed))
+                record_stop(&rec, vm, "invalid instruction");   // chip8-headless stops there
+            chip8_tick_timers(vm);
+            rewind_push(&history, vm);
+            rec.instructions += executed;
+            rec.frames++;
+            frame++;
+            stalled = vm->idle == CHIP8_IDLE_HALT || vm->idle == CHIP8_IDLE_KEY;
+            if (!sched->turbo || stalled || SDL_GetPerformanceCounter() - frame_start >= sched->frame_ticks)
+                break;
+        }
+
+        beeper_set(&beeper, vm->sound_timer > 0);   // Timestamped here, played one audio buffer later
+        publish_frame(e, frame);    // The main thread shows the latest one at its next host refresh
+        sched_wait(sched, stalled); // Sleeps until the next frame instead of spinning
+    }
+    record_stop(&rec, vm, NULL);
+    beeper_set(&beeper, false);
+}
+
+// Quirk profile of the ROM just loaded: the --quirks one, else guessed from the instructions it uses
+static Chip8Quirks rom_quirks(const Emulator *e)
+{
+    if (e->quirks != ROMLIB_QUIRKS_AUTO)
+        return (Chip8Quirks)e->quirks;
+    uint32_t features = romlib_scan_features(e->vm.memory + CHIP8_PC_START_INDEX, CHIP8_ROM_MAX_SIZE);
+    return romlib_profile_quirks(romlib_guess_profile(features));
+}
+
+// VM thread entry point: runs the ROMs one after the other
+static int emu_thread(void *data)
+{
+    Emulator *e = data;
+    for (int i = 0; i < e->rom_count; i++)
+    {
+        if (chip8_init(&e->vm))    // Initialize the chip8 emulator for this ROM
+        {
+            e->status = 1;
+            break;
+        }
+        if (chip8_load_rom(&e->vm, e->roms[i])) // Load the rom into the vm memory
+            continue;
+        chip8_set_quirks(&e->vm, rom_quirks(e));
+        log_msg(LOG_INFO, "%s: %s quirks", e->roms[i], chip8_quirks_name(e->vm.quirks));
+        emu_run_rom(e, i);
+    }
+    atomic_store_explicit(&e->done, true, memory_order_release);
+    return e->status;
+}
+
+// Main thread: forwards one SDL event to the VM thread
+static void forward_event(const SDL_Event *e)
+{
+    if (e->type == SDL_QUIT)
+    {
+        input_push(&emu.input, INPUT_QUIT, 0, true);
+        return;
+    }
+    if (e->type != SDL_KEYDOWN && e->type != SDL_KEYUP)
+        return;
+    SDL_Keycode sym = e->key.keysym.sym;
+    bool down = e->type == SDL_KEYDOWN;
+    int key = map_key(sym);
+    if (key != -1)
+        input_push(&emu.input, INPUT_KEY, (uint8_t)key, down);
+    else if (sym == SDLK_BACKSPACE)
+        input_push(&emu.input, INPUT_REWIND, 0, down);
+    else if (!down)
+        return;
+    else if (sym == SDLK_ESCAPE)
+        input_push(&emu.input, INPUT_QUIT, 0, true);
+    else if (sym == SDLK_F5)
+        input_push(&emu.input, INPUT_SAVE, 0, true);
+    else if (sym == SDLK_F9)
+        input_push(&emu.input, INPUT_LOAD, 0, true);
+    else if (sym == SDLK_EQUALS || sym == SDLK_PLUS || sym == SDLK_KP_PLUS)
+        input_push(&emu.input, INPUT_FASTER, 0, true);
+    else if (sym == SDLK_MINUS || sym == SDLK_KP_MINUS)
+        input_push(&emu.input, INPUT_SLOWER, 0, true);
+    else if (sym == SDLK_TAB)
+        input_push(&emu.input, INPUT_TURBO, 0, true);
+}
+
+// Main thread: shows the speed setting in the window title when it changed
+static void show_speed(Platform *plat, uint32_t *shown)
+{
+    uint32_t speed = atomic_load_explicit(&emu.speed, memory_order_relaxed);
+    if (speed == *shown)
+        return;
+    *shown = speed;
+    char title[128];
+    if (!speed)
+        snprintf(title, sizeof(title), "%s - turbo", WINDOW_TITLE);
+    else
+        snprintf(title, sizeof(title), "%s - %u IPS", WINDOW_TITLE, speed);
+    SDL_SetWindowTitle(plat->window, title);
+}
+
+/* Main thread: renders the latest published frame, or the last one again while its erased pixels are still fading
+    (plat_render skips the upload when nothing changed) */
+static void render_latest(Platform *plat)
+{
+    static uint64_t shown[CHIP8_DISPLAY_HEIGHT];
+    const DisplayFrame *f = triplebuf_take(&emu.frames);
+    if (f)
+        memcpy(shown, f->display, sizeof(shown));
+    else if (!plat->phosphor.fading && !plat->texture_stale)
+        return;
+    plat_render(plat, shown);
+}
+
+int main(int argc, char *argv[]) {
+    Platform plat = {0};
+    emu.sched = (Scheduler){ .ips = DEFAULT_IPS };
+
+    if (plat_init(&plat) || rewind_init(&history, REWIND_DEFAULT_BYTES, REWIND_DEFAULT_FRAMES))   // Initialize the SDL2 platform
+    {
+        main_cleanup(&plat, &emu.vm);
         exit(1);
     }
 
-    for (int i = 1; i < argc; i++) // Read arguments
+    int first = 1;
+    const char *record_path = NULL;
+    int audio_samples = AUDIO_DEFAULT_SAMPLES;
+    Scaler scaler = SCALER_NEAREST;
+    unsigned long persistence = PHOSPHOR_DEFAULT_PERSISTENCE;
+    emu.quirks = ROMLIB_QUIRKS_AUTO;
+    for (; first + 1 < argc && !strncmp(argv[first], "--", 2); first += 2)  // Read options
     {
-        char *path_to_file = argv[i];
-        if (chip8_init(&vm))    // Initialize the chip8 emulator for this ROM
+        if (!strcmp(argv[first], "--record"))
         {
-            main_cleanup(&plat, &vm); // On failure, clear and exit
-            exit(1);
+            record_path = argv[first + 1];
+            continue;
         }
-        if (!chip8_load_rom(&vm, path_to_file)) // Load the rom into the vm memory
+        if (!strcmp(argv[first], "--audio-buffer"))
         {
-            bool running = true;    // Keyboard interrupt flag
-            uint64_t timer_last_tick = SDL_GetTicks();
-            uint64_t cpu_last_tick = SDL_GetTicks();
-
-            /*
-                Keyboard input event loop - Checks for early interrupts and updates vm's key[] array if a key is pressed
-                    - Press "ESC" to terminate the program early
-                    - Chip8 keyboard abides by the:
-                            1 2 3 4 ->  1 2 3 C
-                            q w e r ->  4 5 6 D
-                            a s d f ->  7 8 9 E
-                            z x c v ->  A 0 B F
-                      layout. the keys on the left are mapped to the keys in the standard chip8 keyboard (right). 
-            */
-            while (running)
+            char *end = NULL;
+            unsigned long samples = strtoul(argv[first + 1], &end, 10);
+            if (!argv[first + 1][0] || *end || samples < AUDIO_MIN_SAMPLES || samples > AUDIO_MAX_SAMPLES)
             {
-                SDL_Event e;
-                while (SDL_PollEvent(&e))
-                {
-                    if (e.type == SDL_QUIT) running = false;
-                    if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE) running = false;
-
-                    int key = map_key(e.key.keysym.sym);
-                    if (key != -1)
-                    {
-                        if (e.type == SDL_KEYDOWN)   vm.keys[key] = 1;
-                        if (e.type == SDL_KEYUP)     vm.keys[key] = 0;
-                    }
-                }
-                uint64_t current_tick = SDL_GetTicks();
-                
-                if (current_tick - cpu_last_tick >= cpu_delay)
-                {
-                    chip8_cycle(&vm);
-                    cpu_last_tick = current_tick;
-                }
-
-                // Update timer ticks
-                if (current_tick - timer_last_tick >= TIMER_FREQ)
-                {
-                    if (vm.delay_timer) vm.delay_timer--;
-                    if (vm.sound_timer) vm.sound_timer--;
-                    timer_last_tick = current_tick;
-                }
-
-                // Invokes render if the executed opcode triggers a render request (draw_flag is true)
-                if (vm.draw_flag)
-                    plat_render(&plat, &vm);
-                
+                log_msg(LOG_ERROR, "--audio-buffer expects a value between %d and %d", AUDIO_MIN_SAMPLES,
+                    AUDIO_MAX_SAMPLES);
+                main_cleanup(&plat, &emu.vm);
+                exit(1);
+            }
+            audio_samples = (int)samples;
+            continue;
+        }
+        if (!strcmp(argv[first], "--quirks"))
+        {
+            Chip8Quirks quirks;
+            if (chip8_parse_quirks(argv[first + 1], &quirks))
+            {
+                main_cleanup(&plat, &emu.vm);
+                exit(1);
+            }
+            emu.quirks = quirks;
+            continue;
+        }
+        if (!strcmp(argv[first], "--scaler"))
+        {
+            if (phosphor_parse_scaler(argv[first + 1], &scaler))
+            {
+                main_cleanup(&plat, &emu.vm);
+                exit(1);
+            }
+            continue;
+        }
+        if (!strcmp(argv[first], "--persistence"))
+        {
+            char *end = NULL;
+            persistence = strtoul(argv[first + 1], &end, 10);
+            if (!argv[first + 1][0] || *end || persistence > PHOSPHOR_MAX_PERSISTENCE)
+            {
+                log_msg(LOG_ERROR, "--persistence expects a value between 0 and %d", PHOSPHOR_MAX_PERSISTENCE);
+                main_cleanup(&plat, &emu.vm);
+                exit(1);
             }
+            continue;
         }
+        if (strcmp(argv[first], "--ips"))
+            break;
+        char *end = NULL;
+        unsigned long ips = strtoul(argv[first + 1], &end, 10);
+        if (!argv[first + 1][0] || *end || ips < MIN_IPS || ips > MAX_IPS)
+        {
+            log_msg(LOG_ERROR, "--ips expects a value between %d and %d", MIN_IPS, MAX_IPS);
+            main_cleanup(&plat, &emu.vm);
+            exit(1);
+        }
+        emu.sched.ips = (uint32_t)ips;
     }
-    main_cleanup(&plat, &vm); // Cleanup before termination
-    return 0;
+
+    if (argc <= first)
+    {
+        log_msg(LOG_ERROR, "Excepted at least 1 argument");
+        main_cleanup(&plat, &emu.vm);
+        exit(1);
+    }
+    plat_set_filter(&plat, scaler, (unsigned)persistence);
+    emu.sched.frame_ticks = SDL_GetPerformanceFrequency() / FRAME_RATE;
+    emu.roms = argv + first;
+    emu.rom_count = argc - first;
+    emu.record_path = record_path;
+    triplebuf_init(&emu.frames);
+    sched_show(&emu.sched);
+    beeper_open(&beeper, audio_samples);
+    SDL_Thread *thread = SDL_CreateThread(emu_thread, "chip8-vm", &emu);
+    if (!thread)
+    {
+        log_msg(LOG_ERROR, "Failed to start the VM thread: %s", SDL_GetError());
+        main_cleanup(&plat, &emu.vm);
+        exit(1);
+    }
+
+    /* Input and presentation: waits for input until the next host refresh, forwarding it as it comes, then shows
+        the latest frame the VM thread published. Nothing here waits on the VM thread */
+    uint64_t next_refresh = SDL_GetPerformanceCounter();
+    uint32_t shown_speed = UINT32_MAX;
+    while (!atomic_load_explicit(&emu.done, memory_order_acquire))
+    {
+        uint64_t now = SDL_GetPerformanceCounter();
+        int timeout = now < next_refresh ? (int)((next_refresh - now) * 1000 / SDL_GetPerformanceFrequency()) + 1 : 0;
+        SDL_Event e;
+        if (SDL_WaitEventTimeout(&e, timeout))
+        {
+            forward_event(&e);
+            while (SDL_PollEvent(&e))
+                forward_event(&e);
+        }
+        now = SDL_GetPerformanceCounter();
+        if (now < next_refresh)
+            continue;
+        next_refresh += plat.refresh_interval;
+        if (next_refresh < now)     // Don't catch up after a stall
+            next_refresh = now + plat.refresh_interval;
+        show_speed(&plat, &shown_speed);
+        render_latest(&plat);
+        plat_present(&plat);    // Shows the latest frame, at most once per host refresh
+    }
+    int status = 0;
+    SDL_WaitThread(thread, &status);
+    main_cleanup(&plat, &emu.vm); // Cleanup before termination
+    return status;
 }
 
 // Main cleanup function
@@ -104,4 +522,7 @@ void main_cleanup(Platform *plat, Chip8 *vm)
 {
     if (plat)
         plat_cleanup(plat);
-}
\ No newline at end of file
+    beeper_close(&beeper);
+    rewind_cleanup(&history);
+    movie_cleanup(&movie);
+}
@@ -0,0 +1,616 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+#include "runner.h"
+#include "batch.h"
+#include "pool.h"
+#include "lockstep.h"
+#include "romlib.h"
+#include "trace.h"
+#include "movie.h"
+#include "logger.h"
+#ifdef CHIP8_PROFILE
+#include "profile.h"
+#endif
+
+/* Headless Chip8 entry point
+    Runs ROMs without SDL for a fixed instruction and/or frame budget and reports throughput and final state
+    Program usage: ./chip8-headless [-J] [-F] [-R] [-P profile_prefix] [-T trace] [-D dump] [-r fps] [-M movie] [-b] [-j threads] [-L lanes] [-I index] [-W pack] [-q quirks] [-n instructions] [-f frames] [-i instructions_per_frame] rom|directory|pack.c8pk ...
+        -J  execute through the x86-64 JIT
+        -F  don't fuse common instruction sequences into superinstructions in the interpreter
+        -R  record the rewind history (one delta-compressed snapshot per frame) and report its size
+        -P  profile the guest (needs a PROFILE=1 build) and write <prefix>.json and <prefix>.folded per ROM
+            (<prefix>.<n>.* with several ROMs), the run stays on the interpreter
+        -T  record an execution trace of every instruction into the given file (<trace>.<n> with several ROMs) for
+            chip8-replay, the run stays on the interpreter
+        -D  export the display stream into the given file, one record per run of identical frames: .y4m for Y4M,
+            .png for a PNG per distinct frame plus an ffconcat list, raw 1 bpp otherwise (<stem>.<n>.<ext> with
+            several ROMs)
+        -r  frames per second of emulated time in the display stream (default 60)
+        -M  play an input movie recorded by chip8-emulator --record on the ROM it was recorded on (found among the
+            ROMs given by content), to its end unless -n/-f is given; may be repeated, -b plays the movies in parallel
+        -b  batch mode: run the ROMs in parallel on one thread per core and print a summary
+        -j  batch mode with the given number of threads
+        -L  lockstep mode: run the given number of lanes of the first ROM (lane i seeded with the default seed + i)
+            through the SIMD lockstep engine, then compare against independent runs
+        -I  keep a ROM index in the given file: loose ROMs whose size and mtime match are not read again at startup
+        -W  write every ROM given into a pack (mmapped whole when loaded back) and exit
+        -q  quirk profile for every ROM: modern, vip, chip48 or schip (default: schip for ROMs using SUPER-CHIP
+            instructions, modern otherwise)
+    Directories are scanned recursively. In batch mode ROMs with identical content run once */
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: chip8-headless [-J] [-F] [-R] [-P profile_prefix] [-T trace] [-D dump] [-r fps] [-M movie] [-b] [-j threads] [-L lanes] [-I index] [-W pack] [-q quirks] [-n instructions] [-f frames] [-i instructions_per_frame] rom|dir|pack.c8pk ...\n");
+}
+
+// Parses a positive integer option value, returns true on failure
+static bool parse_count(const char *arg, uint64_t *out)
+{
+    char *end = NULL;
+    unsigned long long v = strtoull(arg, &end, 0);
+    if (!arg[0] || *end || v == 0)
+    {
+        log_msg(LOG_ERROR, "invalid count '%s'", arg);
+        return true;
+    }
+    *out = v;
+    return false;
+}
+
+static void print_result(const char *path, const Chip8 *vm, const RunResult *res)
+{
+    double ips = res->seconds > 0 ? res->instructions / res->seconds : 0;
+    printf("rom: %s\n", path);
+    printf("  exit: %s\n", res->exit == RUN_EXIT_VM_ERROR ? "vm-error" : "budget");
+    if (vm->quirks != CHIP8_QUIRKS_MODERN)
+        printf("  quirks: %s\n", chip8_quirks_name(vm->quirks));
+    printf("  instructions: %llu  frames: %llu  time: %.6fs  ips: %.0f\n",
+        (unsigned long long)res->instructions, (unsigned long long)res->frames, res->seconds, ips);
+    printf("  pc=%03X I=%03X sp=%u dt=%u st=%u\n", vm->pc, vm->I, vm->sp, vm->delay_timer, vm->sound_timer);
+    printf("  V:");
+    for (int i = 0; i < CHIP8_REGISTER_COUNT; i++)
+        printf(" %02X", vm->V[i]);
+    printf("\n  display hash: %016llX\n", (unsigned long long)res->display_hash);
+}
+
+// An input movie given with -M and the library ROM it was recorded on
+typedef struct {
+    const char *path;
+    Movie movie;
+    uint32_t rom;
+} MovieRun;
+
+/* Finds the ROM each movie was recorded on.
+Returns: true if a movie matches none of the library's ROMs */
+static bool match_movies(const RomLib *lib, MovieRun *movies, size_t count)
+{
+    static Chip8 vm;
+    bool failed = false;
+    for (size_t m = 0; m < count; m++)
+    {
+        movies[m].rom = UINT32_MAX;
+        for (uint32_t r = 0; r < lib->rom_count && movies[m].rom == UINT32_MAX; r++)
+            if (!chip8_init(&vm) && !romlib_load(lib, r, &vm) && movie_matches(&movies[m].movie, &vm))
+                movies[m].rom = r;
+        if (movies[m].rom == UINT32_MAX)
+        {
+            log_msg(LOG_ERROR, "movie '%s' was recorded on none of the ROMs given", movies[m].path);
+            failed = true;
+        }
+    }
+    return failed;
+}
+
+// Returns true if a run that played a whole movie ended where the recording did
+static bool movie_replayed(const Movie *movie, const RunResult *res)
+{
+    return res->exit == RUN_EXIT_BUDGET && res->instructions == movie->instructions &&
+           res->frames == movie->frames && res->display_hash == movie->display_hash;
+}
+
+static const char *exit_name(const BatchJob *job)
+{
+    if (job->load_failed) return "load-error";
+    return job->result.exit == RUN_EXIT_VM_ERROR ? "vm-error" : "budget";
+}
+
+/* Runs every distinct ROM of the library in parallel and prints one summary line per path plus totals.
+    With movies, runs every movie on its ROM instead and prints one line per movie */
+static int run_batch(const RomLib *lib, const MovieRun *movies, size_t movie_count, const RunConfig *cfg,
+    bool use_jit, unsigned threads)
+{
+    size_t count = movie_count ? movie_count : lib->rom_count;
+    BatchJob *jobs = calloc(count ? count : 1, sizeof(BatchJob));
+    if (!jobs)
+        return 1;
+    for (size_t r = 0; r < count; r++)
+    {
+        jobs[r].rom = movie_count ? movies[r].rom : (uint32_t)r;
+        jobs[r].path = movie_count ? movies[r].path : lib->paths[lib->roms[r].path].name;
+        jobs[r].movie = movie_count ? &movies[r].movie : NULL;
+    }
+
+    double start = runner_now();
+    if (batch_run(jobs, count, lib, cfg, use_jit, threads))
+    {
+        free(jobs);
+        return 1;
+    }
+    double wall = runner_now() - start;
+
+    int status = 0;
+    uint64_t total = 0;
+    printf("%-10s %14s %10s  %-16s  %s\n", "exit", "instructions", "frames", "display-hash", movie_count ? "movie" : "rom");
+    for (size_t i = 0; movie_count && i < count; i++)
+    {
+        const BatchJob *job = &jobs[i];
+        bool whole = !cfg->max_instructions && !cfg->max_frames;
+        bool matches = !job->load_failed && movie_replayed(job->movie, &job->result);
+        printf("%-10s %14llu %10llu  %016llX  %s (%s)%s\n", exit_name(job),
+            (unsigned long long)job->result.instructions, (unsigned long long)job->result.frames,
+            (unsigned long long)job->result.display_hash, job->path, lib->paths[lib->roms[job->rom].path].name,
+            whole && !matches ? " differs from the recording" : "");
+        if (job->load_failed || job->result.exit == RUN_EXIT_VM_ERROR || (whole && !matches))
+            status = 1;
+    }
+    for (size_t i = 0; !movie_count && i < lib->path_count; i++)     // Duplicates report their content's run
+    {
+        const BatchJob *job = &jobs[lib->paths[i].rom];
+        printf("%-10s %14llu %10llu  %016llX  %s\n", exit_name(job),
+            (unsigned long long)job->result.instructions, (unsigned long long)job->result.frames,
+            (unsigned long long)job->result.display_hash, lib->paths[i].name);
+        if (job->load_failed || job->result.exit == RUN_EXIT_VM_ERROR)
+            status = 1;
+    }
+    for (size_t r = 0; r < count; r++)
+        total += jobs[r].result.instructions;
+    if (movie_count)
+        printf("total: %zu movies, %llu instructions in %.3fs on %u threads (%.0f ips)\n", count,
+            (unsigned long long)total, wall, threads, wall > 0 ? total / wall : 0);
+    else
+        printf("total: %zu roms (%zu distinct), %llu instructions in %.3fs on %u threads (%.0f ips)\n",
+            lib->path_count, count, (unsigned long long)total, wall, threads, wall > 0 ? total / wall : 0);
+    free(jobs);
+    return status;
+}
+
+// Returns true if a lockstep lane and an independently run VM ended in the same state
+static bool same_state(const Chip8 *a, const Chip8 *b)
+{
+    return a->pc == b->pc && a->I == b->I && a->sp == b->sp && !memcmp(a->V, b->V, sizeof(a->V)) &&
+           a->delay_timer == b->delay_timer && a->sound_timer == b->sound_timer &&
+           chip8_display_hash(a) == chip8_display_hash(b);
+}
+
+/* Runs `lanes` copies of a ROM in lockstep for the budget (per lane), then the same lanes one by one
+    through runner_run, and reports throughput of both plus divergence statistics */
+static int run_lockstep(const RomLib *lib, const RunConfig *cfg, size_t lanes)
+{
+    static Chip8 proto;
+    const char *path = lib->paths[0].name;
+    if (chip8_init(&proto) || romlib_load(lib, lib->paths[0].rom, &proto))
+        return 1;
+    Lockstep ls;
+    if (lockstep_init(&ls, &proto, lanes, CHIP8_DEFAULT_SEED))
+        return 1;
+
+    uint32_t ipf = cfg->instructions_per_frame ? cfg->instructions_per_frame : RUNNER_DEFAULT_IPF;
+    uint64_t steps = 0, frames = 0;
+    size_t alive = lanes;
+    double start = runner_now();
+    bool running = true;
+    while (running && alive)    // Same frame/budget accounting as runner_run
+    {
+        uint64_t budget = ipf;
+        if (cfg->max_instructions)
+        {
+            uint64_t left = cfg->max_instructions - steps;
+            if (left < budget)
+            {
+                budget = left;
+                running = false;
+            }
+        }
+        for (uint64_t k = 0; k < budget && alive; k++, steps++)
+            alive = lockstep_step(&ls);
+        if (!running || !alive)
+            break;
+        lockstep_tick_timers(&ls);
+        frames++;
+        if (cfg->max_frames && frames >= cfg->max_frames)
+            running = false;
+    }
+    double lockstep_time = runner_now() - start;
+    uint64_t lane_instructions = ls.vector_instructions + ls.scalar_instructions;
+
+    // Baseline: the same lanes as independent VMs
+    Chip8 *vm = malloc(sizeof(Chip8));
+    size_t matching = 0;
+    uint64_t independent_instructions = 0;
+    start = runner_now();
+    for (size_t l = 0; vm && l < lanes; l++)
+    {
+        RunResult res;
+        *vm = proto;
+        chip8_seed(vm, CHIP8_DEFAULT_SEED + (uint32_t)l);
+        RunConfig lane_cfg = *cfg;
+        lane_cfg.jit = NULL;
+        lane_cfg.rewind = NULL;
+        runner_run(vm, &lane_cfg, &res);
+        independent_instructions += res.instructions;
+        lockstep_sync(&ls, l);
+        matching += same_state(vm, &ls.vms[l]);
+    }
+    double independent_time = runner_now() - start;
+    free(vm);
+
+    double lockstep_ips = lockstep_time > 0 ? lane_instructions / lockstep_time : 0;
+    double independent_ips = independent_time > 0 ? independent_instructions / independent_time : 0;
+    printf("rom: %s\n", path);
+    printf("  lockstep: %zu lanes, %llu steps, %llu frames, %.6fs, %.0f lane-instructions/s\n", lanes,
+        (unsigned long long)steps, (unsigned long long)frames, lockstep_time, lockstep_ips);
+    printf("  vector: %.1f%% of lane-instructions, divergent steps: %.1f%%, lanes alive: %zu\n",
+        lane_instructions ? 100.0 * ls.vector_instructions / lane_instructions : 0,
+        ls.steps ? 100.0 * ls.divergent_steps / ls.steps : 0, alive);
+    printf("  independent: %.6fs, %.0f lane-instructions/s (lockstep speedup %.2fx)\n", independent_time,
+        independent_ips, independent_ips > 0 ? lockstep_ips / independent_ips : 0);
+    printf("  lanes matching independent runs: %zu/%zu\n", matching, lanes);
+    lockstep_cleanup(&ls);
+    return matching == lanes ? 0 : 1;
+}
+
+#ifdef CHIP8_PROFILE
+/* Writes <prefix>.json and <prefix>.folded (<prefix>.<index>.* if index >= 0) for the profiled vm.
+Returns: true if a file couldn't be written */
+static bool write_profile(const Chip8Profile *prof, const Chip8 *vm, const char *prefix, int index)
+{
+    char base[4000], path[4096];
+    if (index >= 0)
+        snprintf(base, sizeof(base), "%s.%d", prefix, index);
+    else
+        snprintf(base, sizeof(base), "%s", prefix);
+    snprintf(path, sizeof(path), "%s.json", base);
+    bool failed = profile_write_json(prof, vm, path);
+    snprintf(path, sizeof(path), "%s.folded", base);
+    failed |= profile_write_folded(prof, path);
+    return failed;
+}
+#endif
+
+// Numbers an output path for run `index` of several: <stem>.<index><extension>
+static void numbered_path(char *out, size_t size, const char *path, size_t index)
+{
+    const char *ext = strrchr(path, '.');
+    if (!ext || strchr(ext, '/'))
+        ext = path + strlen(path);
+    snprintf(out, size, "%.*s.%zu%s", (int)(ext - path), path, index, ext);
+}
+
+// Closes the trace and frame dump of a run that couldn't start or finish, keeping what they hold so far
+static void close_outputs(RunConfig *cfg)
+{
+    if (cfg->trace)
+        trace_close(cfg->trace);
+    if (cfg->dump)
+        framedump_close(cfg->dump);
+    cfg->trace = NULL;
+    cfg->dump = NULL;
+}
+
+/* Runs the library's ROMs one after the other, in path order, with detailed output per ROM.
+    With movies, runs every movie on its ROM instead */
+static int run_sequential(const RomLib *lib, const MovieRun *movies, size_t movie_count, RunConfig *cfg, bool use_jit,
+    bool use_rewind, const char *profile_prefix, const char *trace_path, const char *dump_path, uint32_t dump_fps)
+{
+    static Chip8Jit jit;
+    static Rewind rewind;
+#ifdef CHIP8_PROFILE
+    static Chip8Profile profile;
+    if (profile_prefix && use_jit)
+    {
+        log_msg(LOG_WARN, "profiling runs on the interpreter, -J ignored");
+        use_jit = false;
+    }
+#else
+    if (profile_prefix)
+    {
+        log_msg(LOG_ERROR, "built without the profiler, rebuild with make PROFILE=1");
+        return 1;
+    }
+#endif
+    if (trace_path && use_jit)
+    {
+        log_msg(LOG_WARN, "tracing runs on the interpreter, -J ignored");
+        use_jit = false;
+    }
+
+    if (use_jit)
+    {
+        if (chip8_jit_init(&jit))
+            return 1;
+        cfg->jit = &jit;
+    }
+    if (use_rewind)
+    {
+        if (rewind_init(&rewind, REWIND_DEFAULT_BYTES, REWIND_DEFAULT_FRAMES))
+            return 1;
+        cfg->rewind = &rewind;
+    }
+
+    int status = 0;
+    size_t runs = movie_count ? movie_count : lib->path_count;
+    for (size_t i = 0; i < runs; i++)
+    {
+        static Chip8 vm;
+        RunResult res;
+        uint32_t path = movie_count ? lib->roms[movies[i].rom].path : (uint32_t)i;
+        if (chip8_init(&vm) || romlib_load(lib, lib->paths[path].rom, &vm))
+        {
+            status = 1;
+            continue;
+        }
+        MoviePlayer player;
+        cfg->movie = NULL;
+        if (movie_count)
+        {
+            movie_play_start(&player, &movies[i].movie, &vm);
+            cfg->movie = &player;
+        }
+        if (cfg->jit)
+            chip8_jit_flush(cfg->jit);
+        if (cfg->rewind)
+            rewind_clear(cfg->rewind);
+#ifdef CHIP8_PROFILE
+        if (profile_prefix)
+        {
+            vm.profile = &profile;
+            profile_reset(&profile, vm.pc);
+        }
+#endif
+        static Chip8Trace trace;
+        static char trace_file[4096];
+        if (trace_path)
+        {
+            if (runs > 1)
+                snprintf(trace_file, sizeof(trace_file), "%s.%zu", trace_path, i);
+            else
+                snprintf(trace_file, sizeof(trace_file), "%s", trace_path);
+            if (trace_open(&trace, trace_file, &vm))
+            {
+                status = 1;
+                break;
+            }
+            cfg->trace = &trace;
+        }
+        static FrameDump dump;
+        static char dump_file[4096];
+        if (dump_path)
+        {
+            if (runs > 1)
+                numbered_path(dump_file, sizeof(dump_file), dump_path, i);
+            else
+                snprintf(dump_file, sizeof(dump_file), "%s", dump_path);
+            if (framedump_open(&dump, dump_file, dump_fps))
+            {
+                status = 1;
+                close_outputs(cfg);
+                break;
+            }
+            cfg->dump = &dump;
+        }
+        if (runner_run(&vm, cfg, &res))
+        {
+            status = 1;
+            close_outputs(cfg);
+            break;
+        }
+        print_result(lib->paths[path].name, &vm, &res);
+        if (movie_count)
+        {
+            bool whole = !cfg->max_instructions && !cfg->max_frames;
+            bool matches = movie_replayed(&movies[i].movie, &res);
+            printf("  movie: %s, %zu events%s\n", movies[i].path, movies[i].movie.count,
+                !whole ? "" : matches ? ", matches the recording" : ", differs from the recording");
+            if (whole && !matches)
+                status = 1;
+        }
+        if (cfg->trace)
+        {
+            status |= trace_close(&trace);  // Counts the end record, trace.bytes is then the file size
+            printf("  trace: %s, %llu bytes (%.2f per instruction)\n", trace.path, (unsigned long long)trace.bytes,
+                res.instructions ? (double)trace.bytes / res.instructions : 0);
+            cfg->trace = NULL;
+        }
+        if (cfg->dump)
+        {
+            status |= framedump_close(&dump);
+            printf("  dump: %s, %llu frames, %llu distinct, %llu bytes\n", dump_file, (unsigned long long)dump.frames,
+                (unsigned long long)dump.records, (unsigned long long)dump.bytes);
+            cfg->dump = NULL;
+        }
+#ifdef CHIP8_PROFILE
+        if (profile_prefix)
+            status |= write_profile(&profile, &vm, profile_prefix, runs > 1 ? (int)i : -1);
+#endif
+        if (cfg->rewind)
+            printf("  rewind: %zu frames held in %zu bytes\n", cfg->rewind->count, cfg->rewind->used);
+        if (res.exit == RUN_EXIT_VM_ERROR)
+            status = 1;
+    }
+    if (cfg->jit)
+        chip8_jit_cleanup(cfg->jit);
+    if (cfg->rewind)
+        rewind_cleanup(cfg->rewind);
+    return status;
+}
+
+static void print_library(const RomLib *lib)
+{
+    printf("library: %zu roms, %zu distinct (%zu read, %zu from the index, %zu packs mapped)\n", lib->path_count,
+        lib->rom_count, lib->hashed, lib->indexed, lib->map_count);
+}
+
+int main(int argc, char *argv[])
+{
+    RunConfig cfg = { .instructions_per_frame = RUNNER_DEFAULT_IPF };
+    bool use_jit = false;
+    bool use_rewind = false;
+    unsigned threads = 0;   // 0 = sequential, detailed output
+    size_t lanes = 0;       // 0 = no lockstep
+    const char *profile_prefix = NULL;
+    const char *trace_path = NULL;
+    const char *dump_path = NULL;
+    uint32_t dump_fps = 60;
+    static MovieRun movies[64];
+    size_t movie_count = 0;
+    const char *index_path = NULL;
+    const char *pack_path = NULL;
+    int quirks = ROMLIB_QUIRKS_AUTO;
+    bool fuse = true;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++)    // Read options
+    {
+        if (!strcmp(argv[i], "-J"))
+        {
+            use_jit = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "-F"))
+        {
+            fuse = false;
+            continue;
+        }
+        if (!strcmp(argv[i], "-R"))
+        {
+            use_rewind = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "-b"))
+        {
+            threads = pool_default_threads();
+            continue;
+        }
+        if (!strcmp(argv[i], "-P") && i + 1 < argc)
+        {
+            profile_prefix = argv[++i];
+            continue;
+        }
+        if (!strcmp(argv[i], "-T") && i + 1 < argc)
+        {
+            trace_path = argv[++i];
+            continue;
+        }
+        if (!strcmp(argv[i], "-D") && i + 1 < argc)
+        {
+            dump_path = argv[++i];
+            continue;
+        }
+        if (!strcmp(argv[i], "-M") && i + 1 < argc)
+        {
+            if (movie_count == sizeof(movies) / sizeof(movies[0]))
+            {
+                log_msg(LOG_ERROR, "too many movies, at most %zu", sizeof(movies) / sizeof(movies[0]));
+                return 1;
+            }
+            movies[movie_count].path = argv[++i];
+            if (movie_read(&movies[movie_count].movie, movies[movie_count].path))
+                return 1;
+            movie_count++;
+            continue;
+        }
+        if (!strcmp(argv[i], "-I") && i + 1 < argc)
+        {
+            index_path = argv[++i];
+            continue;
+        }
+        if (!strcmp(argv[i], "-W") && i + 1 < argc)
+        {
+            pack_path = argv[++i];
+            continue;
+        }
+        if (!strcmp(argv[i], "-q") && i + 1 < argc)
+        {
+            Chip8Quirks q;
+            if (chip8_parse_quirks(argv[++i], &q))
+                return 1;
+            quirks = q;
+            continue;
+        }
+        uint64_t value = 0;
+        if (i + 1 >= argc || parse_count(argv[i + 1], &value))
+        {
+            usage();
+            return 1;
+        }
+        if (!strcmp(argv[i], "-n"))         cfg.max_instructions = value;
+        else if (!strcmp(argv[i], "-f"))    cfg.max_frames = value;
+        else if (!strcmp(argv[i], "-i"))    cfg.instructions_per_frame = (uint32_t)value;
+        else if (!strcmp(argv[i], "-j"))    threads = (unsigned)value;
+        else if (!strcmp(argv[i], "-L"))    lanes = (size_t)value;
+        else if (!strcmp(argv[i], "-r"))    dump_fps = value > UINT32_MAX ? UINT32_MAX : (uint32_t)value;   // framedump_open checks the range
+        else
+        {
+            usage();
+            return 1;
+        }
+        i++;
+    }
+
+    if (i >= argc || (!pack_path && !movie_count && !cfg.max_instructions && !cfg.max_frames))
+    {
+        usage();
+        return 1;
+    }
+    if (trace_path && (threads || lanes))
+    {
+        log_msg(LOG_ERROR, "tracing needs a sequential run, drop -b/-j/-L");
+        return 1;
+    }
+    if (dump_path && (threads || lanes))
+    {
+        log_msg(LOG_ERROR, "frame dumps need a sequential run, drop -b/-j/-L");
+        return 1;
+    }
+    if (movie_count && lanes)
+    {
+        log_msg(LOG_ERROR, "movies can't be played in lockstep mode");
+        return 1;
+    }
+
+    // Gather the ROMs, a ROM that can't be read fails the run but doesn't stop the others
+    static RomLib lib;
+    int status = 0;
+    romlib_init(&lib);
+    lib.quirks = quirks;
+    lib.fuse = fuse;
+    if (index_path)
+        status |= romlib_load_index(&lib, index_path);
+    for (; i < argc; i++)
+        status |= romlib_add(&lib, argv[i]);
+    if (index_path)
+        status |= romlib_save_index(&lib, index_path);
+
+    if (pack_path)
+    {
+        print_library(&lib);
+        status |= romlib_write_pack(&lib, pack_path);
+    }
+    else if (!lib.path_count || match_movies(&lib, movies, movie_count))
+        status = 1;
+    else if (lanes)
+        status |= run_lockstep(&lib, &cfg, lanes);
+    else if (threads)
+    {
+        print_library(&lib);
+        status |= run_batch(&lib, movies, movie_count, &cfg, use_jit, threads);
+    }
+    else
+        status |= run_sequential(&lib, movies, movie_count, &cfg, use_jit, use_rewind, profile_prefix, trace_path,
+            dump_path, dump_fps);
+    romlib_cleanup(&lib);
+    for (size_t m = 0; m < movie_count; m++)
+        movie_cleanup(&movies[m].movie);
+    return status;
+}
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "movie.h"
+#include "logger.h"
+
+/*
+    movie.c records and plays back input movies:
+    - Events are appended in instruction order while recording, playback walks them with a cursor
+    - Files are little-endian: a fixed header, then one 13-byte record per event
+*/
+
+#define MOVIE_HEADER_SIZE 60    // magic, version, memory hash, seed, ips, credit, frames, instructions, display, events,
+                                // quirks
+#define MOVIE_EVENT_SIZE 13     // at u64, type u8, value u32
+
+static void put32(uint8_t *b, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        b[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void put64(uint8_t *b, uint64_t v)
+{
+    put32(b, (uint32_t)v);
+    put32(b + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t get32(const uint8_t *b)
+{
+    return (uint32_t)b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+static uint64_t get64(const uint8_t *b)
+{
+    return get32(b) | (uint64_t)get32(b + 4) << 32;
+}
+
+static uint64_t memory_hash(const Chip8 *vm)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < CHIP8_MEM_SIZE; i++)
+    {
+        hash ^= vm->memory[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+void movie_init(Movie *m)
+{
+    *m = (Movie){ 0 };
+}
+
+void movie_cleanup(Movie *m)
+{
+    free(m->events);
+    *m = (Movie){ 0 };
+}
+
+void movie_start(Movie *m, const Chip8 *vm, uint32_t ips, uint32_t credit)
+{
+    m->memory_hash = memory_hash(vm);
+    m->seed = vm->rng_state;
+    m->quirks = vm->quirks;
+    m->ips = m->last_ips = ips;
+    m->credit = credit;
+    m->frames = m->instructions = m->display_hash = 0;
+    m->count = 0;
+    m->keys = 0;    // Playback starts with every key released
+}
+
+static bool add_event(Movie *m, uint64_t at, MovieEventType type, uint32_t value)
+{
+    if (m->count == m->cap)
+    {
+        size_t cap = m->cap ? m->cap * 2 : 256;
+        MovieEvent *events = realloc(m->events, cap * sizeof(MovieEvent));
+        if (!events)
+        {
+            log_msg(LOG_ERROR, "Out of memory for the movie");
+            return true;
+        }
+        m->events = events;
+        m->cap = cap;
+    }
+    m->events[m->count++] = (MovieEvent){ .at = at, .type = (uint8_t)type, .value = value };
+    return false;
+}
+
+bool movie_record(Movie *m, uint64_t at, uint16_t keys, uint32_t ips)
+{
+    if (keys != m->keys)
+    {
+        if (add_event(m, at, MOVIE_EV_KEYS, keys))
+            return true;
+        m->keys = keys;
+    }
+    if (ips != m->last_ips)
+    {
+        if (add_event(m, at, MOVIE_EV_IPS, ips))
+            return true;
+        m->last_ips = ips;
+    }
+    return false;
+}
+
+void movie_finish(Movie *m, uint64_t instructions, uint64_t frames, const Chip8 *vm)
+{
+    m->instructions = instructions;
+    m->frames = frames;
+    m->display_hash = chip8_display_hash(vm);
+}
+
+bool movie_write(const Movie *m, const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f)
+    {
+        log_msg(LOG_ERROR, "Couldn't open file: '%s'", path);
+        return true;
+    }
+    uint8_t h[MOVIE_HEADER_SIZE];
+    memcpy(h, MOVIE_MAGIC, 4);
+    put32(h + 4, MOVIE_VERSION);
+    put64(h + 8, m->memory_hash);
+    put32(h + 16, m->seed);
+    put32(h + 20, m->ips);
+    put32(h + 24, m->credit);
+    put64(h + 28, m->frames);
+    put64(h + 36, m->instructions);
+    put64(h + 44, m->display_hash);
+    put32(h + 52, (uint32_t)m->count);
+    put32(h + 56, m->quirks);
+    fwrite(h, 1, sizeof(h), f);
+    for (size_t i = 0; i < m->count; i++)
+    {
+        uint8_t e[MOVIE_EVENT_SIZE];
+        put64(e, m->events[i].at);
+        e[8] = m->events[i].type;
+        put32(e + 9, m->events[i].value);
+        fwrite(e, 1, sizeof(e), f);
+    }
+    bool failed = ferror(f) != 0;
+    failed |= fclose(f) != 0;
+    if (failed)
+        log_msg(LOG_ERROR, "Couldn't write movie: '%s'", path);
+    return failed;
+}
+
+bool movie_read(Movie *m, const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        log_msg(LOG_ERROR, "Couldn't open file: '%s'", path);
+        return true;
+    }
+    movie_init(m);
+    uint8_t h[MOVIE_HEADER_SIZE];
+    bool failed = fread(h, 1, sizeof(h), f) != sizeof(h) || memcmp(h, MOVIE_MAGIC, 4) ||
+                  get32(h + 4) != MOVIE_VERSION || get32(h + 56) >= CHIP8_QUIRKS_COUNT;
+    if (!failed)
+    {
+        m->memory_hash = get64(h + 8);
+        m->seed = get32(h + 16);
+        m->quirks = (uint8_t)get32(h + 56);
+        m->ips = m->last_ips = get32(h + 20);
+        m->credit = get32(h + 24);
+        m->frames = get64(h + 28);
+        m->instructions = get64(h + 36);
+        m->display_hash = get64(h + 44);
+        uint32_t count = get32(h + 52);
+        uint64_t last = 0;
+        for (uint32_t i = 0; i < count && !failed; i++)
+        {
+            uint8_t e[MOVIE_EVENT_SIZE];
+            if (fread(e, 1, sizeof(e), f) != sizeof(e))
+            {
+                failed = true;
+                break;
+            }
+            MovieEvent ev = { .at = get64(e), .type = e[8], .value = get32(e + 9) };
+            // Events must be in order and well-formed, the player relies on it
+            failed = ev.at < last || ev.type > MOVIE_EV_IPS || (ev.type == MOVIE_EV_IPS && ev.value == 0) ||
+                     add_event(m, ev.at, (MovieEventType)ev.type, ev.value);
+            last = ev.at;
+        }
+    }
+    fclose(f);
+    if (failed)
+    {
+        log_msg(LOG_ERROR, "'%s' isn't a valid version %d movie", path, MOVIE_VERSION);
+        movie_cleanup(m);
+    }
+    return failed;
+}
+
+bool movie_matches(const Movie *m, const Chip8 *vm)
+{
+    return memory_hash(vm) == m->memory_hash;
+}
+
+void movie_play_start(MoviePlayer *p, const Movie *m, Chip8 *vm)
+{
+    *p = (MoviePlayer){ .movie = m, .ips = m->ips, .credit = m->credit };
+    chip8_seed(vm, m->seed);
+    chip8_set_quirks(vm, (Chip8Quirks)m->quirks);
+    chip8_set_key_mask(vm, 0);
+    movie_play_events(p, vm, 0);
+}
+
+uint32_t movie_play_budget(MoviePlayer *p)
+{
+    p->credit += p->ips;
+    uint32_t budget = p->credit / MOVIE_FRAME_RATE;
+    p->credit %= MOVIE_FRAME_RATE;
+    return budget;
+}
+
+uint64_t movie_play_events(MoviePlayer *p, Chip8 *vm, uint64_t executed)
+{
+    const Movie *m = p->movie;
+    for (; p->next < m->count && m->events[p->next].at <= executed; p->next++)
+    {
+        const MovieEvent *e = &m->events[p->next];
+        if (e->type == MOVIE_EV_KEYS)
+            chip8_set_key_mask(vm, (uint16_t)e->value);
+        else
+            p->ips = e->value;
+    }
+    return p->next < m->count ? m->events[p->next].at : UINT64_MAX;
+}
@@ -0,0 +1,83 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+
+/* Input movies: a recorded play session that replays bit for bit.
+    A movie holds the VM's memory hash, PRNG seed and quirk profile when recording started, the scheduler state (instructions per
+    second and the fractional credit, which decide every frame's instruction budget) and a list of events stamped
+    with the instruction count they take effect at: key state changes and speed changes. The SDL frontend records
+    them at frame boundaries (chip8-emulator --record); runner_run plays them back at any instruction count, as
+    fast as the host allows. Rewinding or loading a state ends a recording, since the session would no longer be
+    reproducible from its start */
+
+#define MOVIE_MAGIC "C8MV"
+#define MOVIE_VERSION 2
+#define MOVIE_FRAME_RATE 60         // Frames (timer ticks) per second the budgets are derived from
+
+typedef enum {
+    MOVIE_EV_KEYS,      // value = key mask, bit k = key k pressed
+    MOVIE_EV_IPS        // value = instructions per second from the next frame on
+} MovieEventType;
+
+typedef struct {
+    uint64_t at;        // Instructions executed before the event applies
+    uint8_t type;       // MovieEventType
+    uint32_t value;
+} MovieEvent;
+
+typedef struct {
+    uint64_t memory_hash;   // FNV-1a of the VM memory when recording started (identifies the ROM)
+    uint32_t seed;          // PRNG state when recording started
+    uint8_t quirks;         // Chip8Quirks the session ran with
+    uint32_t ips;           // Scheduler state when recording started
+    uint32_t credit;
+    uint64_t frames;        // Length of the recording
+    uint64_t instructions;
+    uint64_t display_hash;  // chip8_display_hash at the end, to check a playback
+    MovieEvent *events;
+    size_t count, cap;
+    uint16_t keys;          // Recording: last key mask recorded
+    uint32_t last_ips;      // Recording: last speed recorded
+} Movie;
+
+// Playback cursor, one per VM playing a (shared, read-only) movie
+typedef struct {
+    const Movie *movie;
+    size_t next;            // Next event
+    uint32_t ips, credit;
+} MoviePlayer;
+
+void movie_init(Movie *m);
+void movie_cleanup(Movie *m);
+
+// Starts recording on vm as it is now, with the frontend's scheduler state
+void movie_start(Movie *m, const Chip8 *vm, uint32_t ips, uint32_t credit);
+
+/* Records the key state and speed in effect from instruction `at` on (only changes are stored).
+Returns: true if out of memory */
+bool movie_record(Movie *m, uint64_t at, uint16_t keys, uint32_t ips);
+
+// Closes the recording with its length and final display
+void movie_finish(Movie *m, uint64_t instructions, uint64_t frames, const Chip8 *vm);
+
+// File I/O, return true on failure
+bool movie_write(const Movie *m, const char *path);
+bool movie_read(Movie *m, const char *path);
+
+// Returns true if vm is in the state the movie was recorded from (same memory, i.e. the same ROM)
+bool movie_matches(const Movie *m, const Chip8 *vm);
+
+// Seeds vm, selects the movie's quirk profile, releases every key and applies the events at instruction 0, p then feeds the rest to runner_run
+void movie_play_start(MoviePlayer *p, const Movie *m, Chip8 *vm);
+
+// Instruction budget of the next frame (same arithmetic as the frontend's scheduler)
+uint32_t movie_play_budget(MoviePlayer *p);
+
+// Applies every event due at `executed` instructions, returns the instruction count of the next one (UINT64_MAX if none)
+uint64_t movie_play_events(MoviePlayer *p, Chip8 *vm, uint64_t executed);
+
+#endif
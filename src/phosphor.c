@@ -0,0 +1,245 @@
+#include <math.h>
+#include <string.h>
+#include "phosphor.h"
+#include "logger.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+    phosphor.c implements the display pipeline of the SDL frontend:
+    - The blend works on 16 pixels at a time with SSE2: the display bits become byte masks, the old brightness is
+      scaled by keep in 16-bit lanes and the two are merged with an unsigned max
+    - Scale2x runs on the brightness, 16 pixels at a time without branches (the EPX compares on a flickering
+      screen are unpredictable). Fading pixels compare unequal to lit ones, so a fading edge isn't smoothed
+    - The blend reports which display rows changed (widened by one row for scale2x, whose corners read the rows next
+      to them), so only the output bands those rows cover are rewritten and uploaded
+    - The upscaler builds each distinct output row once and copies it to every output row it covers, the texture
+      memory is only ever written
+*/
+
+static const char *scaler_names[SCALERS_COUNT] = { "nearest", "scale2x" };
+
+static void scale2x(const uint8_t *src, uint8_t *dst);
+
+void phosphor_init(Phosphor *ph, Scaler scaler, unsigned persistence, unsigned refresh_rate)
+{
+    memset(ph->level, 0, sizeof(ph->level));
+    memset(ph->smooth, 0, sizeof(ph->smooth));
+    ph->map_width = 0;
+    ph->scaler = scaler;
+    ph->fading = false;
+    ph->keep = 0;
+    if (persistence > PHOSPHOR_MAX_PERSISTENCE)
+        persistence = PHOSPHOR_MAX_PERSISTENCE;
+    if (persistence && refresh_rate)
+    {
+        // Same decay per second at any refresh rate: persistence per 60 Hz frame, spread over the host refreshes
+        float keep = 256.0f * powf(persistence / 100.0f, 60.0f / (float)refresh_rate);
+        ph->keep = keep >= 255.0f ? 255 : (uint16_t)lroundf(keep);
+    }
+}
+
+bool phosphor_parse_scaler(const char *name, Scaler *out)
+{
+    for (int s = 0; s < SCALERS_COUNT; s++)
+    {
+        if (!strcmp(name, scaler_names[s]))
+        {
+            *out = (Scaler)s;
+            return false;
+        }
+    }
+    log_msg(LOG_ERROR, "unknown scaler '%s' (nearest, scale2x)", name);
+    return true;
+}
+
+uint32_t phosphor_blend(Phosphor *ph, const uint64_t *display)
+{
+    uint32_t rows = 0;
+#ifdef __SSE2__
+    // Byte j of a 16-pixel group tests bit 7 - (j & 7) of the display byte it was broadcast from
+    const __m128i bit = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i keep = _mm_set1_epi16((short)ph->keep);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi8(-1);
+    __m128i fading = zero;
+    for (int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++)
+    {
+        __m128i changed = zero;
+        for (int group = 0; group < CHIP8_DISPLAY_WIDTH / 16; group++)
+        {
+            uint32_t bits = (uint32_t)(display[y] >> (48 - group * 16)) & 0xFFFFu;
+            __m128i spread = _mm_set_epi64x((long long)((bits & 0xFFu) * 0x0101010101010101ull),
+                                            (long long)((bits >> 8) * 0x0101010101010101ull));
+            __m128i on = _mm_cmpeq_epi8(_mm_and_si128(spread, bit), bit);
+
+            __m128i *level = (__m128i *)(ph->level + y * CHIP8_DISPLAY_WIDTH + group * 16);
+            __m128i old = _mm_load_si128(level);
+            __m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(old, zero), keep), 8);
+            __m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(old, zero), keep), 8);
+            __m128i now = _mm_max_epu8(on, _mm_packus_epi16(lo, hi));
+            _mm_store_si128(level, now);
+
+            changed = _mm_or_si128(changed, _mm_xor_si128(now, old));
+            fading = _mm_or_si128(fading, _mm_andnot_si128(_mm_cmpeq_epi8(now, full), now));
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(changed, zero)) != 0xFFFF)
+            rows |= 1u << y;
+    }
+    ph->fading = _mm_movemask_epi8(_mm_cmpeq_epi8(fading, zero)) != 0xFFFF;
+#else
+    bool fading = false;
+    for (int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++)
+    {
+        for (int x = 0; x < CHIP8_DISPLAY_WIDTH; x++)
+        {
+            uint8_t *level = ph->level + y * CHIP8_DISPLAY_WIDTH + x;
+            uint8_t now = (display[y] >> (63 - x)) & 1u ? 255 : (uint8_t)((*level * ph->keep) >> 8);
+            if (now != *level)
+                rows |= 1u << y;
+            fading |= now && now != 255;
+            *level = now;
+        }
+    }
+    ph->fading = fading;
+#endif
+    if (rows && ph->scaler == SCALER_SCALE2X)
+    {
+        scale2x(ph->level, ph->smooth);
+        rows |= rows << 1 | rows >> 1;
+    }
+    return rows;
+}
+
+#ifdef __SSE2__
+// Picks a where mask is set, b elsewhere
+static inline __m128i pick(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+#endif
+
+/* Scale2x (EPX) of the brightness: each pixel becomes 2x2, a corner takes the color of the two neighbours it
+    touches when they match and the opposite ones don't. Neighbours past the edge repeat the edge pixel */
+static void scale2x(const uint8_t *src, uint8_t *dst)
+{
+    const int w = CHIP8_DISPLAY_WIDTH, h = CHIP8_DISPLAY_HEIGHT;
+    for (int y = 0; y < h; y++)
+    {
+        const uint8_t *up = src + (y ? y - 1 : y) * w;
+        const uint8_t *row = src + y * w;
+        const uint8_t *down = src + (y < h - 1 ? y + 1 : y) * w;
+        uint8_t *out = dst + y * 4 * w;
+#ifdef __SSE2__
+        // The row with its edge pixels repeated on both sides, so left and right neighbours are plain loads
+        uint8_t padded[CHIP8_DISPLAY_WIDTH + 2];
+        memcpy(padded + 1, row, w);
+        padded[0] = row[0];
+        padded[w + 1] = row[w - 1];
+        for (int x = 0; x < w; x += 16)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *)(up + x));
+            __m128i b = _mm_loadu_si128((const __m128i *)(padded + x + 2));
+            __m128i c = _mm_loadu_si128((const __m128i *)(padded + x));
+            __m128i d = _mm_loadu_si128((const __m128i *)(down + x));
+            __m128i e = _mm_loadu_si128((const __m128i *)(row + x));
+            __m128i ca = _mm_cmpeq_epi8(c, a), ab = _mm_cmpeq_epi8(a, b);
+            __m128i cd = _mm_cmpeq_epi8(c, d), bd = _mm_cmpeq_epi8(b, d);
+            __m128i e0 = pick(_mm_andnot_si128(_mm_or_si128(cd, ab), ca), a, e);
+            __m128i e1 = pick(_mm_andnot_si128(_mm_or_si128(ca, bd), ab), b, e);
+            __m128i e2 = pick(_mm_andnot_si128(_mm_or_si128(bd, ca), cd), c, e);
+            __m128i e3 = pick(_mm_andnot_si128(_mm_or_si128(ab, cd), bd), d, e);
+            _mm_storeu_si128((__m128i *)(out + 2 * x), _mm_unpacklo_epi8(e0, e1));
+            _mm_storeu_si128((__m128i *)(out + 2 * x + 16), _mm_unpackhi_epi8(e0, e1));
+            _mm_storeu_si128((__m128i *)(out + 2 * w + 2 * x), _mm_unpacklo_epi8(e2, e3));
+            _mm_storeu_si128((__m128i *)(out + 2 * w + 2 * x + 16), _mm_unpackhi_epi8(e2, e3));
+        }
+#else
+        for (int x = 0; x < w; x++)
+        {
+            uint8_t a = up[x], b = row[x < w - 1 ? x + 1 : x], c = row[x ? x - 1 : x], d = down[x], e = row[x];
+            out[2 * x]             = c == a && c != d && a != b ? a : e;
+            out[2 * x + 1]         = a == b && a != c && b != d ? b : e;
+            out[2 * w + 2 * x]     = d == c && d != b && c != a ? c : e;
+            out[2 * w + 2 * x + 1] = b == d && b != a && d != c ? d : e;
+        }
+#endif
+    }
+}
+
+// RGBA8888 gray of a brightness, alpha opaque
+static inline uint32_t gray(uint8_t level)
+{
+    return level * 0x01010100u | 0x000000FFu;
+}
+
+// Builds the output row of source row src (source_width pixels) into ph->line
+static void expand_line(Phosphor *ph, const uint8_t *src, int source_width, int width)
+{
+    uint32_t *out = ph->line;
+    if (width % source_width)
+    {
+        for (int x = 0; x < width; x++)
+            out[x] = gray(src[ph->column[x]]);
+        return;
+    }
+    // Whole scale factor: runs of `scale` equal pixels
+    int scale = width / source_width;
+    for (int x = 0; x < source_width; x++, out += scale)
+    {
+        uint32_t color = gray(src[x]);
+        int i = 0;
+#ifdef __SSE2__
+        __m128i run = _mm_set1_epi32((int)color);
+        for (; i + 4 <= scale; i += 4)
+            _mm_storeu_si128((__m128i *)(out + i), run);
+#endif
+        for (; i < scale; i++)
+            out[i] = color;
+    }
+}
+
+void phosphor_span(int height, int first, int end, int *top, int *bottom)
+{
+    // Output row y shows display row y * CHIP8_DISPLAY_HEIGHT / height (scale2x rows halve that exactly)
+    *top = (first * height + CHIP8_DISPLAY_HEIGHT - 1) / CHIP8_DISPLAY_HEIGHT;
+    *bottom = (end * height + CHIP8_DISPLAY_HEIGHT - 1) / CHIP8_DISPLAY_HEIGHT;
+}
+
+void phosphor_upscale(Phosphor *ph, uint32_t *dst, int pitch, int width, int height, int top, int bottom)
+{
+    const uint8_t *src = ph->level;
+    int source_width = CHIP8_DISPLAY_WIDTH, source_height = CHIP8_DISPLAY_HEIGHT;
+    if (ph->scaler == SCALER_SCALE2X)
+    {
+        src = ph->smooth;
+        source_width *= 2;
+        source_height *= 2;
+    }
+    if (width > PHOSPHOR_MAX_WIDTH)
+        width = PHOSPHOR_MAX_WIDTH;
+    if (height > PHOSPHOR_MAX_HEIGHT)
+        height = PHOSPHOR_MAX_HEIGHT;
+    if (bottom > height)
+        bottom = height;
+    if (ph->map_width != width || ph->map_source != source_width)
+    {
+        for (int x = 0; x < width; x++)
+            ph->column[x] = (uint16_t)(x * source_width / width);
+        ph->map_width = width;
+        ph->map_source = source_width;
+    }
+
+    int built = -1;     // Source row ph->line holds
+    for (int y = top; y < bottom; y++)
+    {
+        int source_y = y * source_height / height;
+        if (source_y != built)
+        {
+            expand_line(ph, src + source_y * source_width, source_width, width);
+            built = source_y;
+        }
+        memcpy((uint8_t *)dst + (size_t)(y - top) * pitch, ph->line, (size_t)width * sizeof(uint32_t));
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef PHOSPHOR_H
+#define PHOSPHOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "constants.h"
+
+/*
+    phosphor.h: CPU-side display pipeline of the SDL frontend, run once per host refresh:
+    - Blends the latest display into a persistence buffer: lit pixels go to full brightness, unlit ones keep a
+      fraction of theirs, so a sprite erased and redrawn on the next frame (XOR drawing) dims instead of flickering
+    - Upscales the brightness to the output size (nearest, or scale2x then nearest) as RGBA8888 pixels, written
+      straight into the locked streaming texture, only the bands of the display rows that changed
+*/
+
+#define PHOSPHOR_MAX_WIDTH  4096            // Largest output the upscaler fills
+#define PHOSPHOR_MAX_HEIGHT 4096
+#define PHOSPHOR_DEFAULT_PERSISTENCE 60     // Percent of its brightness an unlit pixel keeps per 60 Hz frame
+#define PHOSPHOR_MAX_PERSISTENCE 95
+
+typedef enum {
+    SCALER_NEAREST,     // Square pixels
+    SCALER_SCALE2X,     // Scale2x (EPX) edge smoothing first, then nearest
+    SCALERS_COUNT
+} Scaler;
+
+typedef struct {
+    _Alignas(16) uint8_t level[CHIP8_DISPLAY_HEIGHT * CHIP8_DISPLAY_WIDTH];      // Brightness of each pixel
+    _Alignas(16) uint8_t smooth[CHIP8_DISPLAY_HEIGHT * CHIP8_DISPLAY_WIDTH * 4]; // level after scale2x
+    uint32_t line[PHOSPHOR_MAX_WIDTH];      // One upscaled row, copied to every output row it covers
+    uint16_t column[PHOSPHOR_MAX_WIDTH];    // Source column of each output column (for map_width)
+    int map_width, map_source;
+    uint16_t keep;          // Brightness an unlit pixel keeps per host refresh, in 256ths (0: no persistence)
+    Scaler scaler;
+    bool fading;            // Some pixel is between off and full brightness: blend again even without a new frame
+} Phosphor;
+
+/* Resets the buffer to a blank screen. persistence is the percent of its brightness an unlit pixel keeps per 60 Hz
+    frame (0 = none, up to PHOSPHOR_MAX_PERSISTENCE), refresh_rate the host refreshes per second */
+void phosphor_init(Phosphor *ph, Scaler scaler, unsigned persistence, unsigned refresh_rate);
+
+// Looks up a scaler by name (nearest, scale2x). Returns: true if there is none
+bool phosphor_parse_scaler(const char *name, Scaler *out);
+
+/* Blends display (CHIP8_DISPLAY_HEIGHT packed rows, bit 63 = leftmost pixel) into the buffer, decaying unlit pixels
+    by one host refresh.
+Returns: the display rows whose output changed (bit y = row y), 0 if nothing needs uploading */
+uint32_t phosphor_blend(Phosphor *ph, const uint64_t *display);
+
+// Output rows [*top, *bottom) of a height-row output that show display rows [first, end)
+void phosphor_span(int height, int first, int end, int *top, int *bottom);
+
+/* Writes output rows [top, bottom) of the buffer upscaled to width x height RGBA8888 pixels into dst (which holds
+    row top), pitch bytes per row */
+void phosphor_upscale(Phosphor *ph, uint32_t *dst, int pitch, int width, int height, int top, int bottom);
+
+#endif
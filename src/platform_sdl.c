@@ -4,7 +4,8 @@
 /*
     responsible for the SDL2 platform operations:
     - Initializes and builds the window
-    - Renders VM states
+    - Renders display frames (on the main thread, the VM runs on its own) through the phosphor pipeline into a
+      streaming texture the size of the renderer output, presented 1:1
     - Converts user input to chip-8 standard
 */
 
@@ -27,16 +28,34 @@ bool plat_init(Platform *p)
     flag |= plat_renderer_create(p);     // Create the renderer object
     flag |= plat_texture_create(p);      // Create the texture object
 
-    SDL_SetRenderDrawColor(p->renderer, 0, 0, 0, 255);  // Default color scheme
-    SDL_RenderClear(p->renderer);
     if (flag)
     {
         plat_cleanup(p);
         return true;
     }
+    SDL_SetRenderDrawColor(p->renderer, 0, 0, 0, 255);  // Default color scheme
+    SDL_RenderClear(p->renderer);
+
+    // Coalesce presents to the refresh rate of the display the window is on (60 Hz if unknown)
+    SDL_DisplayMode mode;
+    int refresh = 60;
+    if (!SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(p->window), &mode) && mode.refresh_rate > 0)
+        refresh = mode.refresh_rate;
+    p->refresh_rate = refresh;
+    p->refresh_interval = SDL_GetPerformanceFrequency() / refresh;
+    p->present_interval = p->refresh_interval * 3 / 4;   // Slack for wake-up jitter
+    p->last_present = 0;
+    p->present_pending = false;
+    plat_set_filter(p, SCALER_NEAREST, PHOSPHOR_DEFAULT_PERSISTENCE);
     return false;
 }
 
+void plat_set_filter(Platform *p, Scaler scaler, unsigned persistence)
+{
+    phosphor_init(&p->phosphor, scaler, persistence, (unsigned)p->refresh_rate);
+    p->texture_stale = true;
+}
+
 bool plat_display_create(Platform *p)
 {
     p->window = SDL_CreateWindow(WINDOW_TITLE, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH, SCREEN_HEIGHT, 0);
@@ -56,18 +75,34 @@ bool plat_renderer_create(Platform *p)
         log_msg(LOG_ERROR, "Failed to create the renderer: %s", SDL_GetError());
         return true;
     }
-    SDL_RenderSetLogicalSize(p->renderer, CHIP8_DISPLAY_WIDTH, CHIP8_DISPLAY_HEIGHT);
     return false;
 }
 
+// Size of the renderer output in pixels (the window size if unknown), at most what the upscaler fills
+static void output_size(Platform *p, int *width, int *height)
+{
+    if (SDL_GetRendererOutputSize(p->renderer, width, height) || *width <= 0 || *height <= 0)
+    {
+        *width = SCREEN_WIDTH;
+        *height = SCREEN_HEIGHT;
+    }
+    if (*width > PHOSPHOR_MAX_WIDTH)
+        *width = PHOSPHOR_MAX_WIDTH;
+    if (*height > PHOSPHOR_MAX_HEIGHT)
+        *height = PHOSPHOR_MAX_HEIGHT;
+}
+
 bool plat_texture_create(Platform *p)
 {
-    p->texture = SDL_CreateTexture(p->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, TEXTURE_WIDTH, TEXTURE_HEIGHT);
+    output_size(p, &p->texture_width, &p->texture_height);
+    p->texture = SDL_CreateTexture(p->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+        p->texture_width, p->texture_height);
     if (!p->texture)
     {
         log_msg(LOG_ERROR, "Failed to create the texture: %s", SDL_GetError());
         return true;
     }
+    p->texture_stale = true;    // Filled by the next plat_render
     return false;
 }
 
@@ -99,14 +134,69 @@ bool plat_display_clear(Platform *p)
     return false;
 }
 
-bool plat_render(Platform *p, Chip8* vm)
+bool plat_render(Platform *p, const uint64_t *display)
 {
-    for (int i = 0; i < CHIP8_DISPLAY_HEIGHT*CHIP8_DISPLAY_WIDTH; i++)
-        p->pixels[i] = vm->display[i] ? 0xFFFFFFFFu : 0x000000FFu;
-    SDL_UpdateTexture(p->texture, NULL, p->pixels, CHIP8_DISPLAY_WIDTH * sizeof(uint32_t));
+    // A new output size (the window moved to a display with another pixel density) needs a new texture
+    int width, height;
+    output_size(p, &width, &height);
+    if (width != p->texture_width || height != p->texture_height)
+    {
+        SDL_DestroyTexture(p->texture);
+        p->texture = NULL;
+        if (plat_texture_create(p))
+            return true;
+    }
+
+    uint32_t rows = phosphor_blend(&p->phosphor, display);
+    if (p->texture_stale)
+        rows = UINT32_MAX;
+
+    // Upload each run of consecutive changed rows, upscaled, with one texture lock
+    int y = 0;
+    while (y < CHIP8_DISPLAY_HEIGHT && rows >> y)
+    {
+        if (!((rows >> y) & 1u))
+        {
+            y++;
+            continue;
+        }
+        int first = y;
+        while (y < CHIP8_DISPLAY_HEIGHT && ((rows >> y) & 1u))
+            y++;
+        int top, bottom;
+        phosphor_span(p->texture_height, first, y, &top, &bottom);
+        if (top >= bottom)
+            continue;
+
+        SDL_Rect rect = { 0, top, p->texture_width, bottom - top };
+        void *dst;
+        int pitch;
+        if (SDL_LockTexture(p->texture, &rect, &dst, &pitch))
+        {
+            log_msg(LOG_ERROR, "Failed to lock the texture: %s", SDL_GetError());
+            return true;
+        }
+        phosphor_upscale(&p->phosphor, dst, pitch, p->texture_width, p->texture_height, top, bottom);
+        SDL_UnlockTexture(p->texture);
+        p->present_pending = true;
+    }
+    p->texture_stale = false;
+    return false;
+}
+
+bool plat_present(Platform *p)
+{
+    if (!p->present_pending)
+        return false;
+    uint64_t now = SDL_GetPerformanceCounter();
+    if (now - p->last_present < p->present_interval)
+        return false;
+
     SDL_RenderClear(p->renderer);
     SDL_RenderCopy(p->renderer, p->texture, NULL, NULL);
     SDL_RenderPresent(p->renderer);
+    p->last_present = now;
+    p->present_pending = false;
     return false;
 }
 
@@ -4,6 +4,7 @@
 #include <SDL2/SDL.h>
 #include "constants.h"
 #include "chip8.h"
+#include "phosphor.h"
 
 // SDL Platform constants
 
@@ -11,15 +12,20 @@
 #define WINDOW_SCALE 10
 #define SCREEN_WIDTH  (CHIP8_DISPLAY_WIDTH * WINDOW_SCALE)
 #define SCREEN_HEIGHT (CHIP8_DISPLAY_HEIGHT * WINDOW_SCALE)
-#define TEXTURE_WIDTH  CHIP8_DISPLAY_WIDTH
-#define TEXTURE_HEIGHT CHIP8_DISPLAY_HEIGHT
 
 typedef struct {
     SDL_Window* window;
     SDL_Renderer* renderer;
-    SDL_Texture* texture;
-    uint32_t pixels[TEXTURE_WIDTH * TEXTURE_HEIGHT];
+    SDL_Texture* texture;       // Streaming, the size of the renderer output
+    int texture_width, texture_height;
+    bool texture_stale;         // Texture contents don't match the phosphor buffer (just created)
+    Phosphor phosphor;          // Persistence buffer and upscaler filling the texture
     int scale;
+    int refresh_rate;           // Host refreshes per second
+    bool present_pending;       // Texture changed since the last present
+    uint64_t refresh_interval;  // Performance-counter ticks per host refresh
+    uint64_t present_interval;  // Minimum performance-counter ticks between presents (most of a host refresh)
+    uint64_t last_present;      // Performance counter at the last present
 } Platform;
 
 // Initialize SDL platform
@@ -34,8 +40,15 @@ void plat_cleanup(Platform *p);
 // Clears the current display
 bool plat_display_clear(Platform *p);
 
-// Renders the framebuffer from the vm
-bool plat_render(Platform *p, Chip8* vm);
+// Selects the upscaler and the phosphor persistence (percent kept per 60 Hz frame, 0 = none), clears the screen
+void plat_set_filter(Platform *p, Scaler scaler, unsigned persistence);
+
+/* Blends display (CHIP8_DISPLAY_HEIGHT packed rows) into the phosphor buffer and uploads, upscaled, only the row bands
+    that changed. Call once per host refresh, even without a new frame, so lit pixels fade; plat_present shows it */
+bool plat_render(Platform *p, const uint64_t *display);
+
+// Presents the texture if it changed, at most once per host refresh
+bool plat_present(Platform *p);
 
 // Maps the keys 1,2,3,4,q,w,e,r... into their chip8 keyboard counterparts (1->0, 2->1 etc.)
 int map_key(SDL_Keycode k);
@@ -0,0 +1,157 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pool.h"
+#include "logger.h"
+
+/*
+    pool.c implements the work-stealing pool:
+    - Each worker owns a [head, tail) range of job indexes, guarded by its own mutex
+    - The owner takes jobs from the head, thieves take the upper half from the tail
+    - Jobs are coarse (whole ROM runs) so the per-job lock is never contended in practice
+*/
+
+typedef struct {
+    pthread_mutex_t lock;
+    size_t head;
+    size_t tail;
+} PoolQueue;
+
+typedef struct {
+    PoolQueue *queues;
+    unsigned threads;
+    PoolJobFn fn;
+    void *ctx;
+} Pool;
+
+typedef struct {
+    Pool *pool;
+    unsigned index;
+} PoolWorker;
+
+unsigned pool_default_threads(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned)n : 1;
+}
+
+// Pops the next job from the worker's own range, returns false if empty
+static bool pool_pop(PoolQueue *q, size_t *job)
+{
+    bool found = false;
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail)
+    {
+        *job = q->head++;
+        found = true;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+// Moves the upper half of the fullest other range into q, returns false if every range is empty
+static bool pool_steal(Pool *pool, unsigned self)
+{
+    for (;;)
+    {
+        unsigned victim = self;
+        size_t best = 0;
+        for (unsigned i = 0; i < pool->threads; i++)
+        {
+            PoolQueue *q = &pool->queues[i];
+            pthread_mutex_lock(&q->lock);
+            size_t left = q->tail - q->head;
+            pthread_mutex_unlock(&q->lock);
+            if (i != self && left > best)
+            {
+                best = left;
+                victim = i;
+            }
+        }
+        if (victim == self)
+            return false;
+
+        PoolQueue *v = &pool->queues[victim];
+        size_t from = 0, to = 0;
+        pthread_mutex_lock(&v->lock);
+        if (v->head < v->tail)
+        {
+            size_t take = (v->tail - v->head + 1) / 2;
+            to = v->tail;
+            from = v->tail - take;
+            v->tail = from;
+        }
+        pthread_mutex_unlock(&v->lock);
+        if (from == to)
+            continue;   // Victim drained meanwhile, look again
+
+        PoolQueue *q = &pool->queues[self];
+        pthread_mutex_lock(&q->lock);
+        q->head = from;
+        q->tail = to;
+        pthread_mutex_unlock(&q->lock);
+        return true;
+    }
+}
+
+static void *pool_worker(void *arg)
+{
+    PoolWorker *w = arg;
+    Pool *pool = w->pool;
+    size_t job;
+    do
+    {
+        while (pool_pop(&pool->queues[w->index], &job))
+            pool->fn(pool->ctx, job, w->index);
+    } while (pool_steal(pool, w->index));
+    return NULL;
+}
+
+bool pool_run(size_t jobs, unsigned threads, PoolJobFn fn, void *ctx)
+{
+    if (threads == 0) threads = 1;
+    if (threads > jobs) threads = jobs ? (unsigned)jobs : 1;
+
+    Pool pool = { .threads = threads, .fn = fn, .ctx = ctx };
+    pool.queues = calloc(threads, sizeof(PoolQueue));
+    PoolWorker *workers = calloc(threads, sizeof(PoolWorker));
+    pthread_t *handles = calloc(threads, sizeof(pthread_t));
+    if (!pool.queues || !workers || !handles)
+    {
+        log_msg(LOG_ERROR, "Failed to allocate the thread pool");
+        free(pool.queues);
+        free(workers);
+        free(handles);
+        return true;
+    }
+
+    for (unsigned i = 0; i < threads; i++)  // Even split of the job range
+    {
+        pthread_mutex_init(&pool.queues[i].lock, NULL);
+        pool.queues[i].head = jobs * i / threads;
+        pool.queues[i].tail = jobs * (i + 1) / threads;
+        workers[i] = (PoolWorker){ .pool = &pool, .index = i };
+    }
+
+    // Worker 0 runs on the calling thread, ranges of workers that fail to start get stolen
+    unsigned started = 1;
+    for (unsigned i = 1; i < threads; i++, started++)
+    {
+        if (pthread_create(&handles[i], NULL, pool_worker, &workers[i]))
+        {
+            log_msg(LOG_WARN, "Failed to start pool thread %u, continuing with %u", i, started);
+            break;
+        }
+    }
+    pool_worker(&workers[0]);
+    for (unsigned i = 1; i < started; i++)
+        pthread_join(handles[i], NULL);
+
+    for (unsigned i = 0; i < threads; i++)
+        pthread_mutex_destroy(&pool.queues[i].lock);
+    free(pool.queues);
+    free(workers);
+    free(handles);
+    return false;
+}
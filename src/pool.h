@@ -0,0 +1,20 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Work-stealing thread pool for independent jobs.
+    Jobs are split into one contiguous range per worker; a worker that runs out steals half of the
+    largest remaining range, so uneven ROM run times still keep every core busy */
+
+// Runs job number `job` on worker number `worker` (0 .. threads - 1)
+typedef void (*PoolJobFn)(void *ctx, size_t job, unsigned worker);
+
+// Number of online cores (at least 1)
+unsigned pool_default_threads(void);
+
+// Runs jobs 0 .. jobs - 1 on `threads` workers and waits for all of them, returns true if the pool couldn't be allocated
+bool pool_run(size_t jobs, unsigned threads, PoolJobFn fn, void *ctx);
+
+#endif
@@ -0,0 +1,234 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "profile.h"
+#include "logger.h"
+
+/*
+    profile.c holds the cold half of the guest profiler:
+    - Call-tree bookkeeping for 2NNN (the run and draw counters are bumped inline by chip8_run)
+    - Per-address counts rebuilt from the straight-line runs
+    - JSON and folded-stack export
+*/
+
+double profile_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void profile_reset(Chip8Profile *prof, uint16_t entry)
+{
+    memset(prof, 0, sizeof(*prof));
+    prof->nodes[0] = (ProfileNode){ .parent = 0, .entry = entry, .calls = 1 };
+    prof->node_count = 1;
+    prof->start_ticks = profile_ticks();
+    prof->start_seconds = profile_now();
+}
+
+void profile_pc_counts(const Chip8Profile *prof, uint64_t *counts)
+{
+    // Running sums over even and odd addresses, unsigned wraparound cancels the decrements out
+    uint64_t inside[2] = { 0, 0 };
+    for (uint32_t pc = 0; pc < PROFILE_PCS; pc++)
+    {
+        inside[pc & 1] += prof->pc_runs[pc];
+        counts[pc] = inside[pc & 1];
+    }
+}
+
+static uint32_t hash_pair(uint32_t a, uint32_t b)
+{
+    return ((a << 12 | b) * 2654435761u) >> 16;
+}
+
+void profile_enter_slow(Chip8Profile *prof, uint16_t site, uint16_t target)
+{
+    // Call edge
+    ProfileEdge *edge = &prof->site_edges[site & (CHIP8_MEM_SIZE - 1)];
+    uint32_t probes = 0;
+    if (edge->count && edge->target != target)
+    {
+        for (uint32_t h = hash_pair(site, target); probes < PROFILE_MAX_EDGES; h++, probes++)
+        {
+            edge = &prof->edges[h & (PROFILE_MAX_EDGES - 1)];
+            if (!edge->count || (edge->site == site && edge->target == target))
+                break;
+        }
+    }
+    if (probes < PROFILE_MAX_EDGES)
+    {
+        edge->site = site;
+        edge->target = target;
+        edge->count++;
+    }
+    else
+        prof->lost_calls++;
+
+    // Child node of the current one, created on first call
+    uint32_t parent = prof->node;
+    ProfileNode *caller = &prof->nodes[parent];
+    if (caller->last_child && caller->last_target == target)
+    {
+        prof->node = caller->last_child - 1;
+        prof->nodes[prof->node].calls++;
+        return;
+    }
+    probes = 0;
+    for (uint32_t h = hash_pair(parent, target); probes < PROFILE_NODE_HASH; h++, probes++)
+    {
+        uint16_t *slot = &prof->node_hash[h & (PROFILE_NODE_HASH - 1)];
+        if (*slot)
+        {
+            ProfileNode *n = &prof->nodes[*slot - 1];
+            if (n->parent != parent || n->entry != target)
+                continue;
+            n->calls++;
+            prof->node = *slot - 1;
+            caller->last_target = target;
+            caller->last_child = *slot;
+            return;
+        }
+        if (prof->node_count == PROFILE_MAX_NODES)
+            break;
+        prof->nodes[prof->node_count] = (ProfileNode){ .parent = (uint16_t)parent, .entry = target, .calls = 1 };
+        *slot = (uint16_t)++prof->node_count;
+        prof->node = prof->node_count - 1;
+        caller->last_target = target;
+        caller->last_child = *slot;
+        return;
+    }
+    prof->lost_calls++;     // Table full: the callee is attributed to the caller (and its 00EE leaves the caller too)
+}
+
+// Ticks per second, measured over the profiled period
+static double tick_rate(const Chip8Profile *prof)
+{
+    double seconds = profile_now() - prof->start_seconds;
+    uint64_t ticks = profile_ticks() - prof->start_ticks;
+    return seconds > 0 && ticks ? ticks / seconds : 1e9;
+}
+
+static const uint64_t *sort_counts;     // qsort context: the counters the indexes refer to
+
+static int by_count_desc(const void *a, const void *b)
+{
+    uint64_t ca = sort_counts[*(const uint32_t *)a], cb = sort_counts[*(const uint32_t *)b];
+    if (ca != cb)
+        return ca < cb ? 1 : -1;
+    return *(const uint32_t *)a < *(const uint32_t *)b ? -1 : 1;
+}
+
+// Fills idx with the indexes of the non-zero counts, sorted by count, returns how many
+static uint32_t sorted_nonzero(const uint64_t *counts, uint32_t n, uint32_t *idx)
+{
+    uint32_t k = 0;
+    for (uint32_t i = 0; i < n; i++)
+        if (counts[i])
+            idx[k++] = i;
+    sort_counts = counts;
+    qsort(idx, k, sizeof(uint32_t), by_count_desc);
+    return k;
+}
+
+bool profile_write_json(const Chip8Profile *prof, const Chip8 *vm, const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+    {
+        log_msg(LOG_ERROR, "Couldn't open file: '%s'", path);
+        return true;
+    }
+    uint64_t total = prof->instructions;
+    double rate = tick_rate(prof);
+    // Timed draws stand for all of them
+    double draw_ns = prof->draw_timed ? prof->draw_ticks / rate * 1e9 * prof->draw_count / prof->draw_timed : 0;
+
+    fprintf(f, "{\n  \"instructions\": %llu,\n  \"decode_misses\": %llu,\n", (unsigned long long)total,
+        (unsigned long long)prof->decode_misses);
+    fprintf(f, "  \"draw\": {\"count\": %llu, \"ns_total\": %.0f, \"ns_mean\": %.2f},\n",
+        (unsigned long long)prof->draw_count, draw_ns, prof->draw_count ? draw_ns / prof->draw_count : 0);
+
+    static uint64_t pc_count[PROFILE_PCS];
+    uint64_t op_count[PROFILE_OPS] = { 0 };
+    profile_pc_counts(prof, pc_count);
+    for (uint32_t pc = 0; pc < PROFILE_PCS; pc++)
+    {
+        if (!pc_count[pc])
+            continue;
+        uint16_t instruction = pc <= CHIP8_MEM_SIZE - 2 ? (uint16_t)(vm->memory[pc] << 8 | vm->memory[pc + 1]) : 0;
+        op_count[chip8_op_class(instruction)] += pc_count[pc];
+    }
+
+    static uint32_t idx[PROFILE_PCS];
+    uint32_t n = sorted_nonzero(op_count, PROFILE_OPS, idx);
+    fprintf(f, "  \"opcodes\": [");
+    for (uint32_t i = 0; i < n; i++)
+        fprintf(f, "%s\n    {\"op\": \"%s\", \"count\": %llu}", i ? "," : "", chip8_op_name(idx[i]),
+            (unsigned long long)op_count[idx[i]]);
+    fprintf(f, "\n  ],\n");
+
+    n = sorted_nonzero(pc_count, PROFILE_PCS, idx);
+    fprintf(f, "  \"hotspots\": [");
+    for (uint32_t i = 0; i < n; i++)
+        fprintf(f, "%s\n    {\"pc\": \"0x%03X\", \"count\": %llu, \"share\": %.6f}", i ? "," : "", idx[i],
+            (unsigned long long)pc_count[idx[i]], total ? (double)pc_count[idx[i]] / total : 0);
+    fprintf(f, "\n  ],\n");
+
+    fprintf(f, "  \"calls\": [");
+    bool first = true;
+    for (int i = 0; i < CHIP8_MEM_SIZE + PROFILE_MAX_EDGES; i++)
+    {
+        const ProfileEdge *e = i < CHIP8_MEM_SIZE ? &prof->site_edges[i] : &prof->edges[i - CHIP8_MEM_SIZE];
+        if (!e->count)
+            continue;
+        fprintf(f, "%s\n    {\"site\": \"0x%03X\", \"target\": \"0x%03X\", \"count\": %llu}", first ? "" : ",",
+            e->site, e->target, (unsigned long long)e->count);
+        first = false;
+    }
+    fprintf(f, "\n  ],\n  \"call_tree_nodes\": %u,\n  \"lost_calls\": %llu\n}\n", prof->node_count,
+        (unsigned long long)prof->lost_calls);
+
+    bool failed = ferror(f) != 0;
+    failed |= fclose(f) != 0;
+    if (failed)
+        log_msg(LOG_ERROR, "Couldn't write profile: '%s'", path);
+    return failed;
+}
+
+bool profile_write_folded(const Chip8Profile *prof, const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+    {
+        log_msg(LOG_ERROR, "Couldn't open file: '%s'", path);
+        return true;
+    }
+    uint16_t chain[PROFILE_MAX_NODES];
+    for (uint32_t i = 0; i < prof->node_count; i++)
+    {
+        uint64_t self = prof->nodes[i].self;
+        if (i == prof->node)
+            self += prof->instructions - prof->mark;    // Not charged yet
+        if (!self)
+            continue;
+        uint32_t depth = 0;
+        for (uint32_t n = i; ; n = prof->nodes[n].parent)
+        {
+            chain[depth++] = prof->nodes[n].entry;
+            if (n == 0)
+                break;
+        }
+        while (depth--)
+            fprintf(f, "0x%03X%s", chain[depth], depth ? ";" : "");
+        fprintf(f, " %llu\n", (unsigned long long)self);
+    }
+    bool failed = ferror(f) != 0;
+    failed |= fclose(f) != 0;
+    if (failed)
+        log_msg(LOG_ERROR, "Couldn't write profile: '%s'", path);
+    return failed;
+}
@@ -0,0 +1,124 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+
+/* Guest profiler, compiled into the interpreter only with -DCHIP8_PROFILE (make PROFILE=1).
+    Attach one to a VM through Chip8.profile; chip8_run then switches to its profiled interpreter instances, which
+    count every executed instruction per pc (and from those per opcode class), record 2NNN call edges and a call
+    tree, and time a sample of Dxyn.
+    There is no per-instruction work: addresses are counted per straight-line run, one decrement where a jump, call,
+    return or skip leaves it and one increment where the next run begins. Call-tree nodes are charged on 2NNN/00EE
+    only, with the instructions executed since the previous call or return.
+    Instructions executed as native JIT blocks are not seen, profile on the interpreter */
+
+#define PROFILE_OPS 64              // Upper bound of handler indexes (see chip8_op_name)
+#define PROFILE_MAX_NODES 4096      // Call-tree nodes (function entry in the context of its callers)
+#define PROFILE_NODE_HASH 8192      // Child lookup slots, power of two
+#define PROFILE_MAX_EDGES 1024      // Distinct (call site, target) pairs, power of two
+#define PROFILE_DRAW_SAMPLE 128     // One Dxyn in this many is timed, power of two
+#define PROFILE_PCS (UINT16_MAX + 1)  // Every value pc can take: past the end of memory the VM fetches 0000
+
+typedef struct {
+    uint16_t parent;        // Caller node (the root is its own parent)
+    uint16_t entry;         // Address the function was entered at
+    uint16_t last_target;   // Most recent callee of this node and its node index + 1 (lookup cache)
+    uint16_t last_child;
+    uint64_t self;          // Instructions executed in this node, excluding callees
+    uint64_t calls;         // Times entered
+} ProfileNode;
+
+typedef struct {
+    uint16_t site;          // Address of the 2NNN
+    uint16_t target;        // NNN
+    uint64_t count;         // 0 = free slot
+} ProfileEdge;
+
+typedef struct Chip8Profile {
+    uint64_t decode_misses;             // Instructions decoded into the cache
+    uint64_t pc_runs[PROFILE_PCS];      // Straight-line runs starting minus ending at each pc, see profile_pc_counts
+    uint64_t leaves;                    // Runs ended, tells a straight-line idle loop from one that branches
+    uint64_t probe_leaves;              // leaves at the last idle probe
+    uint64_t instructions;              // Executed instructions, updated when chip8_run returns
+    uint64_t draw_count;                // Dxyn executed
+    uint64_t draw_timed;                // Dxyn timed (every PROFILE_DRAW_SAMPLE-th)
+    uint64_t draw_ticks;                // profile_ticks() spent inside the timed Dxyn
+    uint64_t mark;                      // Instruction count the current node was last charged up to
+    uint32_t node;                      // Current call-tree node
+    uint32_t node_count;
+    uint64_t lost_calls;                // Calls that didn't fit the node or edge tables
+    ProfileNode nodes[PROFILE_MAX_NODES];
+    uint16_t node_hash[PROFILE_NODE_HASH];  // Node index + 1 keyed by (parent, entry), 0 = free
+    ProfileEdge site_edges[CHIP8_MEM_SIZE]; // Call edges by call site, a 2NNN normally always has the same target
+    ProfileEdge edges[PROFILE_MAX_EDGES];   // Edges from sites whose target changed (self-modifying code)
+    uint64_t start_ticks;               // profile_ticks() and wall time at profile_reset, to convert ticks to time
+    double start_seconds;
+} Chip8Profile;
+
+// Clears all counters, entry is the root function's address (normally the VM's pc)
+void profile_reset(Chip8Profile *prof, uint16_t entry);
+
+/* Turns pc_runs into instructions fetched per address (PROFILE_PCS counts): an address is inside every run that
+    started at or before it, on its side of the even/odd split, and hasn't ended yet. A run that wraps past 0xFFFE
+    starts again at 0 */
+void profile_pc_counts(const Chip8Profile *prof, uint64_t *counts);
+
+// Charges the current node with the instructions up to `now` (the running instruction count)
+static inline void profile_charge(Chip8Profile *prof, uint64_t now)
+{
+    prof->nodes[prof->node].self += now - prof->mark;
+    prof->mark = now;
+}
+
+// Call edge and call-tree lookups for profile_enter when its caches miss
+void profile_enter_slow(Chip8Profile *prof, uint16_t site, uint16_t target);
+
+// Records a 2NNN at site and moves into the callee's node
+static inline void profile_enter(Chip8Profile *prof, uint64_t now, uint16_t site, uint16_t target)
+{
+    profile_charge(prof, now);
+    ProfileEdge *edge = &prof->site_edges[site & (CHIP8_MEM_SIZE - 1)];
+    ProfileNode *caller = &prof->nodes[prof->node];
+    if (edge->count && edge->target == target && caller->last_child && caller->last_target == target)
+    {
+        edge->count++;
+        prof->node = caller->last_child - 1;
+        prof->nodes[prof->node].calls++;
+        return;
+    }
+    profile_enter_slow(prof, site, target);
+}
+
+// Records a 00EE, back to the caller's node
+static inline void profile_leave(Chip8Profile *prof, uint64_t now)
+{
+    profile_charge(prof, now);
+    prof->node = prof->nodes[prof->node].parent;
+}
+
+// Monotonic host time in seconds
+double profile_now(void);
+
+// Cheap timestamp in unspecified units (TSC on x86-64)
+static inline uint64_t profile_ticks(void)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+    return __builtin_ia32_rdtsc();
+#else
+    return (uint64_t)(profile_now() * 1e9);
+#endif
+}
+
+/* Writes the counters as JSON: opcode classes and hot pcs sorted by count, call edges, Dxyn time. An address counts
+    towards the class of the instruction vm holds there now (self-modifying code is classified as it ended up).
+Returns: true if the file can't be written */
+bool profile_write_json(const Chip8Profile *prof, const Chip8 *vm, const char *path);
+
+/* Writes the call tree in folded-stack format ("0x200;0x2A4;0x31C 1234" per line) for flamegraph tools,
+    weighted by instructions.
+Returns: true if the file can't be written */
+bool profile_write_folded(const Chip8Profile *prof, const char *path);
+
+#endif
@@ -0,0 +1,703 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "chip8.h"
+#include "runner.h"
+#include "pool.h"
+#include "movie.h"
+#include "romlib.h"
+#include "logger.h"
+
+/* Golden-image regression runner
+    Runs every entry of a manifest on its own VM, in parallel over the work-stealing pool, and compares the final
+    framebuffer and registers with the golden hashes stored in the manifest. A failing entry prints both hashes,
+    its registers and a visual diff of the display against the golden frame saved next to the manifest.
+    Manifest: one entry per line, blank lines and lines starting with '#' are ignored
+        path frames=N [instructions=N] [ipf=N] [quirks=profile] [keys=frame:mask,...] [display=hash] [regs=hash]
+        - path: the ROM, relative to the manifest's directory unless absolute
+        - frames/instructions: run budget (at least one of them), ipf: instructions per frame (default 8)
+        - quirks: modern, vip, chip48 or schip (default: picked from the ROM like chip8-headless does)
+        - keys: key states (hex masks, bit k = key k) from the start of the given frames on, in frame order
+        - display/regs: golden hashes (hex) of the final framebuffer (chip8_display_hash) and of pc, I, V, sp,
+          the stack, the timers and the PRNG state
+    Program usage: ./chip8-regress [-J] [-u] [-v] [-j threads] manifest
+        -J  execute through the x86-64 JIT (one per worker)
+        -u  regenerate: rewrite the hashes of every entry from this run (comments and order are kept) and save the
+            final frames into <manifest>.golden for later diffs
+        -v  print every entry, not only the failures
+        -j  number of worker threads (default one per core) */
+
+#define REGRESS_GOLDEN_MAGIC "C8GF"
+#define REGRESS_GOLDEN_VERSION 1
+#define REGRESS_GOLDEN_RECORD (8 + CHIP8_DISPLAY_HEIGHT * 8)    // u64 hash and the rows, little-endian
+
+typedef struct {
+    uint64_t frame;     // First frame the mask applies to
+    uint16_t mask;
+} KeyStep;
+
+typedef struct {
+    size_t line;                // Manifest line, rewritten by -u
+    char *path;                 // As written in the manifest
+    char *rom;                  // Resolved against the manifest's directory
+    uint64_t frames, instructions;
+    uint32_t ipf;
+    int quirks;                 // Chip8Quirks, ROMLIB_QUIRKS_AUTO = from the ROM's profile
+    KeyStep *keys;
+    size_t key_count;
+    bool has_golden;
+    uint64_t want_display, want_regs;
+
+    // Outcome, written by the worker
+    bool load_failed;
+    RunResult result;
+    uint64_t regs_hash;
+    uint64_t display[CHIP8_DISPLAY_HEIGHT];
+    uint16_t pc, I;
+    uint8_t V[CHIP8_REGISTER_COUNT];
+    uint8_t sp, delay_timer, sound_timer;
+} Entry;
+
+typedef struct {
+    char **lines;               // Manifest text, without line ends
+    size_t line_count, line_cap;
+    Entry *entries;
+    size_t count, cap;
+} Manifest;
+
+typedef struct {
+    Entry *entries;
+    Chip8Jit *jits;             // One per worker, NULL when interpreting
+} Regress;
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: chip8-regress [-J] [-u] [-v] [-j threads] manifest\n");
+}
+
+// FNV-1a over the register file in a fixed byte order, so hashes don't depend on the struct layout
+static uint64_t register_hash(const Chip8 *vm)
+{
+    uint8_t state[2 + 2 + CHIP8_REGISTER_COUNT + 1 + CHIP8_STACK_SIZE * 2 + 2 + 4];
+    size_t n = 0;
+    state[n++] = (uint8_t)vm->pc;
+    state[n++] = (uint8_t)(vm->pc >> 8);
+    state[n++] = (uint8_t)vm->I;
+    state[n++] = (uint8_t)(vm->I >> 8);
+    memcpy(state + n, vm->V, CHIP8_REGISTER_COUNT);
+    n += CHIP8_REGISTER_COUNT;
+    state[n++] = vm->sp;
+    for (int i = 0; i < CHIP8_STACK_SIZE; i++)
+    {
+        state[n++] = (uint8_t)vm->stack[i];
+        state[n++] = (uint8_t)(vm->stack[i] >> 8);
+    }
+    state[n++] = vm->delay_timer;
+    state[n++] = vm->sound_timer;
+    for (int b = 0; b < 4; b++)
+        state[n++] = (uint8_t)(vm->rng_state >> (b * 8));
+
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < n; i++)
+    {
+        hash ^= state[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+static void regress_job(void *ctx, size_t index, unsigned worker)
+{
+    Regress *r = ctx;
+    Entry *e = &r->entries[index];
+    Chip8 *vm = malloc(sizeof(Chip8));
+    if (!vm || chip8_init(vm) || chip8_load_rom(vm, e->rom))
+    {
+        e->load_failed = true;
+        free(vm);
+        return;
+    }
+    if (e->quirks == ROMLIB_QUIRKS_AUTO)
+    {
+        uint32_t features = romlib_scan_features(vm->memory + CHIP8_PC_START_INDEX, CHIP8_ROM_MAX_SIZE);
+        chip8_set_quirks(vm, romlib_profile_quirks(romlib_guess_profile(features)));
+    }
+    else
+        chip8_set_quirks(vm, (Chip8Quirks)e->quirks);
+
+    RunConfig cfg = {
+        .max_instructions = e->instructions,
+        .max_frames = e->frames,
+        .instructions_per_frame = e->ipf
+    };
+    if (r->jits)
+    {
+        cfg.jit = &r->jits[worker];
+        chip8_jit_flush(cfg.jit);
+    }
+
+    // Scripted keys play as a movie at a constant speed of ipf instructions per frame
+    Movie movie;
+    MoviePlayer player;
+    movie_init(&movie);
+    bool failed = false;
+    if (e->key_count)
+    {
+        uint32_t ips = e->ipf * MOVIE_FRAME_RATE;
+        movie_start(&movie, vm, ips, 0);
+        for (size_t k = 0; k < e->key_count && !failed; k++)
+            failed = movie_record(&movie, e->keys[k].frame * e->ipf, e->keys[k].mask, ips);
+        movie_play_start(&player, &movie, vm);
+        cfg.movie = &player;
+    }
+    if (failed || runner_run(vm, &cfg, &e->result))
+        e->load_failed = true;
+    movie_cleanup(&movie);
+
+    e->regs_hash = register_hash(vm);
+    memcpy(e->display, vm->display, sizeof(e->display));
+    e->pc = vm->pc;
+    e->I = vm->I;
+    memcpy(e->V, vm->V, sizeof(e->V));
+    e->sp = vm->sp;
+    e->delay_timer = vm->delay_timer;
+    e->sound_timer = vm->sound_timer;
+    free(vm);
+}
+
+static bool run_entries(Entry *entries, size_t count, bool use_jit, unsigned threads)
+{
+    Regress r = { .entries = entries };
+    if (use_jit)
+    {
+        r.jits = calloc(threads, sizeof(Chip8Jit));
+        if (!r.jits)
+            return true;
+        for (unsigned i = 0; i < threads; i++)
+        {
+            if (chip8_jit_init(&r.jits[i]))
+            {
+                for (unsigned k = 0; k < i; k++)
+                    chip8_jit_cleanup(&r.jits[k]);
+                free(r.jits);
+                return true;
+            }
+        }
+    }
+
+    bool failed = pool_run(count, threads, regress_job, &r);
+
+    if (r.jits)
+    {
+        for (unsigned i = 0; i < threads; i++)
+            chip8_jit_cleanup(&r.jits[i]);
+        free(r.jits);
+    }
+    return failed;
+}
+
+/* ---- Manifest ---- */
+
+static void manifest_cleanup(Manifest *m)
+{
+    for (size_t i = 0; i < m->line_count; i++)
+        free(m->lines[i]);
+    for (size_t i = 0; i < m->count; i++)
+    {
+        free(m->entries[i].path);
+        free(m->entries[i].rom);
+        free(m->entries[i].keys);
+    }
+    free(m->lines);
+    free(m->entries);
+}
+
+// Parses an unsigned integer in the given base that must fill the whole token, returns true on failure
+static bool parse_number(const char *s, int base, uint64_t *out)
+{
+    char *end = NULL;
+    *out = 0;
+    if (!isxdigit((unsigned char)s[0]))
+        return true;
+    *out = strtoull(s, &end, base);
+    return *end != '\0';
+}
+
+// keys=frame:mask,frame:mask,... in frame order
+static bool parse_keys(Entry *e, const char *s)
+{
+    size_t count = 1;
+    for (const char *c = s; *c; c++)
+        count += *c == ',';
+    e->keys = calloc(count, sizeof(KeyStep));
+    if (!e->keys)
+        return true;
+    char *copy = strdup(s);
+    if (!copy)
+        return true;
+    bool failed = false;
+    char *save = NULL;
+    for (char *tok = strtok_r(copy, ",", &save); tok && !failed; tok = strtok_r(NULL, ",", &save))
+    {
+        char *colon = strchr(tok, ':');
+        uint64_t frame = 0, mask = 0;
+        if (!colon)
+        {
+            failed = true;
+            break;
+        }
+        *colon = '\0';
+        failed = parse_number(tok, 10, &frame) || parse_number(colon + 1, 16, &mask) || mask > 0xFFFF ||
+            (e->key_count && frame < e->keys[e->key_count - 1].frame);
+        e->keys[e->key_count++] = (KeyStep){ .frame = frame, .mask = (uint16_t)mask };
+    }
+    free(copy);
+    return failed || !e->key_count;
+}
+
+// Resolves a manifest path against the manifest's directory
+static char *resolve_path(const char *manifest, const char *path)
+{
+    const char *slash = strrchr(manifest, '/');
+    size_t dir = path[0] == '/' || !slash ? 0 : (size_t)(slash - manifest) + 1;
+    char *out = malloc(dir + strlen(path) + 1);
+    if (out)
+    {
+        memcpy(out, manifest, dir);
+        strcpy(out + dir, path);
+    }
+    return out;
+}
+
+static bool parse_entry(Entry *e, const char *manifest, char *text)
+{
+    char *save = NULL;
+    char *path = strtok_r(text, " \t", &save);
+    e->path = strdup(path);
+    e->rom = resolve_path(manifest, path);
+    e->ipf = RUNNER_DEFAULT_IPF;
+    e->quirks = ROMLIB_QUIRKS_AUTO;
+    if (!e->path || !e->rom)
+        return true;
+
+    bool has_display = false, has_regs = false;
+    for (char *tok = strtok_r(NULL, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save))
+    {
+        char *value = strchr(tok, '=');
+        if (!value)
+            return true;
+        *value++ = '\0';
+        uint64_t v;
+        bool failed;
+        if (!strcmp(tok, "frames"))
+            failed = parse_number(value, 10, &e->frames);
+        else if (!strcmp(tok, "instructions"))
+            failed = parse_number(value, 10, &e->instructions);
+        else if (!strcmp(tok, "ipf"))
+        {
+            failed = parse_number(value, 10, &v) || v == 0 || v > UINT32_MAX / MOVIE_FRAME_RATE;
+            e->ipf = (uint32_t)v;
+        }
+        else if (!strcmp(tok, "quirks"))
+        {
+            Chip8Quirks quirks;
+            failed = chip8_parse_quirks(value, &quirks);
+            e->quirks = quirks;
+        }
+        else if (!strcmp(tok, "keys"))
+            failed = parse_keys(e, value);
+        else if (!strcmp(tok, "display"))
+            failed = !(has_display = !parse_number(value, 16, &e->want_display));
+        else if (!strcmp(tok, "regs"))
+            failed = !(has_regs = !parse_number(value, 16, &e->want_regs));
+        else
+            failed = true;
+        if (failed)
+            return true;
+    }
+    e->has_golden = has_display && has_regs;
+    return !e->frames && !e->instructions;
+}
+
+/* Reads the manifest, keeping its text for -u.
+Returns: true on I/O errors or a malformed entry (reported with its line number) */
+static bool manifest_read(Manifest *m, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        log_msg(LOG_ERROR, "Couldn't open manifest: '%s'", path);
+        return true;
+    }
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    bool failed = false;
+    while (!failed && (len = getline(&line, &size, f)) >= 0)
+    {
+        while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (m->line_count == m->line_cap)
+        {
+            size_t cap = m->line_cap ? m->line_cap * 2 : 256;
+            char **lines = realloc(m->lines, cap * sizeof(char *));
+            if (!lines)
+            {
+                failed = true;
+                break;
+            }
+            m->lines = lines;
+            m->line_cap = cap;
+        }
+        if (!(m->lines[m->line_count] = strdup(line)))
+        {
+            failed = true;
+            break;
+        }
+        m->line_count++;
+
+        const char *text = line + strspn(line, " \t");
+        if (!*text || *text == '#')
+            continue;
+        if (m->count == m->cap)
+        {
+            size_t cap = m->cap ? m->cap * 2 : 256;
+            Entry *entries = realloc(m->entries, cap * sizeof(Entry));
+            if (!entries)
+            {
+                failed = true;
+                break;
+            }
+            m->entries = entries;
+            m->cap = cap;
+        }
+        Entry *e = &m->entries[m->count++];
+        memset(e, 0, sizeof(*e));
+        e->line = m->line_count - 1;
+        if (parse_entry(e, path, line))
+        {
+            log_msg(LOG_ERROR, "%s:%zu: malformed entry", path, e->line + 1);
+            failed = true;
+        }
+    }
+    if (ferror(f))
+        failed = true;
+    free(line);
+    fclose(f);
+    return failed;
+}
+
+// Rewrites every entry line of the manifest with the hashes of this run (atomically, through a temporary file)
+static bool manifest_update(const Manifest *m, const char *path)
+{
+    size_t len = strlen(path);
+    char *tmp = malloc(len + 5);
+    if (!tmp)
+        return true;
+    memcpy(tmp, path, len);
+    strcpy(tmp + len, ".tmp");
+    FILE *f = fopen(tmp, "w");
+    if (!f)
+    {
+        log_msg(LOG_ERROR, "Couldn't write '%s'", tmp);
+        free(tmp);
+        return true;
+    }
+
+    size_t next = 0;    // Next entry, in line order
+    for (size_t i = 0; i < m->line_count; i++)
+    {
+        const Entry *e = next < m->count && m->entries[next].line == i ? &m->entries[next++] : NULL;
+        if (!e || e->load_failed)
+        {
+            fprintf(f, "%s\n", m->lines[i]);
+            continue;
+        }
+        fprintf(f, "%s", e->path);
+        if (e->frames)
+            fprintf(f, " frames=%llu", (unsigned long long)e->frames);
+        if (e->instructions)
+            fprintf(f, " instructions=%llu", (unsigned long long)e->instructions);
+        if (e->ipf != RUNNER_DEFAULT_IPF)
+            fprintf(f, " ipf=%u", e->ipf);
+        if (e->quirks != ROMLIB_QUIRKS_AUTO)
+            fprintf(f, " quirks=%s", chip8_quirks_name((uint8_t)e->quirks));
+        for (size_t k = 0; k < e->key_count; k++)
+            fprintf(f, "%s%llu:%04X", k ? "," : " keys=", (unsigned long long)e->keys[k].frame, e->keys[k].mask);
+        fprintf(f, " display=%016llX regs=%016llX\n", (unsigned long long)e->result.display_hash,
+            (unsigned long long)e->regs_hash);
+    }
+    bool failed = ferror(f) != 0;
+    failed |= fclose(f) != 0;
+    if (failed || rename(tmp, path))
+    {
+        log_msg(LOG_ERROR, "Couldn't write '%s'", path);
+        remove(tmp);
+        failed = true;
+    }
+    free(tmp);
+    return failed;
+}
+
+/* ---- Golden frames: <manifest>.golden, the final display of every entry keyed by its hash ---- */
+
+static char *golden_path(const char *manifest)
+{
+    size_t len = strlen(manifest);
+    char *path = malloc(len + 8);
+    if (path)
+    {
+        memcpy(path, manifest, len);
+        strcpy(path + len, ".golden");
+    }
+    return path;
+}
+
+static void put_u64(uint8_t *p, uint64_t v)
+{
+    for (int b = 0; b < 8; b++)
+        p[b] = (uint8_t)(v >> (b * 8));
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int b = 0; b < 8; b++)
+        v |= (uint64_t)p[b] << (b * 8);
+    return v;
+}
+
+static bool golden_write(const Manifest *m, const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f)
+    {
+        log_msg(LOG_ERROR, "Couldn't write '%s'", path);
+        return true;
+    }
+    uint8_t header[12] = { 0 };
+    memcpy(header, REGRESS_GOLDEN_MAGIC, 4);
+    header[4] = REGRESS_GOLDEN_VERSION;
+    uint32_t count = 0;
+    for (size_t i = 0; i < m->count; i++)
+        count += !m->entries[i].load_failed;
+    for (int b = 0; b < 4; b++)
+        header[8 + b] = (uint8_t)(count >> (b * 8));
+    bool failed = fwrite(header, 1, sizeof(header), f) != sizeof(header);
+    for (size_t i = 0; i < m->count && !failed; i++)
+    {
+        const Entry *e = &m->entries[i];
+        if (e->load_failed)
+            continue;
+        uint8_t record[REGRESS_GOLDEN_RECORD];
+        put_u64(record, e->result.display_hash);
+        for (int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++)
+            put_u64(record + 8 + y * 8, e->display[y]);
+        failed = fwrite(record, 1, sizeof(record), f) != sizeof(record);
+    }
+    failed |= fclose(f) != 0;
+    if (failed)
+        log_msg(LOG_ERROR, "Couldn't write '%s'", path);
+    return failed;
+}
+
+/* Loads the golden frames file whole, returns the record count (0 if it's missing or malformed, the report then
+    shows the frames without a diff) */
+static size_t golden_read(const char *path, uint8_t **out)
+{
+    *out = NULL;
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return 0;
+    uint8_t header[12];
+    size_t count = 0;
+    if (fread(header, 1, sizeof(header), f) == sizeof(header) && !memcmp(header, REGRESS_GOLDEN_MAGIC, 4) &&
+        header[4] == REGRESS_GOLDEN_VERSION)
+    {
+        count = header[8] | header[9] << 8 | header[10] << 16 | (size_t)header[11] << 24;
+        *out = malloc(count * REGRESS_GOLDEN_RECORD + 1);
+        if (!*out || fread(*out, REGRESS_GOLDEN_RECORD, count, f) != count)
+        {
+            log_msg(LOG_WARN, "'%s' is truncated, displays are shown without a diff", path);
+            free(*out);
+            *out = NULL;
+            count = 0;
+        }
+    }
+    fclose(f);
+    return count;
+}
+
+static bool golden_find(const uint8_t *golden, size_t count, uint64_t hash, uint64_t display[CHIP8_DISPLAY_HEIGHT])
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8_t *record = golden + i * REGRESS_GOLDEN_RECORD;
+        if (get_u64(record) != hash)
+            continue;
+        for (int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++)
+            display[y] = get_u64(record + 8 + y * 8);
+        return true;
+    }
+    return false;
+}
+
+/* ---- Report ---- */
+
+/* Draws the display, against the golden frame when there is one:
+    '#' lit in both, '+' lit only in this run, '-' lit only in the golden frame */
+static void print_display(const uint64_t *got, const uint64_t *want)
+{
+    for (int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++)
+    {
+        char row[CHIP8_DISPLAY_WIDTH + 1];
+        for (int x = 0; x < CHIP8_DISPLAY_WIDTH; x++)
+        {
+            unsigned g = (got[y] >> (63 - x)) & 1u;
+            unsigned w = want ? (want[y] >> (63 - x)) & 1u : g;
+            row[x] = g && w ? '#' : g ? '+' : w ? '-' : '.';
+        }
+        row[CHIP8_DISPLAY_WIDTH] = '\0';
+        printf("    %2d %s%s\n", y, row, want && got[y] != want[y] ? " <" : "");
+    }
+}
+
+static void print_failure(const Entry *e, const uint8_t *golden, size_t golden_count)
+{
+    if (e->load_failed)
+    {
+        printf("FAIL %s (line %zu): couldn't run the ROM\n", e->path, e->line + 1);
+        return;
+    }
+    if (!e->has_golden)
+    {
+        printf("FAIL %s (line %zu): no golden hashes, regenerate with -u\n", e->path, e->line + 1);
+        return;
+    }
+    printf("FAIL %s (line %zu)%s\n", e->path, e->line + 1,
+        e->result.exit == RUN_EXIT_VM_ERROR ? ": stopped on an invalid instruction" : "");
+    printf("  display: expected %016llX, got %016llX\n", (unsigned long long)e->want_display,
+        (unsigned long long)e->result.display_hash);
+    printf("  regs:    expected %016llX, got %016llX\n", (unsigned long long)e->want_regs,
+        (unsigned long long)e->regs_hash);
+    printf("  pc=%03X I=%03X sp=%u dt=%u st=%u V=", e->pc, e->I, e->sp, e->delay_timer, e->sound_timer);
+    for (int i = 0; i < CHIP8_REGISTER_COUNT; i++)
+        printf("%02X", e->V[i]);
+    printf("  (%llu instructions, %llu frames)\n", (unsigned long long)e->result.instructions,
+        (unsigned long long)e->result.frames);
+    if (e->result.display_hash == e->want_display)
+        return;
+    uint64_t want[CHIP8_DISPLAY_HEIGHT];
+    if (golden_find(golden, golden_count, e->want_display, want))
+    {
+        printf("  display diff ('+' lit only in this run, '-' lit only in the golden frame, '<' rows differ):\n");
+        print_display(e->display, want);
+    }
+    else
+    {
+        printf("  display (no golden frame for the expected hash):\n");
+        print_display(e->display, NULL);
+    }
+}
+
+static bool entry_passed(const Entry *e)
+{
+    return !e->load_failed && e->has_golden && e->result.display_hash == e->want_display &&
+        e->regs_hash == e->want_regs;
+}
+
+int main(int argc, char *argv[])
+{
+    bool use_jit = false;
+    bool update = false;
+    bool verbose = false;
+    unsigned threads = pool_default_threads();
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++)    // Read options
+    {
+        if (!strcmp(argv[i], "-J"))
+            use_jit = true;
+        else if (!strcmp(argv[i], "-u"))
+            update = true;
+        else if (!strcmp(argv[i], "-v"))
+            verbose = true;
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            threads = (unsigned)atoi(argv[++i]);
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    if (i + 1 != argc)
+    {
+        usage();
+        return 1;
+    }
+    const char *path = argv[i];
+
+    Manifest m = { 0 };
+    if (manifest_read(&m, path))
+    {
+        manifest_cleanup(&m);
+        return 1;
+    }
+
+    double start = runner_now();
+    if (run_entries(m.entries, m.count, use_jit, threads))
+    {
+        log_msg(LOG_ERROR, "Couldn't start the workers");
+        manifest_cleanup(&m);
+        return 1;
+    }
+    double seconds = runner_now() - start;
+
+    // Report in manifest order
+    char *golden_file = golden_path(path);
+    uint8_t *golden = NULL;
+    size_t golden_count = update || !golden_file ? 0 : golden_read(golden_file, &golden);
+    size_t passed = 0, load_failed = 0;
+    uint64_t instructions = 0;
+    for (size_t k = 0; k < m.count; k++)
+    {
+        const Entry *e = &m.entries[k];
+        instructions += e->result.instructions;
+        load_failed += e->load_failed;
+        if (update)
+        {
+            if (e->load_failed)
+                printf("FAIL %s (line %zu): couldn't run the ROM, entry left as is\n", e->path, e->line + 1);
+            else if (verbose)
+                printf("%-7s %s\n", !e->has_golden ? "new" : entry_passed(e) ? "same" : "changed", e->path);
+            continue;
+        }
+        if (entry_passed(e))
+        {
+            passed++;
+            if (verbose)
+                printf("ok   %s\n", e->path);
+        }
+        else
+            print_failure(e, golden, golden_count);
+    }
+
+    int status;
+    if (update)
+    {
+        status = manifest_update(&m, path) || !golden_file || golden_write(&m, golden_file) || load_failed;
+        printf("%zu entries regenerated, %zu failed to run, %.3fs (%.1f M instructions/s)\n", m.count - load_failed,
+            load_failed, seconds, seconds > 0 ? instructions / seconds / 1e6 : 0.0);
+    }
+    else
+    {
+        status = passed != m.count;
+        printf("%zu entries: %zu passed, %zu failed, %.3fs (%.1f M instructions/s)\n", m.count, passed,
+            m.count - passed, seconds, seconds > 0 ? instructions / seconds / 1e6 : 0.0);
+    }
+    free(golden);
+    free(golden_file);
+    manifest_cleanup(&m);
+    return status;
+}
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+#include "savestate.h"
+#include "trace.h"
+#include "logger.h"
+
+/* Trace replay verifier
+    Restores the VM state saved in a trace header, re-executes every instruction record through chip8_cycle
+    (ticking the timers and applying key changes at frame records) and compares what each instruction changed
+    with the recorded delta. Stops at the first divergence and prints the instruction, its pc and opcode and
+    both records
+    Program usage: ./chip8-replay [-d] trace
+        -d  also print every record, with its instruction number, frame, pc and opcode */
+
+#define REPLAY_BUFFER (1u << 20)
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: chip8-replay [-d] trace\n");
+}
+
+// Streaming reader: keeps at least TRACE_RECORD_MAX bytes available while the file has them
+typedef struct {
+    FILE *f;
+    uint8_t buf[REPLAY_BUFFER];
+    size_t pos, len;
+    bool eof;
+} Reader;
+
+static const uint8_t *reader_peek(Reader *r, size_t *avail)
+{
+    if (r->len - r->pos < TRACE_RECORD_MAX && !r->eof)
+    {
+        memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+        r->len -= r->pos;
+        r->pos = 0;
+        size_t n = fread(r->buf + r->len, 1, REPLAY_BUFFER - r->len, r->f);
+        r->len += n;
+        if (n == 0)
+            r->eof = true;
+    }
+    *avail = r->len - r->pos;
+    return r->buf + r->pos;
+}
+
+static void print_divergence(uint64_t n, uint64_t frame, const TraceSnap *s, const TraceRecord *want,
+    const TraceRecord *got)
+{
+    char a[512], b[512];
+    trace_format(want, a, sizeof(a));
+    trace_format(got, b, sizeof(b));
+    printf("divergence at instruction %llu (frame %llu): pc=%03X opcode=%04X\n", (unsigned long long)n,
+        (unsigned long long)frame, s->pc, s->opcode);
+    printf("  trace: %s\n", a + (a[0] == ' '));
+    printf("  replay: %s\n", b + (b[0] == ' '));
+}
+
+int main(int argc, char *argv[])
+{
+    bool dump = false;
+    int i = 1;
+    if (i < argc && !strcmp(argv[i], "-d"))
+    {
+        dump = true;
+        i++;
+    }
+    if (i + 1 != argc)
+    {
+        usage();
+        return 1;
+    }
+    const char *path = argv[i];
+
+    static Reader r;
+    static Chip8 vm;
+    r.f = fopen(path, "rb");
+    if (!r.f)
+    {
+        log_msg(LOG_ERROR, "Couldn't open file: '%s'", path);
+        return 1;
+    }
+    uint8_t header[TRACE_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), r.f) != sizeof(header) || memcmp(header, TRACE_MAGIC, 4) ||
+        header[4] != TRACE_VERSION || chip8_init(&vm) || savestate_load(&vm, header + 8, SAVESTATE_SIZE))
+    {
+        log_msg(LOG_ERROR, "'%s' isn't a version %d trace", path, TRACE_VERSION);
+        fclose(r.f);
+        return 1;
+    }
+    chip8_set_key_mask(&vm, (uint16_t)(header[8 + SAVESTATE_SIZE] | header[9 + SAVESTATE_SIZE] << 8));
+    chip8_set_quirks(&vm, header[5]);
+
+    uint64_t instructions = 0, frames = 0;
+    bool faulted = false;       // The last replayed instruction failed
+    TraceSnap s = { 0 };
+    int status = 1;
+    for (;;)
+    {
+        size_t avail;
+        const uint8_t *in = reader_peek(&r, &avail);
+        TraceRecord want;
+        size_t len = trace_decode(in, avail, &want);
+        if (!len)
+        {
+            printf("trace ends without an end record after %llu instructions (%s)\n",
+                (unsigned long long)instructions, r.eof && avail < TRACE_RECORD_MAX ? "cut short" : "corrupt record");
+            break;
+        }
+        r.pos += len;
+
+        if (want.tag == TRACE_EV_FAULT)
+        {
+            if (!faulted)
+            {
+                printf("divergence after instruction %llu (frame %llu): the trace faults, the replay doesn't\n",
+                    (unsigned long long)instructions, (unsigned long long)frames);
+                break;
+            }
+            faulted = false;
+            if (dump)
+                printf("%10s %6llu  fault\n", "", (unsigned long long)frames);
+            continue;
+        }
+        if (faulted)
+        {
+            printf("divergence after instruction %llu (frame %llu): the replay faults, the trace doesn't\n",
+                (unsigned long long)instructions, (unsigned long long)frames);
+            break;
+        }
+        if (want.tag == TRACE_EV_END)
+        {
+            if (want.instructions != instructions || want.frames != frames)
+            {
+                printf("trace claims %llu instructions and %llu frames, replayed %llu and %llu\n",
+                    (unsigned long long)want.instructions, (unsigned long long)want.frames,
+                    (unsigned long long)instructions, (unsigned long long)frames);
+                break;
+            }
+            printf("trace: %s\n  %llu instructions over %llu frames replayed, no divergence\n", path,
+                (unsigned long long)instructions, (unsigned long long)frames);
+            printf("  pc=%03X I=%03X sp=%u dt=%u st=%u display hash: %016llX\n", vm.pc, vm.I, vm.sp,
+                vm.delay_timer, vm.sound_timer, (unsigned long long)chip8_display_hash(&vm));
+            status = 0;
+            break;
+        }
+        if (want.tag & TRACE_EVENT)
+        {
+            chip8_tick_timers(&vm);
+            if (want.tag == TRACE_EV_KEYS)
+                chip8_set_key_mask(&vm, want.keys);
+            frames++;
+            if (dump)
+            {
+                char text[64];
+                trace_format(&want, text, sizeof(text));
+                printf("%10s %6llu  %s\n", "", (unsigned long long)frames, text);
+            }
+            continue;
+        }
+
+        // Instruction: run it and encode what it did the same way the recorder did
+        trace_snap(&s, &vm);
+        faulted = chip8_cycle(&vm);
+        uint8_t got_bytes[TRACE_RECORD_MAX];
+        size_t got_len = trace_encode(got_bytes, &s, &vm);
+        if (dump)
+        {
+            char text[512];
+            trace_format(&want, text, sizeof(text));
+            printf("%10llu %6llu  %03X %04X %s\n", (unsigned long long)instructions, (unsigned long long)frames,
+                s.pc, s.opcode, text);
+        }
+        if (got_len != len || memcmp(got_bytes, in, len))
+        {
+            TraceRecord got;
+            trace_decode(got_bytes, got_len, &got);
+            print_divergence(instructions, frames, &s, &want, &got);
+            break;
+        }
+        instructions++;
+    }
+    fclose(r.f);
+    return status;
+}
@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rewind.h"
+#include "logger.h"
+
+/*
+    rewind.c keeps the frame history for rewinding:
+    - A delta is the XOR of two consecutive images, run-length encoded as tokens of
+      [u16 equal bytes to skip][u16 literal length][literal XOR bytes]
+    - A frame where nothing changed costs an entry and no delta bytes
+    - Pushing compares the VM's memory in place and patches only the changed bytes of the newest image,
+      so recording a frame never copies the whole state
+    - Deltas live back to back in a circular byte buffer, a delta never wraps (the tail bytes are skipped instead)
+*/
+
+#define REWIND_MIN_GAP 4    // Equal bytes needed to end a literal, shorter runs are cheaper to keep in it
+
+_Static_assert(SAVESTATE_SIZE <= UINT16_MAX, "delta tokens use 16-bit lengths");
+
+bool rewind_init(Rewind *r, size_t bytes, size_t frames)
+{
+    *r = (Rewind){0};
+    if (bytes < REWIND_MAX_DELTA)
+        bytes = REWIND_MAX_DELTA;
+    if (frames == 0)
+        frames = 1;
+    r->data = malloc(bytes);
+    r->entries = malloc(frames * sizeof(RewindEntry));
+    if (!r->data || !r->entries)
+    {
+        log_msg(LOG_ERROR, "couldn't allocate the rewind buffer");
+        rewind_cleanup(r);
+        return true;
+    }
+    r->capacity = bytes;
+    r->max_entries = frames;
+    return false;
+}
+
+void rewind_cleanup(Rewind *r)
+{
+    free(r->data);
+    free(r->entries);
+    *r = (Rewind){0};
+}
+
+void rewind_clear(Rewind *r)
+{
+    r->head = r->used = r->first = r->count = 0;
+    r->has_current = false;
+}
+
+// Returns the first offset >= pos where a and b differ, len if none
+static size_t next_diff(const uint8_t *a, const uint8_t *b, size_t len, size_t pos)
+{
+    for (; pos + 32 <= len; pos += 32)  // 32 bytes per test, most of an image is unchanged memory
+    {
+        uint64_t wa[4], wb[4], diff = 0;
+        memcpy(wa, a + pos, 32);
+        memcpy(wb, b + pos, 32);
+        for (int i = 0; i < 4; i++)
+            diff |= wa[i] ^ wb[i];
+        if (diff)
+            break;
+    }
+    while (pos < len && a[pos] == b[pos])
+        pos++;
+    return pos;
+}
+
+typedef struct {
+    uint8_t *out;
+    size_t length;  // Bytes written to out
+    size_t last;    // Image offset the next token's skip counts from
+} DeltaEncoder;
+
+/* Appends the tokens for image bytes [start, start + len), prev holding the old image and
+    cur the new bytes of that range only */
+static void encode_range(DeltaEncoder *e, const uint8_t *prev, const uint8_t *cur, size_t start, size_t len)
+{
+    prev += start;
+    for (size_t pos = next_diff(prev, cur, len, 0); pos < len; pos = next_diff(prev, cur, len, pos))
+    {
+        size_t end = pos + 1;
+        for (size_t i = end, equal = 0; i < len && equal < REWIND_MIN_GAP; i++)
+        {
+            if (prev[i] != cur[i])
+            {
+                end = i + 1;
+                equal = 0;
+            }
+            else
+                equal++;
+        }
+        uint16_t skip = (uint16_t)(start + pos - e->last), literal = (uint16_t)(end - pos);
+        memcpy(e->out + e->length, &skip, 2);
+        memcpy(e->out + e->length + 2, &literal, 2);
+        e->length += 4;
+        for (size_t i = pos; i < end; i++)
+            e->out[e->length++] = prev[i] ^ cur[i];
+        e->last = start + end;
+        pos = end;
+    }
+}
+
+// XORs an encoded delta into image
+static void apply_delta(uint8_t *image, const uint8_t *delta, size_t length)
+{
+    size_t pos = 0;
+    for (size_t n = 0; n < length;)
+    {
+        uint16_t skip, len;
+        memcpy(&skip, delta + n, 2);
+        memcpy(&len, delta + n + 2, 2);
+        n += 4;
+        pos += skip;
+        for (uint16_t i = 0; i < len; i++)
+            image[pos++] ^= delta[n++];
+    }
+}
+
+static void drop_oldest(Rewind *r)
+{
+    r->used -= r->entries[r->first].span;
+    r->first = (r->first + 1) % r->max_entries;
+    if (--r->count == 0)
+        r->head = r->used = 0;
+}
+
+// Removes the newest entry and rewinds head to where it was written
+static RewindEntry pop_newest(Rewind *r)
+{
+    RewindEntry e = r->entries[(r->first + r->count - 1) % r->max_entries];
+    r->used -= e.span;
+    r->head = (e.offset + r->capacity - (e.span - e.length)) % r->capacity;
+    if (--r->count == 0)
+        r->head = r->used = 0;
+    return e;
+}
+
+// Appends a delta, evicting the oldest entries until it fits
+static void store(Rewind *r, const uint8_t *delta, size_t length)
+{
+    if (r->count == r->max_entries)
+        drop_oldest(r);
+    size_t skipped;
+    for (;;)
+    {
+        skipped = r->head + length > r->capacity ? r->capacity - r->head : 0;
+        if (!r->count || skipped + length <= r->capacity - r->used)
+            break;
+        drop_oldest(r);
+    }
+
+    RewindEntry e = { .offset = (uint32_t)((r->head + skipped) % r->capacity), .length = (uint32_t)length,
+                      .span = (uint32_t)(skipped + length) };
+    memcpy(r->data + e.offset, delta, length);
+    r->head = (e.offset + length) % r->capacity;
+    r->used += e.span;
+    r->entries[(r->first + r->count) % r->max_entries] = e;
+    r->count++;
+}
+
+void rewind_push(Rewind *r, const Chip8 *p)
+{
+    if (!r->has_current)
+    {
+        savestate_save(p, r->current);
+        r->has_current = true;
+        return;
+    }
+    savestate_save_header(p, r->header);
+    DeltaEncoder e = { .out = r->delta };
+    encode_range(&e, r->current, r->header, 0, SAVESTATE_MEMORY_OFFSET);
+    encode_range(&e, r->current, p->memory, SAVESTATE_MEMORY_OFFSET, CHIP8_MEM_SIZE);
+    store(r, r->delta, e.length);
+    apply_delta(r->current, r->delta, e.length);
+}
+
+bool rewind_step_back(Rewind *r, Chip8 *p, size_t frames)
+{
+    if (!r->has_current)
+        return true;
+    for (; frames && r->count; frames--)
+    {
+        RewindEntry e = pop_newest(r);
+        apply_delta(r->current, r->data + e.offset, e.length);
+    }
+    return savestate_load(p, r->current, SAVESTATE_SIZE);
+}
@@ -0,0 +1,54 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+#include "savestate.h"
+
+/* Rewind history: one savestate per host frame, stored as XOR deltas against the previous frame.
+    Only the newest image is kept whole; stepping back XORs the newest delta out of it, so no keyframes are needed
+    and the oldest frames are simply dropped when the byte or frame limit is reached */
+
+#define REWIND_DEFAULT_BYTES (8u << 20)         // Delta storage of the SDL frontend's rewind buffer
+#define REWIND_DEFAULT_FRAMES (60u * 60 * 10)   // Ten minutes at 60 frames per second
+#define REWIND_MAX_DELTA (SAVESTATE_SIZE + 8)   // Worst-case encoded delta: tokens cover their 4 header bytes, plus one split
+
+typedef struct {
+    uint32_t offset;    // Start of the encoded delta in data
+    uint32_t length;    // Encoded delta bytes
+    uint32_t span;      // length plus the unused bytes skipped at the end of data before it, freed with it
+} RewindEntry;
+
+typedef struct {
+    uint8_t *data;          // Circular delta storage
+    size_t capacity;
+    size_t head;            // Next write offset in data
+    size_t used;            // Bytes held by live entries (spans)
+    RewindEntry *entries;   // Circular entry list, oldest at first
+    size_t max_entries;
+    size_t first;
+    size_t count;           // Deltas held, i.e. frames that can be stepped back
+    bool has_current;
+    uint8_t current[SAVESTATE_SIZE];    // Newest snapshot
+    uint8_t header[SAVESTATE_MEMORY_OFFSET];    // rewind_push scratch: serialized registers and display
+    uint8_t delta[REWIND_MAX_DELTA];            // rewind_push scratch: encoded delta
+} Rewind;
+
+// Allocates a history of at most `bytes` of delta storage and `frames` steps. Returns true on failure
+bool rewind_init(Rewind *r, size_t bytes, size_t frames);
+void rewind_cleanup(Rewind *r);
+
+// Drops all history
+void rewind_clear(Rewind *r);
+
+// Records p as the newest snapshot
+void rewind_push(Rewind *r, const Chip8 *p);
+
+/* Discards the newest `frames` snapshots and restores p to the one before them (clamped to the oldest held).
+    frames = 0 restores the newest snapshot.
+Returns: true if nothing has been recorded */
+bool rewind_step_back(Rewind *r, Chip8 *p, size_t frames);
+
+#endif
@@ -0,0 +1,658 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "romlib.h"
+#include "logger.h"
+
+/*
+    romlib.c builds the ROM library:
+    - Content dedup through an open-addressing table keyed by (hash, size)
+    - Directory walks, sidecar index lookups, pack mapping and writing
+    - Packs and indexes are little-endian / plain text so they move between hosts
+*/
+
+// Pack layout (version 1): header, ROM records, path records, names, ROM contents. Offsets are from the file start
+#define PACK_HEADER 16      // magic, version, rom_count, path_count
+#define PACK_ROM 24         // hash u64, size u32, offset u32, features u32, profile u8, 3 spare bytes
+#define PACK_PATH 12        // rom u32, name offset u32, name length u32
+
+#define INDEX_HEADER "# chip8 rom index v1"
+
+struct RomIndexRecord {
+    char *path;             // NULL = free slot
+    int64_t mtime;
+    uint64_t hash;
+    uint32_t size;
+    uint32_t features;
+};
+
+static void put32(uint8_t *b, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        b[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void put64(uint8_t *b, uint64_t v)
+{
+    put32(b, (uint32_t)v);
+    put32(b + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t get32(const uint8_t *b)
+{
+    return b[0] | b[1] << 8 | b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+static uint64_t get64(const uint8_t *b)
+{
+    return get32(b) | (uint64_t)get32(b + 4) << 32;
+}
+
+static uint64_t fnv1a(const void *data, size_t len)
+{
+    const uint8_t *b = data;
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= b[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// Features of a single instruction
+static uint8_t op_features(uint16_t op)
+{
+    uint8_t features = 0;
+    uint8_t low = op & 0xFF;
+    switch (op >> 12)
+    {
+        case 0x0:
+            if ((op & 0xFFF0) == 0x00C0 || (op >= 0x00FB && op <= 0x00FF))
+                features |= ROM_FEAT_SCHIP;
+            break;
+        case 0x5:
+            if ((op & 0xF) == 2 || (op & 0xF) == 3)
+                features |= ROM_FEAT_XOCHIP;
+            break;
+        case 0x8:
+            if ((op & 0xF) == 0x6 || (op & 0xF) == 0xE)
+                features |= ROM_FEAT_SHIFT;
+            if ((op & 0xF) >= 0x1 && (op & 0xF) <= 0x3)
+                features |= ROM_FEAT_LOGIC;
+            break;
+        case 0xB:
+            features |= ROM_FEAT_JUMP0;
+            break;
+        case 0xD:
+            features |= ROM_FEAT_DRAW;
+            break;
+        case 0xF:
+            if (op == 0xF000 || op == 0xF002 || low == 0x01 || low == 0x3A)
+                features |= ROM_FEAT_XOCHIP;
+            else if (low == 0x30 || low == 0x75 || low == 0x85)
+                features |= ROM_FEAT_SCHIP;
+            else if (low == 0x55 || low == 0x65)
+                features |= ROM_FEAT_LOADSTORE;
+            else if (low == 0x0A)
+                features |= ROM_FEAT_KEYWAIT;
+            break;
+    }
+    return features;
+}
+
+static uint8_t feature_table[0x10000];     // op_features of every instruction, filled once
+static pthread_once_t feature_once = PTHREAD_ONCE_INIT;
+
+static void fill_feature_table(void)
+{
+    for (uint32_t op = 0; op < 0x10000; op++)
+        feature_table[op] = op_features((uint16_t)op);
+}
+
+uint32_t romlib_scan_features(const uint8_t *rom, size_t size)
+{
+    pthread_once(&feature_once, fill_feature_table);
+    uint32_t features = 0;
+    for (size_t i = 0; i + 1 < size; i += 2)
+        features |= feature_table[rom[i] << 8 | rom[i + 1]];
+    return features;
+}
+
+RomProfile romlib_guess_profile(uint32_t features)
+{
+    if (features & ROM_FEAT_XOCHIP)
+        return ROM_PROFILE_XOCHIP;
+    if (features & ROM_FEAT_SCHIP)
+        return ROM_PROFILE_SCHIP;
+    return ROM_PROFILE_CHIP8;
+}
+
+const char *romlib_profile_name(uint8_t profile)
+{
+    switch (profile)
+    {
+        case ROM_PROFILE_CHIP8:  return "chip8";
+        case ROM_PROFILE_SCHIP:  return "schip";
+        case ROM_PROFILE_XOCHIP: return "xochip";
+        default:                 return "unknown";
+    }
+}
+
+Chip8Quirks romlib_profile_quirks(uint8_t profile)
+{
+    return profile == ROM_PROFILE_SCHIP ? CHIP8_QUIRKS_SCHIP : CHIP8_QUIRKS_MODERN;
+}
+
+void romlib_init(RomLib *lib)
+{
+    *lib = (RomLib){ .quirks = ROMLIB_QUIRKS_AUTO, .fuse = true };
+}
+
+void romlib_cleanup(RomLib *lib)
+{
+    for (size_t i = 0; i < lib->path_count; i++)
+        free(lib->paths[i].name);
+    for (size_t i = 0; i < lib->map_count; i++)
+        munmap(lib->maps[i].base, lib->maps[i].size);
+    for (size_t i = 0; i < lib->index_cap; i++)
+        free(lib->index[i].path);
+    for (size_t i = 0; i < lib->rom_count; i++)
+        if (lib->roms[i].owned)
+            free((void *)lib->roms[i].data);
+    free(lib->roms);
+    free(lib->paths);
+    free(lib->slots);
+    free(lib->maps);
+    free(lib->index);
+    *lib = (RomLib){ 0 };
+}
+
+// Grows an array to hold one more element, returns true if out of memory
+static bool reserve(void **items, size_t *cap, size_t count, size_t size)
+{
+    if (count < *cap)
+        return false;
+    size_t grown = *cap ? *cap * 2 : 64;
+    void *p = realloc(*items, grown * size);
+    if (!p)
+    {
+        log_msg(LOG_ERROR, "Out of memory in the ROM library");
+        return true;
+    }
+    *items = p;
+    *cap = grown;
+    return false;
+}
+
+static size_t slot_of(uint64_t hash, uint32_t size, size_t slot_count)
+{
+    return (size_t)((hash ^ size) * 0x9E3779B97F4A7C15ull >> 32) & (slot_count - 1);
+}
+
+// Doubles the dedup table once it is half full, returns true if out of memory
+static bool grow_slots(RomLib *lib)
+{
+    if (lib->rom_count * 2 < lib->slot_count)
+        return false;
+    size_t count = lib->slot_count ? lib->slot_count * 2 : 256;
+    uint32_t *slots = calloc(count, sizeof(uint32_t));
+    if (!slots)
+    {
+        log_msg(LOG_ERROR, "Out of memory in the ROM library");
+        return true;
+    }
+    for (size_t r = 0; r < lib->rom_count; r++)
+    {
+        size_t s = slot_of(lib->roms[r].hash, lib->roms[r].size, count);
+        while (slots[s])
+            s = (s + 1) & (count - 1);
+        slots[s] = (uint32_t)r + 1;
+    }
+    free(lib->slots);
+    lib->slots = slots;
+    lib->slot_count = count;
+    return false;
+}
+
+/* Adds a path with the given content, sharing the RomEntry of identical content added before.
+Returns: true if out of memory (name is freed) */
+static bool add_path(RomLib *lib, char *name, int64_t mtime, uint64_t hash, uint32_t size, uint32_t features,
+    const uint8_t *data)
+{
+    if (grow_slots(lib) || reserve((void **)&lib->paths, &lib->path_cap, lib->path_count, sizeof(RomPath)))
+    {
+        free(name);
+        return true;
+    }
+    size_t s = slot_of(hash, size, lib->slot_count);
+    for (; lib->slots[s]; s = (s + 1) & (lib->slot_count - 1))
+    {
+        RomEntry *e = &lib->roms[lib->slots[s] - 1];
+        if (e->hash == hash && e->size == size)
+            break;
+    }
+    if (!lib->slots[s])
+    {
+        if (reserve((void **)&lib->roms, &lib->rom_cap, lib->rom_count, sizeof(RomEntry)))
+        {
+            free(name);
+            return true;
+        }
+        lib->roms[lib->rom_count] = (RomEntry){ .hash = hash, .size = size, .features = features,
+            .profile = (uint8_t)romlib_guess_profile(features), .path = (uint32_t)lib->path_count };
+        lib->slots[s] = (uint32_t)++lib->rom_count;
+    }
+    RomEntry *e = &lib->roms[lib->slots[s] - 1];
+    e->aliases++;
+    if (data && !e->data)
+        e->data = data;     // Prefer the mapped copy over reading a loose file
+    lib->paths[lib->path_count++] = (RomPath){ .name = name, .rom = lib->slots[s] - 1, .mtime = mtime };
+    return false;
+}
+
+static size_t index_slot(const RomLib *lib, const char *path)
+{
+    size_t s = (size_t)fnv1a(path, strlen(path)) & (lib->index_cap - 1);
+    while (lib->index[s].path && strcmp(lib->index[s].path, path))
+        s = (s + 1) & (lib->index_cap - 1);
+    return s;
+}
+
+static const RomIndexRecord *index_find(const RomLib *lib, const char *path)
+{
+    if (!lib->index_cap)
+        return NULL;
+    const RomIndexRecord *r = &lib->index[index_slot(lib, path)];
+    return r->path ? r : NULL;
+}
+
+// Adds or replaces a sidecar record, takes ownership of rec.path. Returns true if out of memory
+static bool index_put(RomLib *lib, RomIndexRecord rec)
+{
+    if ((lib->index_count + 1) * 2 > lib->index_cap)
+    {
+        size_t cap = lib->index_cap ? lib->index_cap * 2 : 1024;
+        RomIndexRecord *old = lib->index;
+        size_t old_cap = lib->index_cap;
+        lib->index = calloc(cap, sizeof(RomIndexRecord));
+        if (!lib->index)
+        {
+            lib->index = old;
+            free(rec.path);
+            log_msg(LOG_ERROR, "Out of memory in the ROM library");
+            return true;
+        }
+        lib->index_cap = cap;
+        for (size_t i = 0; i < old_cap; i++)
+            if (old[i].path)
+                lib->index[index_slot(lib, old[i].path)] = old[i];
+        free(old);
+    }
+    RomIndexRecord *r = &lib->index[index_slot(lib, rec.path)];
+    if (r->path)
+        free(r->path);
+    else
+        lib->index_count++;
+    *r = rec;
+    return false;
+}
+
+static int64_t mtime_ns(const struct stat *st)
+{
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static bool add_file(RomLib *lib, const char *path, const struct stat *st)
+{
+    if (st->st_size > CHIP8_ROM_MAX_SIZE)
+    {
+        log_msg(LOG_ERROR, "ROM '%s' is larger than %d bytes", path, CHIP8_ROM_MAX_SIZE);
+        return true;
+    }
+    char *name = strdup(path);
+    if (!name)
+        return true;
+    int64_t mtime = mtime_ns(st);
+    const RomIndexRecord *rec = index_find(lib, path);
+    if (rec && rec->size == st->st_size && rec->mtime == mtime)
+    {
+        lib->indexed++;
+        return add_path(lib, name, mtime, rec->hash, rec->size, rec->features, NULL);
+    }
+
+    uint8_t rom[CHIP8_ROM_MAX_SIZE + 1];
+    int fd = open(path, O_RDONLY);
+    size_t len = 0;
+    ssize_t n = fd < 0 ? -1 : 1;
+    while (n > 0 && len < sizeof(rom) && (n = read(fd, rom + len, sizeof(rom) - len)) > 0)
+        len += (size_t)n;
+    if (fd >= 0)
+        close(fd);
+    if (n < 0 || len > CHIP8_ROM_MAX_SIZE)
+    {
+        log_msg(LOG_ERROR, n < 0 ? "Couldn't read file: '%s'" : "ROM '%s' is larger than the VM memory", path);
+        free(name);
+        return true;
+    }
+    lib->hashed++;
+    if (add_path(lib, name, mtime, fnv1a(rom, len), (uint32_t)len, romlib_scan_features(rom, len), NULL))
+        return true;
+
+    // Keep the content that was just read so romlib_load doesn't open the file again
+    RomEntry *e = &lib->roms[lib->paths[lib->path_count - 1].rom];
+    uint8_t *copy = e->data ? NULL : malloc(len ? len : 1);
+    if (copy)
+    {
+        memcpy(copy, rom, len);
+        e->data = copy;
+        e->owned = true;
+    }
+    return false;
+}
+
+static int by_name(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Adds every file under dir except dotfiles, in name order
+static bool add_dir(RomLib *lib, const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (!d)
+    {
+        log_msg(LOG_ERROR, "Couldn't open directory: '%s'", dir);
+        return true;
+    }
+    char **names = NULL;
+    size_t count = 0, cap = 0;
+    bool failed = false;
+    for (struct dirent *e; (e = readdir(d)); )
+    {
+        if (e->d_name[0] == '.')
+            continue;
+        if (reserve((void **)&names, &cap, count, sizeof(char *)))
+        {
+            failed = true;
+            break;
+        }
+        size_t len = strlen(dir) + strlen(e->d_name) + 2;
+        if (!(names[count] = malloc(len)))
+        {
+            failed = true;
+            break;
+        }
+        snprintf(names[count++], len, "%s/%s", dir, e->d_name);
+    }
+    closedir(d);
+    if (count)
+        qsort(names, count, sizeof(char *), by_name);
+    for (size_t i = 0; i < count; i++)
+    {
+        failed |= romlib_add(lib, names[i]);
+        free(names[i]);
+    }
+    free(names);
+    return failed;
+}
+
+static bool add_pack(RomLib *lib, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st))
+    {
+        log_msg(LOG_ERROR, "Couldn't open file: '%s'", path);
+        if (fd >= 0)
+            close(fd);
+        return true;
+    }
+    size_t size = (size_t)st.st_size;
+    const uint8_t *map = size >= PACK_HEADER ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        log_msg(LOG_ERROR, "Couldn't map pack: '%s'", path);
+        return true;
+    }
+    if (reserve((void **)&lib->maps, &lib->map_cap, lib->map_count, sizeof(RomMap)))
+    {
+        munmap((void *)map, size);
+        return true;
+    }
+    lib->maps[lib->map_count++] = (RomMap){ (void *)map, size };    // Stays mapped while the library lives
+
+    uint32_t roms = get32(map + 8), paths = get32(map + 12);
+    uint64_t tables = PACK_HEADER + (uint64_t)roms * PACK_ROM + (uint64_t)paths * PACK_PATH;
+    if (memcmp(map, ROMLIB_PACK_MAGIC, 4) || get32(map + 4) != ROMLIB_PACK_VERSION || tables > size)
+    {
+        log_msg(LOG_ERROR, "'%s' isn't a version %d ROM pack", path, ROMLIB_PACK_VERSION);
+        return true;
+    }
+    const uint8_t *rom_table = map + PACK_HEADER;
+    for (uint32_t r = 0; r < roms; r++)
+    {
+        const uint8_t *rec = rom_table + (size_t)r * PACK_ROM;
+        uint64_t end = (uint64_t)get32(rec + 12) + get32(rec + 8);
+        if (get32(rec + 8) > CHIP8_ROM_MAX_SIZE || end > size)
+        {
+            log_msg(LOG_ERROR, "ROM pack '%s' is corrupt", path);
+            return true;
+        }
+    }
+
+    const uint8_t *path_table = rom_table + (size_t)roms * PACK_ROM;
+    for (uint32_t i = 0; i < paths; i++)
+    {
+        const uint8_t *rec = path_table + (size_t)i * PACK_PATH;
+        uint32_t r = get32(rec), offset = get32(rec + 4), len = get32(rec + 8);
+        if (r >= roms || (uint64_t)offset + len > size)
+        {
+            log_msg(LOG_ERROR, "ROM pack '%s' is corrupt", path);
+            return true;
+        }
+        size_t name_len = strlen(path) + len + 2;
+        char *name = malloc(name_len);
+        if (!name)
+            return true;
+        snprintf(name, name_len, "%s:%.*s", path, (int)len, (const char *)map + offset);
+        const uint8_t *rom = rom_table + (size_t)r * PACK_ROM;
+        if (add_path(lib, name, ROMLIB_PACKED, get64(rom), get32(rom + 8), get32(rom + 16), map + get32(rom + 12)))
+            return true;
+    }
+    return false;
+}
+
+bool romlib_add(RomLib *lib, const char *path)
+{
+    struct stat st;
+    if (stat(path, &st))
+    {
+        log_msg(LOG_ERROR, "Couldn't open file: '%s'", path);
+        return true;
+    }
+    if (S_ISDIR(st.st_mode))
+        return add_dir(lib, path);
+    size_t len = strlen(path);
+    if (len > 5 && !strcmp(path + len - 5, ".c8pk"))
+        return add_pack(lib, path);
+    return add_file(lib, path, &st);
+}
+
+bool romlib_load(const RomLib *lib, uint32_t rom, Chip8 *vm)
+{
+    const RomEntry *e = &lib->roms[rom];
+    chip8_set_quirks(vm, lib->quirks == ROMLIB_QUIRKS_AUTO ? romlib_profile_quirks(e->profile)
+                                                           : (Chip8Quirks)lib->quirks);
+    chip8_set_fusion(vm, lib->fuse);
+    if (e->data)
+        return chip8_load_rom_mem(vm, e->data, e->size);
+
+    // Loose file: one read straight into VM memory, then make sure the file is still the one that was indexed
+    const char *path = lib->paths[e->path].name;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        log_msg(LOG_ERROR, "Couldn't open file: '%s'", path);
+        return true;
+    }
+    size_t len = 0;
+    ssize_t n = 1;
+    while (len < e->size && (n = read(fd, vm->memory + CHIP8_PC_START_INDEX + len, e->size - len)) > 0)
+        len += (size_t)n;
+    uint8_t extra;
+    bool changed = n < 0 || len != e->size || read(fd, &extra, 1) != 0;
+    close(fd);
+    chip8_verify(vm);
+    if (changed)
+        log_msg(LOG_ERROR, "ROM '%s' couldn't be read or changed since it was indexed", path);
+    return changed;
+}
+
+bool romlib_load_index(RomLib *lib, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        if (errno == ENOENT)
+            return false;   // First run, the index is created by romlib_save_index
+        log_msg(LOG_ERROR, "Couldn't open file: '%s'", path);
+        return true;
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    bool failed = false;
+    ssize_t len = getline(&line, &cap, f);
+    if (len < 0 || strncmp(line, INDEX_HEADER, strlen(INDEX_HEADER)))
+    {
+        log_msg(LOG_ERROR, "'%s' isn't a ROM index", path);
+        failed = true;
+    }
+    while (!failed && (len = getline(&line, &cap, f)) > 0)
+    {
+        if (line[len - 1] == '\n')
+            line[--len] = '\0';
+        unsigned long long hash;
+        long long mtime;
+        unsigned size, features;
+        int name = 0;
+        if (sscanf(line, "%llx %u %lld %x %n", &hash, &size, &mtime, &features, &name) != 4 || !name || !line[name])
+        {
+            log_msg(LOG_ERROR, "Malformed line in ROM index '%s'", path);
+            failed = true;
+            break;
+        }
+        char *dup = strdup(line + name);
+        failed = !dup || index_put(lib, (RomIndexRecord){ dup, mtime, hash, size, features });
+    }
+    failed |= ferror(f) != 0;
+    free(line);
+    fclose(f);
+    return failed;
+}
+
+bool romlib_save_index(const RomLib *lib, const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+    {
+        log_msg(LOG_ERROR, "Couldn't open file: '%s'", path);
+        return true;
+    }
+    fprintf(f, "%s\n", INDEX_HEADER);
+    for (size_t i = 0; i < lib->path_count; i++)
+    {
+        const RomPath *p = &lib->paths[i];
+        const RomEntry *e = &lib->roms[p->rom];
+        if (p->mtime != ROMLIB_PACKED)  // Pack members are indexed by their pack
+            fprintf(f, "%016llx %u %lld %x %s\n", (unsigned long long)e->hash, e->size, (long long)p->mtime,
+                e->features, p->name);
+    }
+    bool failed = ferror(f) != 0;
+    failed |= fclose(f) != 0;
+    if (failed)
+        log_msg(LOG_ERROR, "Couldn't write ROM index: '%s'", path);
+    return failed;
+}
+
+bool romlib_write_pack(const RomLib *lib, const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f)
+    {
+        log_msg(LOG_ERROR, "Couldn't open file: '%s'", path);
+        return true;
+    }
+    uint64_t names = PACK_HEADER + (uint64_t)lib->rom_count * PACK_ROM + (uint64_t)lib->path_count * PACK_PATH;
+    uint64_t data = names;
+    for (size_t i = 0; i < lib->path_count; i++)
+        data += strlen(lib->paths[i].name);
+    uint64_t end = data;
+    for (size_t r = 0; r < lib->rom_count; r++)
+        end += lib->roms[r].size;
+    if (end > UINT32_MAX)
+    {
+        log_msg(LOG_ERROR, "ROM pack '%s' would exceed 4 GB", path);
+        fclose(f);
+        return true;
+    }
+
+    uint8_t rec[PACK_ROM] = { 0 };
+    memcpy(rec, ROMLIB_PACK_MAGIC, 4);
+    put32(rec + 4, ROMLIB_PACK_VERSION);
+    put32(rec + 8, (uint32_t)lib->rom_count);
+    put32(rec + 12, (uint32_t)lib->path_count);
+    bool failed = fwrite(rec, 1, PACK_HEADER, f) != PACK_HEADER;
+
+    uint64_t offset = data;
+    for (size_t r = 0; r < lib->rom_count && !failed; r++)
+    {
+        const RomEntry *e = &lib->roms[r];
+        memset(rec, 0, sizeof(rec));
+        put64(rec, e->hash);
+        put32(rec + 8, e->size);
+        put32(rec + 12, (uint32_t)offset);
+        put32(rec + 16, e->features);
+        rec[20] = e->profile;
+        failed |= fwrite(rec, 1, PACK_ROM, f) != PACK_ROM;
+        offset += e->size;
+    }
+    offset = names;
+    for (size_t i = 0; i < lib->path_count && !failed; i++)
+    {
+        uint32_t len = (uint32_t)strlen(lib->paths[i].name);
+        put32(rec, lib->paths[i].rom);
+        put32(rec + 4, (uint32_t)offset);
+        put32(rec + 8, len);
+        failed |= fwrite(rec, 1, PACK_PATH, f) != PACK_PATH;
+        offset += len;
+    }
+    for (size_t i = 0; i < lib->path_count && !failed; i++)
+        failed |= fputs(lib->paths[i].name, f) == EOF;
+    for (size_t r = 0; r < lib->rom_count && !failed; r++)
+    {
+        static Chip8 vm;    // Loose contents are read through romlib_load
+        const RomEntry *e = &lib->roms[r];
+        const uint8_t *content = e->data;
+        if (!content)
+        {
+            failed |= romlib_load(lib, (uint32_t)r, &vm);
+            content = vm.memory + CHIP8_PC_START_INDEX;
+        }
+        failed |= fwrite(content, 1, e->size, f) != e->size;
+    }
+    failed |= ferror(f) != 0;
+    failed |= fclose(f) != 0;
+    if (failed)
+        log_msg(LOG_ERROR, "Couldn't write ROM pack: '%s'", path);
+    return failed;
+}
@@ -0,0 +1,114 @@
+#ifndef ROMLIB_H
+#define ROMLIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+
+/* ROM library: a set of ROMs gathered from files, directories and packs, deduplicated by content.
+    - Every ROM is identified by a 64-bit FNV-1a hash of its content plus its size. Paths with identical content
+      share one RomEntry, so a corpus can run each distinct ROM once
+    - A pack (.c8pk) holds the unique contents and every path in a single file, mmapped whole: opening one costs no
+      hashing and no per-ROM I/O. romlib_write_pack creates one from a library
+    - Loose files are read and hashed once, and their content is kept for romlib_load. A sidecar index
+      (romlib_load_index/romlib_save_index) remembers hash and features per path, size and mtime, so later startups
+      only stat the files and defer reading them to romlib_load
+    - romlib_load copies a ROM into a VM's memory once: memcpy from memory, or one read() for an indexed file */
+
+#define ROMLIB_PACK_MAGIC "C8PK"
+#define ROMLIB_PACK_VERSION 1
+
+// Features found by scanning a ROM's instructions (at even offsets, so data can cause false positives)
+enum {
+    ROM_FEAT_SCHIP     = 1 << 0,    // 00Cn/00FB-00FF, Fx30/Fx75/Fx85
+    ROM_FEAT_XOCHIP    = 1 << 1,    // 5XY2/5XY3, F000 NNNN, Fn01, F002, Fx3A
+    ROM_FEAT_SHIFT     = 1 << 2,    // 8XY6/8XYE, sensitive to the shift quirk
+    ROM_FEAT_LOADSTORE = 1 << 3,    // Fx55/Fx65, sensitive to the I increment quirk
+    ROM_FEAT_JUMP0     = 1 << 4,    // BNNN, sensitive to the BXNN quirk
+    ROM_FEAT_LOGIC     = 1 << 5,    // 8XY1/8XY2/8XY3, sensitive to the VF reset quirk
+    ROM_FEAT_DRAW      = 1 << 6,    // Dxyn
+    ROM_FEAT_KEYWAIT   = 1 << 7,    // Fx0A
+};
+
+// Platform a ROM most likely targets, from its features
+typedef enum {
+    ROM_PROFILE_CHIP8,
+    ROM_PROFILE_SCHIP,
+    ROM_PROFILE_XOCHIP
+} RomProfile;
+
+typedef struct {
+    uint64_t hash;          // FNV-1a of the content
+    uint32_t size;
+    uint32_t features;      // ROM_FEAT_*
+    uint8_t profile;        // RomProfile
+    uint32_t path;          // First path with this content, loose ROMs are read from it
+    uint32_t aliases;       // Paths with this content
+    const uint8_t *data;    // Content inside a mapped pack or a copy of a hashed file, NULL to read the file
+    bool owned;             // data is a heap copy freed with the library
+} RomEntry;
+
+typedef struct {
+    char *name;             // File path, or "<pack>:<name>" for a pack member
+    uint32_t rom;           // RomEntry index
+    int64_t mtime;          // Modification time in ns for the sidecar index, ROMLIB_PACKED for a pack member
+} RomPath;
+
+#define ROMLIB_PACKED INT64_MIN
+#define ROMLIB_QUIRKS_AUTO (-1)
+
+typedef struct {
+    void *base;
+    size_t size;
+} RomMap;
+
+typedef struct RomIndexRecord RomIndexRecord;
+
+typedef struct {
+    RomEntry *roms;
+    size_t rom_count, rom_cap;
+    RomPath *paths;
+    size_t path_count, path_cap;
+    uint32_t *slots;                // rom index + 1 keyed by (hash, size), power-of-two size
+    size_t slot_count;
+    RomMap *maps;                   // Mapped packs
+    size_t map_count, map_cap;
+    RomIndexRecord *index;          // Sidecar index records by path, open addressing
+    size_t index_count, index_cap;
+    size_t hashed;                  // Loose files read and hashed
+    size_t indexed;                 // Loose files taken from the sidecar index
+    int quirks;                     // Chip8Quirks romlib_load selects, ROMLIB_QUIRKS_AUTO = from each ROM's profile
+    bool fuse;                      // Superinstruction fusion on the VMs romlib_load fills (romlib_init: on)
+} RomLib;
+
+void romlib_init(RomLib *lib);
+void romlib_cleanup(RomLib *lib);
+
+/* Adds a ROM file, every file under a directory (recursively, in name order) or every path of a .c8pk pack.
+Returns: true if something couldn't be read (what could be read is still added) */
+bool romlib_add(RomLib *lib, const char *path);
+
+/* Loads ROM `rom` into the VM's memory at CHIP8_PC_START_INDEX (the VM must be initialized) and selects its quirk
+    profile. Thread-safe, a library can feed many workers.
+Returns: true if a loose file can't be read or no longer matches the library */
+bool romlib_load(const RomLib *lib, uint32_t rom, Chip8 *vm);
+
+/* Sidecar index: load before adding files, save after.
+Returns: true on I/O errors or a malformed index (a missing index isn't an error) */
+bool romlib_load_index(RomLib *lib, const char *path);
+bool romlib_save_index(const RomLib *lib, const char *path);
+
+// Writes every path and unique ROM of the library into a pack, returns true on failure
+bool romlib_write_pack(const RomLib *lib, const char *path);
+
+// Feature scan and profile guess used for every new ROM
+uint32_t romlib_scan_features(const uint8_t *rom, size_t size);
+RomProfile romlib_guess_profile(uint32_t features);
+const char *romlib_profile_name(uint8_t profile);
+
+/* Quirk profile a ROM profile runs with: SUPER-CHIP ROMs get CHIP8_QUIRKS_SCHIP, everything else the default
+    CHIP8_QUIRKS_MODERN (plain CHIP-8 code can't tell which platform it was written for) */
+Chip8Quirks romlib_profile_quirks(uint8_t profile);
+
+#endif
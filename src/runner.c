@@ -0,0 +1,135 @@
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include "runner.h"
+#include "logger.h"
+
+/*
+    runner.c drives a VM without SDL:
+    - Executes a fixed number of instructions per frame and ticks the timers between frames
+    - No wall-clock pacing, the VM runs as fast as the host allows
+    - Plays input movies: key events apply at their instruction counts, the movie's speed sets the frame budgets
+    - Once the VM halts (jump to self) or blocks in Fx0A, the remaining frames only tick the timers (no input
+      arrives in a headless run), so they are accounted for without running them, unless every frame is recorded
+      (rewind or trace) or a movie plays. A frame dump just extends the last frame's duration
+*/
+
+double runner_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Accounts for the frames the loop in runner_run would still run on a VM stuck in a halt or key wait.
+    Matches it exactly: full frames end with a timer tick, a final partial burst doesn't */
+static void runner_fast_forward(Chip8 *vm, const RunConfig *cfg, RunResult *res, uint32_t ipf)
+{
+    uint64_t frames = cfg->max_frames ? cfg->max_frames - res->frames : UINT64_MAX;
+    uint64_t tail = 0;
+    if (cfg->max_instructions)
+    {
+        uint64_t left = cfg->max_instructions - res->instructions;
+        if (left / ipf < frames)
+        {
+            frames = left / ipf;
+            tail = left % ipf;
+        }
+    }
+    res->instructions += frames * ipf + tail;
+    res->frames += frames;
+    if (cfg->dump && frames)
+        framedump_frames(cfg->dump, vm, frames);   // Timer ticks don't touch the display
+    for (uint64_t i = 0; i < frames && (vm->delay_timer || vm->sound_timer); i++)
+        chip8_tick_timers(vm);
+    if (frames || tail)
+        vm->draw_flag = false;
+}
+
+// Runs one burst on the configured engine, same contract as chip8_run
+static bool runner_burst(Chip8 *vm, const RunConfig *cfg, uint32_t budget, uint32_t *executed)
+{
+    if (cfg->trace)
+        return trace_run(cfg->trace, vm, budget, executed);
+    if (cfg->jit)
+        return chip8_jit_run(cfg->jit, vm, budget, executed);
+    return chip8_run(vm, budget, executed);
+}
+
+/* Runs vm until the instruction/frame budget in cfg is exhausted or the VM errors out.
+    Without a budget, a movie plays to its end.
+Returns: true if cfg is invalid (no budget given), false otherwise */
+bool runner_run(Chip8 *vm, const RunConfig *cfg, RunResult *res)
+{
+    uint64_t max_frames = cfg->max_frames;
+    if (!cfg->max_instructions && !max_frames && cfg->movie)
+        max_frames = cfg->movie->movie->frames;
+    if (!cfg->max_instructions && !max_frames)
+    {
+        log_msg(LOG_ERROR, "headless run needs an instruction or frame budget");
+        return true;
+    }
+    uint32_t ipf = cfg->instructions_per_frame ? cfg->instructions_per_frame : RUNNER_DEFAULT_IPF;
+
+    *res = (RunResult){ .exit = RUN_EXIT_BUDGET };
+    double start = runner_now();
+    uint64_t next_event = cfg->movie ? movie_play_events(cfg->movie, vm, 0) : UINT64_MAX;
+
+    bool running = true;
+    while (running)
+    {
+        uint32_t budget = cfg->movie ? movie_play_budget(cfg->movie) : ipf;
+        if (cfg->max_instructions)
+        {
+            uint64_t left = cfg->max_instructions - res->instructions;
+            if (left == 0)
+                break;
+            if (left < budget)
+            {
+                budget = (uint32_t)left;
+                running = false;    // Stop after this burst, before the next timer tick
+            }
+        }
+
+        // The burst is split wherever a movie event falls inside it
+        bool failed = false;
+        for (uint32_t left = budget; left && !failed; )
+        {
+            uint32_t part = left, executed = 0;
+            if (next_event - res->instructions < part)
+                part = (uint32_t)(next_event - res->instructions);
+            failed = runner_burst(vm, cfg, part, &executed);
+            res->instructions += executed;
+            left -= executed < left ? executed : left;
+            if (cfg->movie)
+                next_event = movie_play_events(cfg->movie, vm, res->instructions);
+        }
+        if (failed)
+        {
+            res->exit = RUN_EXIT_VM_ERROR;
+            running = false;
+        }
+        if (!running)
+            break;
+
+        chip8_tick_timers(vm);
+        if (cfg->trace)
+            trace_frame(cfg->trace, vm);
+        if (cfg->dump)
+            framedump_frames(cfg->dump, vm, 1);
+        if (cfg->rewind)
+            rewind_push(cfg->rewind, vm);
+        res->frames++;
+        if (max_frames && res->frames >= max_frames)
+            running = false;
+        else if ((vm->idle == CHIP8_IDLE_HALT || vm->idle == CHIP8_IDLE_KEY) && !cfg->rewind && !cfg->trace &&
+                 !cfg->movie)
+        {
+            runner_fast_forward(vm, cfg, res, ipf);
+            running = false;
+        }
+    }
+
+    res->seconds = runner_now() - start;
+    res->display_hash = chip8_display_hash(vm);
+    return false;
+}
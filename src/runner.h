@@ -0,0 +1,48 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+#include "chip8_jit.h"
+#include "rewind.h"
+#include "trace.h"
+#include "movie.h"
+#include "framedump.h"
+
+// Default instructions executed per 60 Hz frame (~500 Hz CPU, same pacing as the SDL frontend)
+#define RUNNER_DEFAULT_IPF 8
+
+// Why a headless run stopped
+typedef enum {
+    RUN_EXIT_BUDGET,    // Instruction or frame budget exhausted
+    RUN_EXIT_VM_ERROR   // chip8_cycle reported an invalid instruction
+} RunExit;
+
+typedef struct {
+    uint64_t max_instructions;          // Stop after this many instructions (0 = no limit)
+    uint64_t max_frames;                // Stop after this many 60 Hz frames (0 = no limit)
+    uint32_t instructions_per_frame;    // Instructions executed between timer ticks (unless a movie plays)
+    Chip8Jit *jit;                      // Execute through the JIT when set (must be flushed per ROM)
+    Rewind *rewind;                     // Record a snapshot after every frame when set
+    Chip8Trace *trace;                  // Record every instruction when set (runs on the interpreter, jit is ignored)
+    MoviePlayer *movie;                 // Play a movie when set (movie_play_start on this VM first): its key events
+                                        // apply at their instruction counts and its speed sets the frame budgets
+    FrameDump *dump;                    // Export the display after every frame when set
+} RunConfig;
+
+typedef struct {
+    RunExit exit;
+    uint64_t instructions;  // Instructions executed
+    uint64_t frames;        // Timer ticks performed
+    double seconds;         // Host wall-clock time spent in the run
+    uint64_t display_hash;  // chip8_display_hash() of the final framebuffer
+} RunResult;
+
+// Runs a loaded VM without any platform layer, as fast as the host allows
+bool runner_run(Chip8 *vm, const RunConfig *cfg, RunResult *res);
+
+// Monotonic host time in seconds
+double runner_now(void);
+
+#endif
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <string.h>
+#include "savestate.h"
+#include "logger.h"
+
+/*
+    savestate.c converts a Chip8 to and from a flat byte image:
+    - Every field is written at a fixed offset, multi-byte values little-endian, so images are portable
+    - Registers come first and memory last, which keeps the frequently changing bytes together for rewind deltas
+*/
+
+// Image layout (version 1)
+#define OFF_VERSION     4
+#define OFF_PC          8
+#define OFF_I           10
+#define OFF_V           12
+#define OFF_STACK       (OFF_V + CHIP8_REGISTER_COUNT)
+#define OFF_SP          (OFF_STACK + CHIP8_STACK_SIZE * 2)
+#define OFF_DELAY       (OFF_SP + 1)
+#define OFF_SOUND       (OFF_SP + 2)
+#define OFF_RNG         (OFF_SP + 4)
+#define OFF_DISPLAY     (OFF_RNG + 4)
+#define OFF_MEMORY      (OFF_DISPLAY + CHIP8_DISPLAY_HEIGHT * 8)
+
+_Static_assert(OFF_MEMORY == SAVESTATE_MEMORY_OFFSET && OFF_MEMORY + CHIP8_MEM_SIZE == SAVESTATE_SIZE,
+    "savestate layout doesn't match savestate.h");
+
+static void put16(uint8_t *b, uint16_t v)
+{
+    b[0] = (uint8_t)v;
+    b[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *b, uint32_t v)
+{
+    put16(b, (uint16_t)v);
+    put16(b + 2, (uint16_t)(v >> 16));
+}
+
+static void put64(uint8_t *b, uint64_t v)
+{
+    put32(b, (uint32_t)v);
+    put32(b + 4, (uint32_t)(v >> 32));
+}
+
+static uint16_t get16(const uint8_t *b)
+{
+    return (uint16_t)(b[0] | b[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *b)
+{
+    return get16(b) | (uint32_t)get16(b + 2) << 16;
+}
+
+static uint64_t get64(const uint8_t *b)
+{
+    return get32(b) | (uint64_t)get32(b + 4) << 32;
+}
+
+void savestate_save_header(const Chip8 *p, uint8_t *buf)
+{
+    memcpy(buf, SAVESTATE_MAGIC, 4);
+    put16(buf + OFF_VERSION, SAVESTATE_VERSION);
+    put16(buf + OFF_VERSION + 2, 0);
+    put16(buf + OFF_PC, p->pc);
+    put16(buf + OFF_I, p->I);
+    memcpy(buf + OFF_V, p->V, CHIP8_REGISTER_COUNT);
+    for (int i = 0; i < CHIP8_STACK_SIZE; i++)
+        put16(buf + OFF_STACK + i * 2, p->stack[i]);
+    buf[OFF_SP] = p->sp;
+    buf[OFF_DELAY] = p->delay_timer;
+    buf[OFF_SOUND] = p->sound_timer;
+    buf[OFF_SOUND + 1] = 0;
+    put32(buf + OFF_RNG, p->rng_state);
+    for (int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++)
+        put64(buf + OFF_DISPLAY + y * 8, p->display[y]);
+}
+
+void savestate_save(const Chip8 *p, uint8_t *buf)
+{
+    savestate_save_header(p, buf);
+    memcpy(buf + OFF_MEMORY, p->memory, CHIP8_MEM_SIZE);
+}
+
+bool savestate_load(Chip8 *p, const uint8_t *buf, size_t len)
+{
+    if (len < SAVESTATE_SIZE || memcmp(buf, SAVESTATE_MAGIC, 4))
+    {
+        log_msg(LOG_ERROR, "not a savestate");
+        return true;
+    }
+    uint16_t version = get16(buf + OFF_VERSION);
+    if (version != SAVESTATE_VERSION)
+    {
+        log_msg(LOG_ERROR, "unsupported savestate version %u", version);
+        return true;
+    }
+    if (len != SAVESTATE_SIZE)
+    {
+        log_msg(LOG_ERROR, "savestate is %zu bytes, expected %d", len, SAVESTATE_SIZE);
+        return true;
+    }
+    uint16_t pc = get16(buf + OFF_PC);
+    uint32_t rng = get32(buf + OFF_RNG);
+    if (pc > CHIP8_MEM_SIZE - 2 || buf[OFF_SP] > CHIP8_STACK_SIZE || rng == 0)
+    {
+        log_msg(LOG_ERROR, "corrupt savestate");
+        return true;
+    }
+
+    p->pc = pc;
+    p->I = get16(buf + OFF_I);
+    memcpy(p->V, buf + OFF_V, CHIP8_REGISTER_COUNT);
+    for (int i = 0; i < CHIP8_STACK_SIZE; i++)
+        p->stack[i] = get16(buf + OFF_STACK + i * 2);
+    p->sp = buf[OFF_SP];
+    p->delay_timer = buf[OFF_DELAY];
+    p->sound_timer = buf[OFF_SOUND];
+    p->rng_state = rng;
+    for (int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++)
+        p->display[y] = get64(buf + OFF_DISPLAY + y * 8);
+    memcpy(p->memory, buf + OFF_MEMORY, CHIP8_MEM_SIZE);
+
+    chip8_verify(p);    // Also drops the predecoded instructions of the old memory
+    p->dirty_rows = UINT32_MAX;
+    p->draw_flag = true;
+    return false;
+}
+
+bool savestate_write_file(const Chip8 *p, const char *path)
+{
+    uint8_t buf[SAVESTATE_SIZE];
+    savestate_save(p, buf);
+    FILE *f = fopen(path, "wb");
+    if (!f)
+    {
+        log_msg(LOG_ERROR, "Couldn't open file: '%s'", path);
+        return true;
+    }
+    bool failed = fwrite(buf, 1, sizeof(buf), f) != sizeof(buf);
+    failed |= fclose(f) != 0;
+    if (failed)
+        log_msg(LOG_ERROR, "Couldn't write savestate: '%s'", path);
+    return failed;
+}
+
+bool savestate_read_file(Chip8 *p, const char *path)
+{
+    uint8_t buf[SAVESTATE_SIZE + 1];    // One spare byte to detect oversized files
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        log_msg(LOG_ERROR, "Couldn't open file: '%s'", path);
+        return true;
+    }
+    size_t len = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    return savestate_load(p, buf, len);
+}
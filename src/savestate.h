@@ -0,0 +1,33 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+
+/* Versioned binary savestates.
+    A state is a fixed-size little-endian image of the architectural VM state: registers, stack, timers,
+    PRNG state, display and memory. Host-side fields (keys, draw/dirty flags, the decode cache) are not saved */
+
+#define SAVESTATE_MAGIC "C8ST"
+#define SAVESTATE_VERSION 1
+#define SAVESTATE_SIZE (68 + CHIP8_DISPLAY_HEIGHT * 8 + CHIP8_MEM_SIZE)    // Bytes in a version 1 image
+#define SAVESTATE_MEMORY_OFFSET (SAVESTATE_SIZE - CHIP8_MEM_SIZE)           // Memory is stored verbatim at the end
+
+// Serializes p into buf (SAVESTATE_SIZE bytes)
+void savestate_save(const Chip8 *p, uint8_t *buf);
+
+// Serializes everything but memory, i.e. the first SAVESTATE_MEMORY_OFFSET bytes of the image
+void savestate_save_header(const Chip8 *p, uint8_t *buf);
+
+/* Restores p from an image, keeping p's key state. The decode cache is invalidated and every display row is
+    marked dirty (a JIT running this VM must be flushed by the caller).
+Returns: true if the image is truncated, from another version or holds an impossible state (p is left untouched) */
+bool savestate_load(Chip8 *p, const uint8_t *buf, size_t len);
+
+// File wrappers around savestate_save/savestate_load, return true on failure
+bool savestate_write_file(const Chip8 *p, const char *path);
+bool savestate_read_file(Chip8 *p, const char *path);
+
+#endif
@@ -0,0 +1,499 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "trace.h"
+#include "logger.h"
+
+/*
+    trace.c records execution traces:
+    - The encoder compares the VM against a snapshot taken before the instruction; memory writes are derived from
+      the opcode (only Fx33 and Fx55 write memory), so no memory is compared
+    - The VM thread appends records to the current chunk and queues it when full; a writer thread does the write()s
+    - The decoder and formatter are shared with chip8-replay, so both sides agree on the encoding
+*/
+
+static void put16(uint8_t *b, uint16_t v)
+{
+    b[0] = (uint8_t)v;
+    b[1] = (uint8_t)(v >> 8);
+}
+
+static void put64(uint8_t *b, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        b[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint16_t get16(const uint8_t *b)
+{
+    return (uint16_t)(b[0] | b[1] << 8);
+}
+
+static uint64_t get64(const uint8_t *b)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = v << 8 | b[i];
+    return v;
+}
+
+// Cheap display fingerprint, good enough to tell two framebuffers apart
+static uint64_t display_digest(const Chip8 *vm)
+{
+    uint64_t h = 0;
+    for (int y = 0; y < CHIP8_DISPLAY_HEIGHT; y++)
+        h = (h ^ vm->display[y]) * 0x9E3779B97F4A7C15ull;
+    return h ^ h >> 29;
+}
+
+void trace_snap(TraceSnap *s, const Chip8 *vm)
+{
+    s->pc = vm->pc;
+    s->I = vm->I;
+    s->opcode = vm->pc < CHIP8_MEM_SIZE - 1 ? (uint16_t)(vm->memory[vm->pc] << 8 | vm->memory[vm->pc + 1]) : 0;
+    s->sp = vm->sp;
+    s->delay = vm->delay_timer;
+    s->sound = vm->sound_timer;
+    memcpy(s->V, vm->V, sizeof(s->V));
+}
+
+size_t trace_encode(uint8_t *out, const TraceSnap *s, const Chip8 *vm)
+{
+    uint8_t *o = out + 1;
+    uint8_t tag = 0;
+    if (vm->pc != (uint16_t)(s->pc + 2))
+    {
+        tag |= TRACE_PC;
+        put16(o, vm->pc);
+        o += 2;
+    }
+#ifdef __SSE2__
+    uint16_t mask = (uint16_t)~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)vm->V),
+        _mm_loadu_si128((const __m128i *)s->V)));
+#else
+    uint16_t mask = 0;
+    for (int i = 0; i < CHIP8_REGISTER_COUNT; i++)
+        if (vm->V[i] != s->V[i])
+            mask |= (uint16_t)(1u << i);
+#endif
+    if (mask)
+    {
+        tag |= TRACE_V;
+        if (!(mask & (mask - 1)))
+        {
+            int r = __builtin_ctz(mask);
+            *o++ = (uint8_t)r;
+            *o++ = vm->V[r];
+        }
+        else
+        {
+            *o++ = 0xFF;
+            put16(o, mask);
+            o += 2;
+            for (unsigned m = mask; m; m &= m - 1)
+                *o++ = vm->V[__builtin_ctz(m)];
+        }
+    }
+    if (vm->delay_timer != s->delay || vm->sound_timer != s->sound)
+    {
+        tag |= TRACE_TIMERS;
+        *o++ = vm->delay_timer;
+        *o++ = vm->sound_timer;
+    }
+    if (vm->I != s->I)
+    {
+        tag |= TRACE_I;
+        put16(o, vm->I);
+        o += 2;
+    }
+    if (vm->sp != s->sp)
+    {
+        tag |= TRACE_STACK;
+        if (vm->sp > s->sp && vm->sp <= CHIP8_STACK_SIZE)
+        {
+            o[0] = vm->sp | TRACE_PUSH;
+            put16(o + 1, vm->stack[vm->sp - 1]);
+            o += 3;
+        }
+        else
+            *o++ = vm->sp;
+    }
+    unsigned len = 0;
+    if ((s->opcode & 0xF0FF) == 0xF033)
+        len = 3;
+    else if ((s->opcode & 0xF0FF) == 0xF055)
+        len = ((s->opcode >> 8) & 0xF) + 1u;
+    if (len && s->I < CHIP8_MEM_SIZE)
+    {
+        if (len > (unsigned)(CHIP8_MEM_SIZE - s->I))
+            len = (unsigned)(CHIP8_MEM_SIZE - s->I);
+        tag |= TRACE_MEM;
+        put16(o, s->I);
+        o[2] = (uint8_t)len;
+        memcpy(o + 3, vm->memory + s->I, len);
+        o += 3 + len;
+    }
+    if (s->opcode == 0x00E0 || (s->opcode & 0xF000) == 0xD000)
+    {
+        tag |= TRACE_DISPLAY;
+        put64(o, display_digest(vm));
+        o += 8;
+    }
+    out[0] = tag;
+    return (size_t)(o - out);
+}
+
+size_t trace_decode(const uint8_t *in, size_t avail, TraceRecord *rec)
+{
+    if (!avail)
+        return 0;
+    memset(rec, 0, sizeof(*rec));
+    const uint8_t *i = in, *end = in + avail;
+    rec->tag = *i++;
+    if (rec->tag & TRACE_EVENT)
+    {
+        switch (rec->tag)
+        {
+            case TRACE_EV_FRAME:
+            case TRACE_EV_FAULT:
+                return 1;
+            case TRACE_EV_KEYS:
+                if (avail < 3)
+                    return 0;
+                rec->keys = get16(i);
+                return 3;
+            case TRACE_EV_END:
+                if (avail < 17)
+                    return 0;
+                rec->instructions = get64(i);
+                rec->frames = get64(i + 8);
+                return 17;
+            default:
+                return 0;
+        }
+    }
+    // Every field is bounds-checked against the worst case before it is read
+    if (rec->tag & TRACE_PC)
+    {
+        if (end - i < 2)
+            return 0;
+        rec->pc = get16(i);
+        i += 2;
+    }
+    if (rec->tag & TRACE_V)
+    {
+        if (end - i < 2)
+            return 0;
+        if (i[0] != 0xFF)
+        {
+            if (i[0] >= CHIP8_REGISTER_COUNT)
+                return 0;
+            rec->v_mask = (uint16_t)(1u << i[0]);
+            rec->V[i[0]] = i[1];
+            i += 2;
+        }
+        else
+        {
+            if (end - i < 3)
+                return 0;
+            rec->v_mask = get16(i + 1);
+            i += 3;
+            if (end - i < __builtin_popcount(rec->v_mask))
+                return 0;
+            for (int r = 0; r < CHIP8_REGISTER_COUNT; r++)
+                if (rec->v_mask & (1u << r))
+                    rec->V[r] = *i++;
+        }
+    }
+    if (rec->tag & TRACE_TIMERS)
+    {
+        if (end - i < 2)
+            return 0;
+        rec->delay = i[0];
+        rec->sound = i[1];
+        i += 2;
+    }
+    if (rec->tag & TRACE_I)
+    {
+        if (end - i < 2)
+            return 0;
+        rec->I = get16(i);
+        i += 2;
+    }
+    if (rec->tag & TRACE_STACK)
+    {
+        if (end - i < 1)
+            return 0;
+        rec->sp = *i & ~TRACE_PUSH;
+        if (*i++ & TRACE_PUSH)
+        {
+            if (end - i < 2)
+                return 0;
+            rec->push = true;
+            rec->pushed = get16(i);
+            i += 2;
+        }
+    }
+    if (rec->tag & TRACE_MEM)
+    {
+        if (end - i < 3 || i[2] == 0 || i[2] > CHIP8_REGISTER_COUNT || end - i < 3 + i[2])
+            return 0;
+        rec->mem_addr = get16(i);
+        rec->mem_len = i[2];
+        memcpy(rec->mem, i + 3, rec->mem_len);
+        i += 3 + rec->mem_len;
+    }
+    if (rec->tag & TRACE_DISPLAY)
+    {
+        if (end - i < 8)
+            return 0;
+        rec->display = get64(i);
+        i += 8;
+    }
+    return (size_t)(i - in);
+}
+
+// Appends printf output to buf at *len, truncating at size
+static void append(char *buf, size_t size, size_t *len, const char *fmt, ...) __attribute__((format(printf, 4, 5)));
+
+static void append(char *buf, size_t size, size_t *len, const char *fmt, ...)
+{
+    if (*len >= size)
+        return;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + *len, size - *len, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        *len += (size_t)n;
+}
+
+void trace_format(const TraceRecord *rec, char *buf, size_t size)
+{
+    size_t len = 0;
+    if (size)
+        buf[0] = '\0';
+    switch (rec->tag)
+    {
+        case TRACE_EV_FRAME: append(buf, size, &len, "frame"); return;
+        case TRACE_EV_KEYS:  append(buf, size, &len, "frame keys=%04X", rec->keys); return;
+        case TRACE_EV_FAULT: append(buf, size, &len, "fault"); return;
+        case TRACE_EV_END:
+            append(buf, size, &len, "end instructions=%llu frames=%llu", (unsigned long long)rec->instructions,
+                (unsigned long long)rec->frames);
+            return;
+    }
+    if (rec->tag & TRACE_PC)
+        append(buf, size, &len, " pc=%03X", rec->pc);
+    for (int r = 0; r < CHIP8_REGISTER_COUNT; r++)
+        if (rec->v_mask & (1u << r))
+            append(buf, size, &len, " V%X=%02X", r, rec->V[r]);
+    if (rec->tag & TRACE_TIMERS)
+        append(buf, size, &len, " dt=%u st=%u", rec->delay, rec->sound);
+    if (rec->tag & TRACE_I)
+        append(buf, size, &len, " I=%03X", rec->I);
+    if (rec->tag & TRACE_STACK)
+    {
+        append(buf, size, &len, " sp=%u", rec->sp);
+        if (rec->push)
+            append(buf, size, &len, " push=%03X", rec->pushed);
+    }
+    if (rec->tag & TRACE_MEM)
+    {
+        append(buf, size, &len, " mem[%03X]=", rec->mem_addr);
+        for (int b = 0; b < rec->mem_len; b++)
+            append(buf, size, &len, "%02X", rec->mem[b]);
+    }
+    if (rec->tag & TRACE_DISPLAY)
+        append(buf, size, &len, " display=%016llX", (unsigned long long)rec->display);
+    if (!len)
+        append(buf, size, &len, " (no change)");
+}
+
+/* Writer thread: writes queued chunks in order until the trace is closed and the queue drained */
+static void *trace_writer(void *arg)
+{
+    Chip8Trace *t = arg;
+    pthread_mutex_lock(&t->lock);
+    for (;;)
+    {
+        while (!t->queued && !t->closing)
+            pthread_cond_wait(&t->ready, &t->lock);
+        if (!t->queued)
+            break;
+        unsigned c = t->head;
+        pthread_mutex_unlock(&t->lock);
+
+        bool failed = false;
+        for (size_t done = 0; done < t->lengths[c]; )
+        {
+            ssize_t n = write(t->fd, t->chunks[c] + done, t->lengths[c] - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                failed = true;
+                break;
+            }
+            done += (size_t)n;
+        }
+
+        pthread_mutex_lock(&t->lock);
+        t->failed |= failed;
+        t->head = (t->head + 1) % TRACE_CHUNKS;
+        t->queued--;
+        pthread_cond_signal(&t->freed);
+    }
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+// Queues the chunk being filled and waits until the next one is free
+static void trace_submit(Chip8Trace *t)
+{
+    pthread_mutex_lock(&t->lock);
+    t->lengths[t->fill] = t->used;
+    t->queued++;
+    pthread_cond_signal(&t->ready);
+    while (t->queued == TRACE_CHUNKS)
+        pthread_cond_wait(&t->freed, &t->lock);
+    pthread_mutex_unlock(&t->lock);
+    t->fill = (t->fill + 1) % TRACE_CHUNKS;
+    t->used = 0;
+}
+
+// Makes room for one more record
+static inline uint8_t *trace_reserve(Chip8Trace *t)
+{
+    if (t->used > TRACE_CHUNK - TRACE_RECORD_MAX)
+        trace_submit(t);
+    return t->chunks[t->fill] + t->used;
+}
+
+bool trace_open(Chip8Trace *t, const char *path, const Chip8 *vm)
+{
+    *t = (Chip8Trace){ .path = path };
+    t->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (t->fd < 0)
+    {
+        log_msg(LOG_ERROR, "Couldn't open file: '%s'", path);
+        return true;
+    }
+    for (int c = 0; c < TRACE_CHUNKS; c++)
+    {
+        if (!(t->chunks[c] = malloc(TRACE_CHUNK)))
+        {
+            log_msg(LOG_ERROR, "Out of memory for the trace buffers");
+            for (int k = 0; k < c; k++)
+                free(t->chunks[k]);
+            close(t->fd);
+            return true;
+        }
+    }
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->ready, NULL);
+    pthread_cond_init(&t->freed, NULL);
+    if (pthread_create(&t->writer, NULL, trace_writer, t))
+    {
+        log_msg(LOG_ERROR, "Couldn't start the trace writer");
+        for (int c = 0; c < TRACE_CHUNKS; c++)
+            free(t->chunks[c]);
+        close(t->fd);
+        return true;
+    }
+
+    uint8_t *h = t->chunks[0];
+    memcpy(h, TRACE_MAGIC, 4);
+    h[4] = TRACE_VERSION;
+    h[5] = vm->quirks;      // 0 (modern) in traces from before quirk profiles
+    h[6] = h[7] = 0;
+    savestate_save(vm, h + 8);
+    t->keys = chip8_key_mask(vm);
+    put16(h + 8 + SAVESTATE_SIZE, t->keys);
+    t->used = TRACE_HEADER_SIZE;
+    t->bytes = TRACE_HEADER_SIZE;
+    return false;
+}
+
+bool trace_close(Chip8Trace *t)
+{
+    uint8_t *o = trace_reserve(t);
+    o[0] = TRACE_EV_END;
+    put64(o + 1, t->instructions);
+    put64(o + 9, t->frames);
+    t->used += 17;
+    t->bytes += 17;
+    trace_submit(t);
+
+    pthread_mutex_lock(&t->lock);
+    t->closing = true;
+    pthread_cond_signal(&t->ready);
+    pthread_mutex_unlock(&t->lock);
+    pthread_join(t->writer, NULL);
+
+    bool failed = t->failed;
+    failed |= close(t->fd) != 0;
+    if (failed)
+        log_msg(LOG_ERROR, "Couldn't write trace: '%s'", t->path);
+    for (int c = 0; c < TRACE_CHUNKS; c++)
+        free(t->chunks[c]);
+    pthread_mutex_destroy(&t->lock);
+    pthread_cond_destroy(&t->ready);
+    pthread_cond_destroy(&t->freed);
+    return failed;
+}
+
+bool trace_run(Chip8Trace *t, Chip8 *vm, uint32_t budget, uint32_t *executed)
+{
+    uint32_t count = 0;
+    bool failed = false;
+    bool drawn = false;
+    while (count < budget && !failed)
+    {
+        TraceSnap s;
+        trace_snap(&s, vm);
+        failed = chip8_run(vm, 1, NULL);
+        drawn |= vm->draw_flag;
+        count++;
+        uint8_t *o = trace_reserve(t);
+        size_t len = trace_encode(o, &s, vm);
+        if (failed)
+            o[len++] = TRACE_EV_FAULT;
+        t->used += len;
+        t->bytes += len;
+    }
+    vm->draw_flag = drawn;      // chip8_run only reports the last instruction
+    t->instructions += count;
+    if (executed)
+        *executed = count;
+    return failed;
+}
+
+void trace_frame(Chip8Trace *t, const Chip8 *vm)
+{
+    uint8_t *o = trace_reserve(t);
+    uint16_t keys = chip8_key_mask(vm);
+    if (keys != t->keys)
+    {
+        o[0] = TRACE_EV_KEYS;
+        put16(o + 1, keys);
+        t->keys = keys;
+        t->used += 3;
+        t->bytes += 3;
+    }
+    else
+    {
+        o[0] = TRACE_EV_FRAME;
+        t->used++;
+        t->bytes++;
+    }
+    t->frames++;
+}
@@ -0,0 +1,124 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "chip8.h"
+#include "savestate.h"
+
+/* Execution trace: every executed instruction as a delta against the state before it, for finding divergences.
+    A trace is a header (magic, version, quirk profile, savestate image and key state of the VM when tracing
+    started) followed by one record per instruction and one per frame. pc and opcode are implied: the reader
+    replays from the header state, so an instruction record only holds what changed (new pc if it didn't just
+    advance, changed V registers, timers, I, sp and pushed return address, bytes written to memory and a display
+    digest after 00E0/Dxyn). A plain register op costs 3 bytes, straight-line code without side effects 1.
+    Records are appended to 1 MB chunks that a background thread writes out, the VM only blocks if the disk
+    falls TRACE_CHUNKS chunks behind. chip8-replay re-executes a trace through chip8_cycle and reports the first
+    record that differs */
+
+#define TRACE_MAGIC "C8TR"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE (8 + SAVESTATE_SIZE + 2)  // magic, version, quirk profile, savestate image, key mask
+#define TRACE_CHUNK (1u << 20)                      // Bytes handed to the writer thread at a time
+#define TRACE_CHUNKS 4                              // Chunks being filled or written
+#define TRACE_RECORD_MAX 64                         // Largest encoded record
+
+// Instruction record tag bits: which fields follow, in this order
+enum {
+    TRACE_PC      = 1 << 0,     // u16 pc, when it isn't the instruction's address + 2
+    TRACE_V       = 1 << 1,     // u8 register and u8 value, or 0xFF, u16 mask and one value per set bit
+    TRACE_TIMERS  = 1 << 2,     // u8 delay, u8 sound
+    TRACE_I       = 1 << 3,     // u16 I
+    TRACE_STACK   = 1 << 4,     // u8 sp (| TRACE_PUSH if a u16 return address follows)
+    TRACE_MEM     = 1 << 5,     // u16 address, u8 length, bytes written (Fx33, Fx55)
+    TRACE_DISPLAY = 1 << 6,     // u64 display digest (00E0, Dxyn)
+    TRACE_EVENT   = 1 << 7      // Not an instruction: the tag is one of the TRACE_EV_* values
+};
+
+#define TRACE_PUSH 0x80             // TRACE_STACK flag: the instruction pushed a return address
+
+// Non-instruction records
+enum {
+    TRACE_EV_FRAME = 0x80,      // Timers ticked
+    TRACE_EV_KEYS  = 0x81,      // Timers ticked, then u16 key mask (bit k = key k pressed) changed
+    TRACE_EV_FAULT = 0x82,      // The previous instruction failed, the run stopped
+    TRACE_EV_END   = 0x83       // u64 instructions, u64 frames; a trace without it was cut short
+};
+
+// One decoded record
+typedef struct {
+    uint8_t tag;
+    uint16_t pc;                            // TRACE_PC
+    uint16_t v_mask;                        // TRACE_V: changed registers and their new values
+    uint8_t V[CHIP8_REGISTER_COUNT];
+    uint8_t delay, sound;                   // TRACE_TIMERS
+    uint16_t I;                             // TRACE_I
+    uint8_t sp;                             // TRACE_STACK
+    bool push;
+    uint16_t pushed;
+    uint16_t mem_addr;                      // TRACE_MEM
+    uint8_t mem_len;
+    uint8_t mem[CHIP8_REGISTER_COUNT];
+    uint64_t display;                       // TRACE_DISPLAY
+    uint16_t keys;                          // TRACE_EV_KEYS
+    uint64_t instructions, frames;          // TRACE_EV_END
+} TraceRecord;
+
+// VM state an instruction record is relative to, taken just before executing it
+typedef struct {
+    uint16_t pc;
+    uint16_t I;
+    uint16_t opcode;
+    uint8_t sp;
+    uint8_t delay, sound;
+    uint8_t V[CHIP8_REGISTER_COUNT];
+} TraceSnap;
+
+typedef struct {
+    int fd;
+    const char *path;
+    uint8_t *chunks[TRACE_CHUNKS];
+    size_t lengths[TRACE_CHUNKS];
+    unsigned fill;                  // Chunk being filled by the VM thread
+    size_t used;                    // Bytes in it
+    unsigned head, queued;          // Full chunks waiting for the writer: head .. head + queued - 1
+    bool closing;
+    bool failed;                    // A write failed, set by the writer
+    pthread_mutex_t lock;
+    pthread_cond_t ready;           // A chunk was queued or the trace is closing
+    pthread_cond_t freed;           // The writer finished a chunk
+    pthread_t writer;
+    uint16_t keys;                  // Key mask at the last frame record
+    uint64_t instructions, frames;
+    uint64_t bytes;                 // Bytes written or queued so far, header included
+} Chip8Trace;
+
+/* Creates the trace file and starts its writer thread, the header captures vm's current state.
+Returns: true on failure (nothing to close) */
+bool trace_open(Chip8Trace *t, const char *path, const Chip8 *vm);
+
+/* Writes the END record, waits for the writer and closes the file.
+Returns: true if any part of the trace couldn't be written */
+bool trace_close(Chip8Trace *t);
+
+// chip8_run one instruction at a time, recording each. Same contract as chip8_run
+bool trace_run(Chip8Trace *t, Chip8 *vm, uint32_t budget, uint32_t *executed);
+
+// Records a frame boundary, call right after ticking the timers
+void trace_frame(Chip8Trace *t, const Chip8 *vm);
+
+// Captures the state an instruction record is relative to
+void trace_snap(TraceSnap *s, const Chip8 *vm);
+
+// Encodes what the instruction changed from s to vm into out (TRACE_RECORD_MAX bytes), returns the length
+size_t trace_encode(uint8_t *out, const TraceSnap *s, const Chip8 *vm);
+
+// Decodes one record, returns its length or 0 if `avail` bytes don't hold a complete, valid record
+size_t trace_decode(const uint8_t *in, size_t avail, TraceRecord *rec);
+
+// Formats the fields of a decoded record as text
+void trace_format(const TraceRecord *rec, char *buf, size_t size);
+
+#endif
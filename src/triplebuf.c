@@ -0,0 +1,36 @@
+#include <string.h>
+#include "triplebuf.h"
+
+/*
+    triplebuf.c implements the triple buffer with one atomic exchange per publish and per take:
+    - Acquire/release on the exchange orders the slot contents with the index handoff
+    - The writer and reader slot indexes are private to their thread
+*/
+
+void triplebuf_init(TripleBuffer *t)
+{
+    memset(t->slots, 0, sizeof(t->slots));
+    t->back = 0;
+    atomic_store_explicit(&t->middle, 1, memory_order_relaxed);
+    t->front = 2;
+}
+
+DisplayFrame *triplebuf_back(TripleBuffer *t)
+{
+    return &t->slots[t->back];
+}
+
+void triplebuf_publish(TripleBuffer *t)
+{
+    uint32_t old = atomic_exchange_explicit(&t->middle, t->back | TRIPLEBUF_FRESH, memory_order_acq_rel);
+    t->back = old & ~TRIPLEBUF_FRESH;
+}
+
+const DisplayFrame *triplebuf_take(TripleBuffer *t)
+{
+    if (!(atomic_load_explicit(&t->middle, memory_order_relaxed) & TRIPLEBUF_FRESH))
+        return NULL;
+    uint32_t old = atomic_exchange_explicit(&t->middle, t->front, memory_order_acq_rel);
+    t->front = old & ~TRIPLEBUF_FRESH;
+    return &t->slots[t->front];
+}
@@ -0,0 +1,39 @@
+#ifndef TRIPLEBUF_H
+#define TRIPLEBUF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "chip8.h"
+
+/* Lock-free triple buffer handing display frames from the emulation thread to the render thread.
+    Three slots: the writer fills its back slot and swaps it with the shared middle one, the reader swaps its front
+    slot with the middle one when a newer frame is there. Neither side ever waits: the writer overwrites frames the
+    reader didn't get to and the reader keeps showing its front slot until a new frame arrives */
+
+#define TRIPLEBUF_FRESH 4u      // Middle flag: published since the reader's last take
+
+typedef struct {
+    uint64_t display[CHIP8_DISPLAY_HEIGHT];
+    uint64_t frame;             // Emulated frames since the ROM started
+} DisplayFrame;
+
+typedef struct {
+    DisplayFrame slots[3];
+    _Atomic uint32_t middle;    // Shared slot index | TRIPLEBUF_FRESH
+    _Alignas(64) uint32_t back; // Writer's slot
+    _Alignas(64) uint32_t front;// Reader's slot
+} TripleBuffer;
+
+void triplebuf_init(TripleBuffer *t);
+
+// Writer: the slot to fill before triplebuf_publish
+DisplayFrame *triplebuf_back(TripleBuffer *t);
+
+// Writer: makes the back slot the latest frame
+void triplebuf_publish(TripleBuffer *t);
+
+// Reader: the latest frame if one was published since the last call, NULL otherwise
+const DisplayFrame *triplebuf_take(TripleBuffer *t);
+
+#endif